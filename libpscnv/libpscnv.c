@@ -36,6 +36,26 @@ int pscnv_gem_new(int fd, uint32_t cookie, uint32_t flags, uint32_t tile_flags,
 	return 0;
 }
 
+int pscnv_gem_new_aligned(int fd, uint32_t cookie, uint32_t flags, uint32_t tile_flags, uint64_t size, uint64_t align, uint32_t *user, uint32_t *handle, uint64_t *map_handle) {
+	int ret;
+	struct drm_pscnv_gem_new_aligned req;
+	req.info.cookie = cookie;
+	req.info.flags = flags;
+	req.info.tile_flags = tile_flags;
+	req.info.size = size;
+	req.align = align;
+	if (user)
+		memcpy(req.info.user, user, sizeof(req.info.user));
+	ret = drmCommandWriteRead(fd, DRM_PSCNV_GEM_NEW_ALIGNED, &req, sizeof(req));
+	if (ret)
+		return ret;
+	if (handle)
+		*handle = req.info.handle;
+	if (map_handle)
+		*map_handle = req.info.map_handle;
+	return 0;
+}
+
 int pscnv_gem_info(int fd, uint32_t handle, uint32_t *cookie, uint32_t *flags, uint32_t *tile_flags, uint64_t *size, uint64_t *map_handle, uint32_t *user) {
 	int ret;
 	struct drm_pscnv_gem_info req;
@@ -90,6 +110,24 @@ int pscnv_gem_open(int fd, uint32_t name, uint32_t *handle, uint64_t *size) {
 	return 0;
 }
 
+int pscnv_gem_sync(int fd, uint32_t handle, uint32_t flags) {
+	struct drm_pscnv_gem_sync req;
+	req.handle = handle;
+	req.flags = flags;
+	return drmCommandWriteRead(fd, DRM_PSCNV_GEM_SYNC, &req, sizeof(req));
+}
+
+int pscnv_gem_new_transfer(int fd, uint32_t cookie, uint64_t size, uint32_t dir, uint32_t *handle, uint64_t *map_handle) {
+	/* host reads of WC or UC VRAM are uncached, so downloads go through
+	 * a cached staging copy. Uploads write-combine straight to VRAM. */
+	uint32_t flags = PSCNV_GEM_MAPPABLE;
+	if (dir == PSCNV_GEM_SYNC_FROM_VRAM)
+		flags |= PSCNV_GEM_MAP_CACHED;
+	else
+		flags |= PSCNV_GEM_MAP_WC;
+	return pscnv_gem_new(fd, cookie, flags, 0, size, 0, handle, map_handle);
+}
+
 int pscnv_vspace_new(int fd, uint32_t *vid) {
 	int ret;
 	struct drm_pscnv_vspace_req req;
@@ -131,6 +169,77 @@ int pscnv_vspace_unmap(int fd, uint32_t vid, uint64_t offset) {
 	return drmCommandWriteRead(fd, DRM_PSCNV_VSPACE_UNMAP, &req, sizeof(req));
 }
 
+int pscnv_vspace_map_range(int fd, uint32_t vid, uint32_t handle, uint64_t bo_offset, uint64_t length, uint64_t start, uint64_t end, uint32_t back, uint32_t flags, uint64_t *offset) {
+	int ret;
+	struct drm_pscnv_vspace_map_range req;
+	req.vid = vid;
+	req.handle = handle;
+	req.bo_offset = bo_offset;
+	req.length = length;
+	req.start = start;
+	req.end = end;
+	req.back = back;
+	req.flags = flags;
+	ret = drmCommandWriteRead(fd, DRM_PSCNV_VSPACE_MAP_RANGE, &req, sizeof(req));
+	if (ret)
+		return ret;
+	if (offset)
+		*offset = req.offset;
+	return 0;
+}
+
+int pscnv_vspace_remap(int fd, uint32_t vid, uint64_t offset, uint64_t bo_offset) {
+	struct drm_pscnv_vspace_remap req;
+	req.vid = vid;
+	req.offset = offset;
+	req.bo_offset = bo_offset;
+	return drmCommandWriteRead(fd, DRM_PSCNV_VSPACE_REMAP, &req, sizeof(req));
+}
+
+/* pscnv_vspace_map_req is passed to the kernel as is */
+typedef char pscnv_map_req_size_check[sizeof(struct pscnv_vspace_map_req) == sizeof(struct drm_pscnv_vspace_map_entry) ? 1 : -1];
+
+int pscnv_vspace_map_batch(int fd, uint32_t vid, struct pscnv_vspace_map_req *reqs, uint32_t count) {
+	struct drm_pscnv_vspace_map_batch req;
+	req.vid = vid;
+	req.count = count;
+	req.entries = (uintptr_t)reqs;
+	return drmCommandWriteRead(fd, DRM_PSCNV_VSPACE_MAP_BATCH, &req, sizeof(req));
+}
+
+int pscnv_vspace_unmap_batch(int fd, uint32_t vid, const uint64_t *offsets, int32_t *results, uint32_t count) {
+	struct drm_pscnv_vspace_unmap_batch req;
+	req.vid = vid;
+	req.count = count;
+	req.offsets = (uintptr_t)offsets;
+	req.results = (uintptr_t)results;
+	return drmCommandWriteRead(fd, DRM_PSCNV_VSPACE_UNMAP_BATCH, &req, sizeof(req));
+}
+
+int pscnv_vspace_reserve(int fd, uint32_t vid, uint64_t size, uint64_t start, uint64_t end, uint32_t back, uint32_t flags, uint64_t *offset) {
+	int ret;
+	struct drm_pscnv_vspace_reserve req;
+	req.vid = vid;
+	req.size = size;
+	req.start = start;
+	req.end = end;
+	req.back = back;
+	req.flags = flags;
+	ret = drmCommandWriteRead(fd, DRM_PSCNV_VSPACE_RESERVE, &req, sizeof(req));
+	if (ret)
+		return ret;
+	if (offset)
+		*offset = req.offset;
+	return 0;
+}
+
+int pscnv_vspace_unreserve(int fd, uint32_t vid, uint64_t offset) {
+	struct drm_pscnv_vspace_unmap req;
+	req.vid = vid;
+	req.offset = offset;
+	return drmCommandWriteRead(fd, DRM_PSCNV_VSPACE_UNRESERVE, &req, sizeof(req));
+}
+
 int pscnv_chan_new(int fd, uint32_t vid, uint32_t *cid, uint64_t *map_handle) {
 	int ret;
 	struct drm_pscnv_chan_new req;
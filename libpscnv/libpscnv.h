@@ -13,17 +13,52 @@
 #define PSCNV_GEM_CONTIG	0x00000001	/* needs to be contiguous in VRAM */
 #define PSCNV_GEM_MAPPABLE	0x00000002	/* intended to be mmapped by host */
 #define PSCNV_GEM_GART		0x00000004	/* should be allocated in GART */
+#define PSCNV_GEM_SPREAD	0x00000008	/* spread evenly over memory partitions */
+#define PSCNV_GEM_HOT		0x00000010	/* small and busy, keep with other hot objects */
+/* how the host mmaps the BO */
+#define PSCNV_GEM_MAP_MASK	0x00000300
+#define PSCNV_GEM_MAP_WC	0x00000000	/* write-combined, for uploads */
+#define PSCNV_GEM_MAP_UC	0x00000100	/* uncached */
+#define PSCNV_GEM_MAP_CACHED	0x00000200	/* cached host staging copy, moved with gem_sync */
+
+#define PSCNV_GEM_SYNC_TO_VRAM		0x00000001	/* staging copy -> VRAM */
+#define PSCNV_GEM_SYNC_FROM_VRAM	0x00000002	/* VRAM -> staging copy */
+
+#define PSCNV_MAP_FIXED		0x00000001	/* map at exactly start, which has to be free or reserved */
 
 int pscnv_getparam(int fd, uint64_t param, uint64_t *value);
 int pscnv_gem_new(int fd, uint32_t cookie, uint32_t flags, uint32_t tile_flags, uint64_t size, uint32_t *user, uint32_t *handle, uint64_t *map_handle);
+/* as pscnv_gem_new, with the VRAM placed at a power of two alignment. BOs
+ * aligned to 64kiB can be mapped with large pages. */
+int pscnv_gem_new_aligned(int fd, uint32_t cookie, uint32_t flags, uint32_t tile_flags, uint64_t size, uint64_t align, uint32_t *user, uint32_t *handle, uint64_t *map_handle);
 int pscnv_gem_info(int fd, uint32_t handle, uint32_t *cookie, uint32_t *flags, uint32_t *tile_flags, uint64_t *size, uint64_t *map_handle, uint32_t *user);
 int pscnv_gem_close(int fd, uint32_t handle);
 int pscnv_gem_flink(int fd, uint32_t handle, uint32_t *name);
 int pscnv_gem_open(int fd, uint32_t name, uint32_t *handle, uint64_t *size);
+int pscnv_gem_sync(int fd, uint32_t handle, uint32_t flags);
+/* a mappable BO for moving data in one direction, PSCNV_GEM_SYNC_TO_VRAM
+ * or PSCNV_GEM_SYNC_FROM_VRAM, mapped the way that's fastest for it. */
+int pscnv_gem_new_transfer(int fd, uint32_t cookie, uint64_t size, uint32_t dir, uint32_t *handle, uint64_t *map_handle);
 int pscnv_vspace_new(int fd, uint32_t *vid);
 int pscnv_vspace_free(int fd, uint32_t vid);
 int pscnv_vspace_map(int fd, uint32_t vid, uint32_t handle, uint64_t start, uint64_t end, uint32_t back, uint32_t flags, uint64_t *offset);
 int pscnv_vspace_unmap(int fd, uint32_t vid, uint64_t offset);
+int pscnv_vspace_map_range(int fd, uint32_t vid, uint32_t handle, uint64_t bo_offset, uint64_t length, uint64_t start, uint64_t end, uint32_t back, uint32_t flags, uint64_t *offset);
+int pscnv_vspace_remap(int fd, uint32_t vid, uint64_t offset, uint64_t bo_offset);
+/* one BO to map with pscnv_vspace_map_batch. result and offset are filled in. */
+struct pscnv_vspace_map_req {
+	uint32_t handle;
+	uint32_t back;
+	uint64_t start;
+	uint64_t end;
+	uint32_t flags;
+	int32_t result;		/* 0 or -errno */
+	uint64_t offset;
+};
+int pscnv_vspace_map_batch(int fd, uint32_t vid, struct pscnv_vspace_map_req *reqs, uint32_t count);
+int pscnv_vspace_unmap_batch(int fd, uint32_t vid, const uint64_t *offsets, int32_t *results, uint32_t count);
+int pscnv_vspace_reserve(int fd, uint32_t vid, uint64_t size, uint64_t start, uint64_t end, uint32_t back, uint32_t flags, uint64_t *offset);
+int pscnv_vspace_unreserve(int fd, uint32_t vid, uint64_t offset);
 int pscnv_chan_new(int fd, uint32_t vid, uint32_t *cid, uint64_t *map_handle);
 int pscnv_chan_free(int fd, uint32_t cid);
 int pscnv_obj_vdma_new(int fd, uint32_t cid, uint32_t handle, uint32_t oclass, uint32_t flags, uint64_t start, uint64_t size);
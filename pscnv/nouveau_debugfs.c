@@ -142,6 +142,87 @@ nouveau_debugfs_memory_info(struct seq_file *m, void *data)
 	struct drm_nouveau_private *dev_priv = minor->dev->dev_private;
 
 	seq_printf(m, "VRAM total: %dKiB\n", (int)(dev_priv->vram_size >> 10));
+	mutex_lock(&dev_priv->vram_mutex);
+	seq_printf(m, "VRAM free: %lldKiB untyped, %lldKiB sane, %lldKiB LSR\n",
+		   dev_priv->vram_free_bytes[PSCNV_VRAM_FREE_UNTYPED] >> 10,
+		   dev_priv->vram_free_bytes[PSCNV_VRAM_FREE_SANE] >> 10,
+		   dev_priv->vram_free_bytes[PSCNV_VRAM_FREE_LSR] >> 10);
+	seq_printf(m, "VRAM reserve: %lldKiB sane, %lldKiB LSR\n",
+		   dev_priv->vram_reserve[0] >> 10, dev_priv->vram_reserve[1] >> 10);
+	seq_printf(m, "rblocks typed: %lld sane, %lld LSR\n",
+		   dev_priv->vram_typed[0], dev_priv->vram_typed[1]);
+	seq_printf(m, "rblocks untyped: %lld sane, %lld LSR\n",
+		   dev_priv->vram_untyped[0], dev_priv->vram_untyped[1]);
+	mutex_unlock(&dev_priv->vram_mutex);
+	mutex_lock(&dev_priv->vram_scrub_mutex);
+	seq_printf(m, "zeroed VOs: %lld from the pools, %lld cleared in place in %lldus\n",
+		   dev_priv->vram_scrub_hits, dev_priv->vram_scrub_fg_clears,
+		   dev_priv->vram_scrub_fg_ns / 1000);
+	seq_printf(m, "background clearing: %lldus, %lldus of it taken off allocations\n",
+		   dev_priv->vram_scrub_bg_ns / 1000, dev_priv->vram_scrub_saved_ns / 1000);
+	mutex_unlock(&dev_priv->vram_scrub_mutex);
+	if (dev_priv->vm) {
+		mutex_lock(&dev_priv->bar1_mutex);
+		seq_printf(m, "BAR1 windows: %lld hits, %lld misses, %lld evicted\n",
+			   dev_priv->bar1_hits, dev_priv->bar1_misses, dev_priv->bar1_evictions);
+		mutex_unlock(&dev_priv->bar1_mutex);
+	}
+	return 0;
+}
+
+static int
+nouveau_debugfs_vspace_info_one(int i, void *p, void *data)
+{
+	struct pscnv_vspace *vs = p;
+	struct seq_file *m = data;
+
+	mutex_lock(&vs->lock);
+	seq_printf(m, "vspace %d: %lld small PTEs, %lld large PTEs, %d page tables split, %d reclaimed\n",
+		   i, vs->pte_small, vs->pte_large, vs->pt_splits, vs->pt_reclaims);
+	seq_printf(m, "vspace %d: %lld TLB flushes requested, %lld done\n",
+		   i, vs->tlb_flush_requests, vs->tlb_flushes);
+	seq_printf(m, "vspace %d: %d map nodes\n", i, vs->map_nodes);
+	mutex_unlock(&vs->lock);
+	return 0;
+}
+
+static int
+nouveau_debugfs_vspace_info(struct seq_file *m, void *data)
+{
+	struct drm_info_node *node = (struct drm_info_node *) m->private;
+	struct drm_nouveau_private *dev_priv = node->minor->dev->dev_private;
+
+	mutex_lock(&dev_priv->vm_mutex);
+	idr_for_each(&dev_priv->vspace_idr, nouveau_debugfs_vspace_info_one, m);
+	mutex_unlock(&dev_priv->vm_mutex);
+	return 0;
+}
+
+static int
+nouveau_debugfs_pagetables_one(int i, void *p, void *data)
+{
+	struct pscnv_vspace *vs = p;
+	struct drm_nouveau_private *dev_priv = vs->dev->dev_private;
+	struct seq_file *m = data;
+
+	mutex_lock(&vs->lock);
+	seq_printf(m, "vspace %d:\n", i);
+	dev_priv->vm->dump(vs, m);
+	mutex_unlock(&vs->lock);
+	return 0;
+}
+
+static int
+nouveau_debugfs_pagetables(struct seq_file *m, void *data)
+{
+	struct drm_info_node *node = (struct drm_info_node *) m->private;
+	struct drm_nouveau_private *dev_priv = node->minor->dev->dev_private;
+
+	if (!dev_priv->vm->dump)
+		return -ENODEV;
+	mutex_lock(&dev_priv->vm_mutex);
+	idr_for_each(&dev_priv->vspace_idr, nouveau_debugfs_pagetables_one, m);
+	mutex_unlock(&dev_priv->vm_mutex);
 	return 0;
 }
 
@@ -160,6 +241,8 @@ nouveau_debugfs_vbios_image(struct seq_file *m, void *data)
 static struct drm_info_list nouveau_debugfs_list[] = {
 	{ "chipset", nouveau_debugfs_chipset_info, 0, NULL },
 	{ "memory", nouveau_debugfs_memory_info, 0, NULL },
+	{ "vspaces", nouveau_debugfs_vspace_info, 0, NULL },
+	{ "pagetables", nouveau_debugfs_pagetables, 0, NULL },
 	{ "vbios.rom", nouveau_debugfs_vbios_image, 0, NULL },
 };
 #define NOUVEAU_DEBUGFS_ENTRIES ARRAY_SIZE(nouveau_debugfs_list)
@@ -39,6 +39,12 @@ nouveau_user_framebuffer_destroy(struct drm_framebuffer *drm_fb)
 	if (drm_fb->fbdev)
 		nouveau_fbcon_remove(dev, drm_fb);
 
+	if (fb->vo) {
+		mutex_lock(&fb->vo->maps_lock);
+		fb->vo->pinned--;
+		mutex_unlock(&fb->vo->maps_lock);
+	}
+
 	if (fb->vo && fb->vo->gem)
 		drm_gem_object_unreference_unlocked(fb->vo->gem);
 
@@ -81,6 +87,10 @@ nouveau_framebuffer_create(struct drm_device *dev, struct pscnv_vo *vo,
 
 	drm_helper_mode_fill_fb_struct(&fb->base, mode_cmd);
 
+	/* scanout reads VRAM directly, keep compaction away from it */
+	mutex_lock(&vo->maps_lock);
+	vo->pinned++;
+	mutex_unlock(&vo->maps_lock);
 	fb->vo = vo;
 	return &fb->base;
 }
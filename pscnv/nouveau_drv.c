@@ -104,10 +104,39 @@ MODULE_PARM_DESC(vram_debug, "VRAM debug level: 0-3.");
 int pscnv_vram_debug = 0;
 module_param_named(vram_debug, pscnv_vram_debug, int, 0400);
 
+MODULE_PARM_DESC(vram_policy, "VRAM placement policy: 0 = first fit, 1 = size class.");
+int pscnv_vram_policy = PSCNV_VRAM_POLICY_FIRST_FIT;
+module_param_named(vram_policy, pscnv_vram_policy, int, 0600);
+
+MODULE_PARM_DESC(vram_compact, "VRAM compaction: 0 = off (default), 1 = on contig allocation failure, 2 = also in background. "
+		"Only moves GEM objects not mapped into any vspace with a channel.");
+int pscnv_vram_compact_mode = PSCNV_VRAM_COMPACT_OFF;
+module_param_named(vram_compact, pscnv_vram_compact_mode, int, 0600);
+
+MODULE_PARM_DESC(vram_trace, "Number of VRAM allocator calls to keep in the debugfs trace, 0 = off.");
+int pscnv_vram_trace_records = 0;
+module_param_named(vram_trace, pscnv_vram_trace_records, int, 0400);
+
+MODULE_PARM_DESC(vram_reserve_sane, "Free VRAM kept typed for sane pages, in KiB.");
+int pscnv_vram_reserve_sane = 4096;
+module_param_named(vram_reserve_sane, pscnv_vram_reserve_sane, int, 0400);
+
+MODULE_PARM_DESC(vram_reserve_lsr, "Free VRAM kept typed for LSR pages, in KiB.");
+int pscnv_vram_reserve_lsr = 4096;
+module_param_named(vram_reserve_lsr, pscnv_vram_reserve_lsr, int, 0400);
+
+MODULE_PARM_DESC(vram_scrub, "Number of pre-zeroed VOs to keep around for each kind of zeroed allocation, 0 = off.");
+int pscnv_vram_scrub_depth = 2;
+module_param_named(vram_scrub, pscnv_vram_scrub_depth, int, 0600);
+
 MODULE_PARM_DESC(vm_debug, "VM debug level: 0-2.");
 int pscnv_vm_debug = 0;
 module_param_named(vm_debug, pscnv_vm_debug, int, 0400);
 
+MODULE_PARM_DESC(mmap_prefault, "Pages of a VRAM mmap to map in after the faulting one, 0 = just the faulting page, -1 = the whole mapping.");
+int pscnv_mmap_prefault = 15;
+module_param_named(mmap_prefault, pscnv_mmap_prefault, int, 0600);
+
 MODULE_PARM_DESC(ramht_debug, "RAMHT debug level: 0-2.");
 int pscnv_ramht_debug = 0;
 module_param_named(ramht_debug, pscnv_ramht_debug, int, 0400);
@@ -395,7 +424,9 @@ static struct drm_driver driver = {
 	.firstopen = nouveau_firstopen,
 	.lastclose = nouveau_lastclose,
 	.unload = nouveau_unload,
+	.open = nouveau_open,
 	.preclose = nouveau_preclose,
+	.postclose = nouveau_postclose,
 #if defined(CONFIG_DRM_NOUVEAU_DEBUG)
 	.debugfs_init = nouveau_debugfs_init,
 	.debugfs_cleanup = nouveau_debugfs_takedown,
@@ -491,6 +522,14 @@ struct drm_ioctl_desc nouveau_ioctls[] = {
 	DRM_IOCTL_DEF(DRM_PSCNV_FIFO_INIT, pscnv_ioctl_fifo_init, DRM_UNLOCKED),
 	DRM_IOCTL_DEF(DRM_PSCNV_OBJ_ENG_NEW, pscnv_ioctl_obj_eng_new, DRM_UNLOCKED),
 	DRM_IOCTL_DEF(DRM_PSCNV_FIFO_INIT_IB, pscnv_ioctl_fifo_init_ib, DRM_UNLOCKED),
+	DRM_IOCTL_DEF(DRM_PSCNV_VSPACE_MAP_BATCH, pscnv_ioctl_vspace_map_batch, DRM_UNLOCKED),
+	DRM_IOCTL_DEF(DRM_PSCNV_VSPACE_UNMAP_BATCH, pscnv_ioctl_vspace_unmap_batch, DRM_UNLOCKED),
+	DRM_IOCTL_DEF(DRM_PSCNV_VSPACE_RESERVE, pscnv_ioctl_vspace_reserve, DRM_UNLOCKED),
+	DRM_IOCTL_DEF(DRM_PSCNV_VSPACE_UNRESERVE, pscnv_ioctl_vspace_unreserve, DRM_UNLOCKED),
+	DRM_IOCTL_DEF(DRM_PSCNV_VSPACE_MAP_RANGE, pscnv_ioctl_vspace_map_range, DRM_UNLOCKED),
+	DRM_IOCTL_DEF(DRM_PSCNV_VSPACE_REMAP, pscnv_ioctl_vspace_remap, DRM_UNLOCKED),
+	DRM_IOCTL_DEF(DRM_PSCNV_GEM_SYNC, pscnv_ioctl_gem_sync, DRM_UNLOCKED),
+	DRM_IOCTL_DEF(DRM_PSCNV_GEM_NEW_ALIGNED, pscnv_ioctl_gem_new_aligned, DRM_UNLOCKED),
 };
 
 int nouveau_max_ioctl = DRM_ARRAY_SIZE(nouveau_ioctls);
@@ -247,6 +247,14 @@ enum nouveau_card_type {
 	NV_C0      = 0xc0,
 };
 
+/* per-file state, file_priv->driver_priv */
+struct pscnv_fpriv {
+	/* vspaces and channels owned by the file, linked by their
+	 * file_list. Protected by vm_mutex. */
+	struct list_head vspaces;
+	struct list_head chans;
+};
+
 struct drm_nouveau_private {
 	struct drm_device *dev;
 	enum {
@@ -327,13 +335,69 @@ struct drm_nouveau_private {
 	uint64_t mmio_phys;
 
 	struct list_head vram_global_list;
-	struct list_head vram_free_list;
+	/* free regions, indexed by free type */
+	struct pscnv_vram_freetree vram_free_tree[PSCNV_VRAM_LAST_FREE + 1];
+	struct list_head vram_free_bucket[PSCNV_VRAM_LAST_FREE + 1][PSCNV_VRAM_BUCKETS];
 	uint32_t vram_rblock_size;
+	/* free bytes of each free type */
+	uint64_t vram_free_bytes[PSCNV_VRAM_LAST_FREE + 1];
+	/* bytes of free sane and LSR space that are kept typed */
+	uint64_t vram_reserve[2];
+	/* rblocks typed for, and untyped after, sane and LSR pages */
+	uint64_t vram_typed[2];
+	uint64_t vram_untyped[2];
+	/* memory layout: a row spans all partitions, each of them holding
+	 * vram_part_stride bytes of it */
+	int vram_parts;
+	uint32_t vram_row_size;
+	uint32_t vram_part_stride;
+	/* row the last hot VO went to, sane and LSR, or ~0 */
+	uint64_t vram_hot_row[2];
 	struct mutex vram_mutex;
-
-	struct pscnv_vspace *vspaces[128];
-	struct pscnv_chan *chans[128];
+	/* spare region descriptors, so that splits don't kmalloc */
+	struct list_head vram_pool;
+	int vram_pool_count;
+	spinlock_t vram_pool_lock;
+	/* 4kiB kernel objects: channel caches, playlists */
+	struct pscnv_vram_slab *vram_slab;
+	/* compaction */
+	struct pscnv_vram_mover *vram_mover;
+	struct mutex vram_compact_mutex;
+	struct delayed_work vram_compact_work;
+	uint64_t vram_compact_moved;
+	uint64_t vram_compact_bytes;
+	/* pre-zeroed VO pools */
+	struct pscnv_vram_scrub_class vram_scrub[PSCNV_VRAM_SCRUB_CLASSES];
+	struct mutex vram_scrub_mutex;
+	struct work_struct vram_scrub_work;
+	uint64_t vram_scrub_hits;
+	uint64_t vram_scrub_fg_clears;
+	uint64_t vram_scrub_fg_ns;
+	uint64_t vram_scrub_bg_ns;
+	uint64_t vram_scrub_saved_ns;
+	/* allocation trace ring, see pscnv_vram_trace.c */
+	struct pscnv_vram_trace_rec *vram_trace;
+	int vram_trace_size;
+	uint64_t vram_trace_count;
+	uint64_t vram_trace_epoch;
+	spinlock_t vram_trace_lock;
+	struct dentry *vram_trace_dentry;
+
+	/* vspaces and channels by ID. Protected by vm_mutex. */
+	struct idr vspace_idr;
+	struct idr chan_idr;
 	struct mutex vm_mutex;
+	/* VOs with a BAR1 window for mmap, least recently faulted in
+	 * first. Windows are evicted from the front when BAR1 fills up. */
+	struct mutex bar1_mutex;
+	struct list_head bar1_lru;
+	uint64_t bar1_hits;
+	uint64_t bar1_misses;
+	uint64_t bar1_evictions;
+	/* GEM VOs by mmap ID. Keyed by VO rather than by handle, so that
+	 * zapping an mmap offset only hits mappings of that VO. Protected
+	 * by struct_mutex. */
+	struct idr mmap_idr;
 
 	/* for slow-path nv_wv32/nv_rv32 */
 
@@ -363,7 +427,6 @@ struct drm_nouveau_private {
 	struct backlight_device *backlight;
 
 	struct nouveau_channel *evo;
-	struct pscnv_vo *evo_obj;
 
 	struct {
 		struct dentry *channel_root;
@@ -415,7 +478,14 @@ extern int nouveau_tv_disable;
 extern char *nouveau_tv_norm;
 extern int nouveau_reg_debug;
 extern int pscnv_vram_debug;
+extern int pscnv_vram_policy;
+extern int pscnv_vram_compact_mode;
+extern int pscnv_vram_trace_records;
+extern int pscnv_vram_reserve_sane;
+extern int pscnv_vram_reserve_lsr;
+extern int pscnv_vram_scrub_depth;
 extern int pscnv_vm_debug;
+extern int pscnv_mmap_prefault;
 extern int pscnv_gem_debug;
 extern int pscnv_ramht_debug;
 extern char *nouveau_vbios;
@@ -432,7 +502,9 @@ extern int nouveau_pci_suspend(struct pci_dev *pdev, pm_message_t pm_state);
 extern int nouveau_pci_resume(struct pci_dev *pdev);
 
 /* nouveau_state.c */
+extern int  nouveau_open(struct drm_device *dev, struct drm_file *);
 extern void nouveau_preclose(struct drm_device *dev, struct drm_file *);
+extern void nouveau_postclose(struct drm_device *dev, struct drm_file *);
 extern int  nouveau_load(struct drm_device *, unsigned long flags);
 extern int  nouveau_firstopen(struct drm_device *);
 extern void nouveau_lastclose(struct drm_device *);
@@ -1070,7 +1142,8 @@ static inline uint32_t nv_rv32(struct pscnv_vo *vo,
 	uint32_t res;
 	uint64_t addr = vo->start + offset;
 	if (vo->map3 && dev_priv->vm)
-		return ioread32_native(dev_priv->ramin + vo->map3->start - dev_priv->fb_size + offset);
+		return ioread32_native(dev_priv->ramin + vo->map3->start - dev_priv->fb_size
+				+ (vo->start - vo->map3->vo->start) + offset);
 	spin_lock(&dev_priv->pramin_lock);
 	if (addr >> 16 != dev_priv->pramin_start) {
 		dev_priv->pramin_start = addr >> 16;
@@ -1087,7 +1160,8 @@ static inline void nv_wv32(struct pscnv_vo *vo,
 	struct drm_nouveau_private *dev_priv = vo->dev->dev_private;
 	uint64_t addr = vo->start + offset;
 	if (vo->map3 && dev_priv->vm)
-		return iowrite32_native(val, dev_priv->ramin + vo->map3->start - dev_priv->fb_size + offset);
+		return iowrite32_native(val, dev_priv->ramin + vo->map3->start - dev_priv->fb_size
+				+ (vo->start - vo->map3->vo->start) + offset);
 	spin_lock(&dev_priv->pramin_lock);
 	if (addr >> 16 != dev_priv->pramin_start) {
 		dev_priv->pramin_start = addr >> 16;
@@ -1097,4 +1171,26 @@ static inline void nv_wv32(struct pscnv_vo *vo,
 	spin_unlock(&dev_priv->pramin_lock);
 }
 
+/* writes len bytes from buf at offset. One block copy through BAR3 if the
+ * VO is mapped there, otherwise one pass through the PRAMIN window. */
+static inline void nv_wvblock(struct pscnv_vo *vo,
+				unsigned offset, const uint32_t *buf, unsigned len)
+{
+	struct drm_nouveau_private *dev_priv = vo->dev->dev_private;
+	uint64_t addr = vo->start + offset;
+	unsigned i;
+	if (vo->map3 && dev_priv->vm)
+		return memcpy_toio(dev_priv->ramin + vo->map3->start - dev_priv->fb_size
+				+ (vo->start - vo->map3->vo->start) + offset, buf, len);
+	spin_lock(&dev_priv->pramin_lock);
+	for (i = 0; i < len / 4; i++, addr += 4) {
+		if (addr >> 16 != dev_priv->pramin_start) {
+			dev_priv->pramin_start = addr >> 16;
+			nv_wr32(vo->dev, 0x1700, addr >> 16);
+		}
+		nv_wr32(vo->dev, 0x700000 + (addr & 0xffff), buf[i]);
+	}
+	spin_unlock(&dev_priv->pramin_lock);
+}
+
 #endif /* __NOUVEAU_DRV_H__ */
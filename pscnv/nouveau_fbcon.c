@@ -247,7 +247,7 @@ nouveau_fbcon_create(struct drm_device *dev, uint32_t fb_width,
 	size = mode_cmd.pitch * mode_cmd.height;
 	size = roundup(size, PAGE_SIZE);
 
-	obj = pscnv_gem_new(dev, size, PSCNV_VO_CONTIG, 0, 0xd15fb, 0);
+	obj = pscnv_gem_new(dev, size, 0, PSCNV_VO_CONTIG, 0, 0xd15fb, 0);
 	if (!obj) {
 		ret = -ENOMEM;
 		NV_ERROR(dev, "failed to allocate framebuffer\n");
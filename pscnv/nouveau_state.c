@@ -232,6 +232,17 @@ static void nouveau_card_takedown(struct drm_device *dev)
 	}
 }
 
+int nouveau_open(struct drm_device *dev, struct drm_file *file_priv)
+{
+	struct pscnv_fpriv *fpriv = kzalloc(sizeof *fpriv, GFP_KERNEL);
+	if (!fpriv)
+		return -ENOMEM;
+	INIT_LIST_HEAD(&fpriv->vspaces);
+	INIT_LIST_HEAD(&fpriv->chans);
+	file_priv->driver_priv = fpriv;
+	return 0;
+}
+
 /* here a client dies, release the stuff that was allocated for its
  * file_priv */
 void nouveau_preclose(struct drm_device *dev, struct drm_file *file_priv)
@@ -240,6 +251,11 @@ void nouveau_preclose(struct drm_device *dev, struct drm_file *file_priv)
 	pscnv_vspace_cleanup(dev, file_priv);
 }
 
+void nouveau_postclose(struct drm_device *dev, struct drm_file *file_priv)
+{
+	kfree(file_priv->driver_priv);
+}
+
 /* first module load, setup the mmio/fb mapping */
 /* KMS: we need mmio at load time, not when the first drm client opens. */
 int nouveau_firstopen(struct drm_device *dev)
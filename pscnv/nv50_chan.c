@@ -5,12 +5,13 @@
 #include "pscnv_chan.h"
 #include "nv50_vm.h"
 
+/* sets up the channel's VO. The page directory is left to
+ * nv50_chan_fill_pd, which needs vs->lock. */
 int nv50_chan_new (struct pscnv_chan *ch) {
 	struct pscnv_vspace *vs = ch->vspace;
 	struct drm_nouveau_private *dev_priv = vs->dev->dev_private;
 	uint64_t size;
 	uint32_t chan_pd;
-	int i;
 	/* determine size of underlying VO... for normal channels,
 	 * allocate 64kiB since they have to store the objects
 	 * heap. for the BAR fake channel, we'll only need two objects,
@@ -22,26 +23,20 @@ int nv50_chan_new (struct pscnv_chan *ch) {
 		size = 0x6000;
 	else
 		size = 0x5000;
-	ch->vo = pscnv_vram_alloc(vs->dev, size, PSCNV_VO_CONTIG,
+	ch->vo = pscnv_vram_alloc(vs->dev, size, 0, PSCNV_VO_CONTIG,
 			0, (ch->isbar ? 0xc5a2ba7 : 0xc5a2f1f0));
 	if (!ch->vo)
 		return -ENOMEM;
 
-	if (!vs->isbar)
-		dev_priv->vm->map_kernel(ch->vo);
+	if (!vs->isbar && dev_priv->vm->map_kernel(ch->vo)) {
+		pscnv_vram_free(ch->vo);
+		return -ENOMEM;
+	}
 
 	if (dev_priv->chipset == 0x50)
 		chan_pd = NV50_CHAN_PD;
 	else
 		chan_pd = NV84_CHAN_PD;
-	for (i = 0; i < NV50_VM_PDE_COUNT; i++) {
-		if (nv50_vs(vs)->pt[i]) {
-			nv_wv32(ch->vo, chan_pd + i * 8 + 4, nv50_vs(vs)->pt[i]->start >> 32);
-			nv_wv32(ch->vo, chan_pd + i * 8, nv50_vs(vs)->pt[i]->start | 0x3);
-		} else {
-			nv_wv32(ch->vo, chan_pd + i * 8, 0);
-		}
-	}
 	ch->instpos = chan_pd + NV50_VM_PDE_COUNT * 8;
 
 	if (!ch->isbar) {
@@ -58,20 +53,42 @@ int nv50_chan_new (struct pscnv_chan *ch) {
 			/* actually, addresses of these two are NOT relative to
 			 * channel struct on NV84+, and can be anywhere in VRAM,
 			 * but we stuff them inside the channel struct anyway for
-			 * simplicity. */
+			 * simplicity. The cache is the 0x400-byte CACHE1 backing
+			 * store, so it comes from the device slab. */
 			ch->ramfc = nv50_chan_iobj_new(ch, 0x100);
-			ch->cache = pscnv_vram_alloc(vs->dev, 0x1000, PSCNV_VO_CONTIG,
-					0, 0xf1f0cace);
+			ch->cache = pscnv_vram_slab_alloc(dev_priv->vram_slab, 0xf1f0cace);
 			if (!ch->cache) {
+				pscnv_vspace_unmap_node(ch->vo->map3);
+				ch->vo->map3 = 0;
 				pscnv_vram_free(ch->vo);
 				return -ENOMEM;
 			}
 		}
 	}
-	dev_priv->vm->bar_flush(vs->dev);
 	return 0;
 }
 
+/* copies the vspace's page directory into the channel. Called with
+ * vs->lock held, so that no PDE changes in between. */
+void nv50_chan_fill_pd (struct pscnv_chan *ch) {
+	struct pscnv_vspace *vs = ch->vspace;
+	struct drm_nouveau_private *dev_priv = vs->dev->dev_private;
+	uint32_t chan_pd;
+	int i;
+	if (dev_priv->chipset == 0x50)
+		chan_pd = NV50_CHAN_PD;
+	else
+		chan_pd = NV84_CHAN_PD;
+	for (i = 0; i < NV50_VM_PDE_COUNT; i++) {
+		if (nv50_vs(vs)->pt[i]) {
+			nv_wv32(ch->vo, chan_pd + i * 8 + 4, nv50_vs_pde(vs, i) >> 32);
+			nv_wv32(ch->vo, chan_pd + i * 8, nv50_vs_pde(vs, i));
+		} else {
+			nv_wv32(ch->vo, chan_pd + i * 8, 0);
+		}
+	}
+}
+
 void nv50_chan_init (struct pscnv_chan *ch) {
 	struct drm_device *dev = ch->vspace->dev;
 	struct drm_nouveau_private *dev_priv = dev->dev_private;
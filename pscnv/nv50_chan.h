@@ -8,6 +8,7 @@
 #define NV84_CHAN_PD	0x0200
 
 extern int nv50_chan_new (struct pscnv_chan *ch);
+extern void nv50_chan_fill_pd (struct pscnv_chan *ch);
 extern void nv50_chan_init (struct pscnv_chan *ch);
 extern int nv50_chan_iobj_new(struct pscnv_chan *, uint32_t size);
 extern int nv50_chan_dmaobj_new(struct pscnv_chan *, uint32_t type, uint64_t start, uint64_t size);
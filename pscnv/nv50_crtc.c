@@ -750,7 +750,7 @@ nv50_crtc_create(struct drm_device *dev, int index)
 	}
 	nv_crtc->lut.depth = 0;
 
-	nv_crtc->lut.vo = pscnv_vram_alloc(dev, 4096, PSCNV_VO_CONTIG, 0, 0xd1517);
+	nv_crtc->lut.vo = pscnv_vram_alloc(dev, 4096, 0, PSCNV_VO_CONTIG, 0, 0xd1517);
 
 	if (!nv_crtc->lut.vo) {
 		kfree(nv_crtc->mode);
@@ -770,7 +770,7 @@ nv50_crtc_create(struct drm_device *dev, int index)
 	drm_crtc_helper_add(&nv_crtc->base, &nv50_crtc_helper_funcs);
 	drm_mode_crtc_set_gamma_size(&nv_crtc->base, 256);
 
-	nv_crtc->cursor.vo = pscnv_vram_alloc(dev, 64*64*4, PSCNV_VO_CONTIG, 0, 0xd15c);
+	nv_crtc->cursor.vo = pscnv_vram_alloc(dev, 64*64*4, 0, PSCNV_VO_CONTIG, 0, 0xd15c);
 	if (!nv_crtc->cursor.vo) {
 		pscnv_vram_free(nv_crtc->lut.vo);
 		kfree(nv_crtc->mode);
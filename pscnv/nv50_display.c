@@ -43,6 +43,8 @@ nv50_evo_channel_del(struct nouveau_channel **pchan)
 
 	if (chan->pushbuf)
 		pscnv_vram_free(chan->pushbuf);
+	if (chan->evo_obj)
+		pscnv_vram_free(chan->evo_obj);
 
 	kfree(chan);
 }
@@ -97,7 +99,7 @@ nv50_evo_channel_new(struct drm_device *dev, struct nouveau_channel **pchan)
 
 	/* nouveau allocates 32kiB here, but there's no way we'd ever use it all.
 	 * with a total of 3 objects, 8kiB is more than enough. */
-	chan->evo_obj = dev_priv->evo_obj;
+	chan->evo_obj = pscnv_vram_alloc(dev, 0x2000, 0x10000, PSCNV_VO_CONTIG, 0, 0xd1501a7);
 	if (!chan->evo_obj) {
 		nv50_evo_channel_del(pchan);
 		NV_ERROR(dev, "Error allocating EVO channel memory\n");
@@ -136,7 +138,7 @@ nv50_evo_channel_new(struct drm_device *dev, struct nouveau_channel **pchan)
 		return ret;
 	}
 
-	chan->pushbuf = pscnv_vram_alloc(dev, 0x1000, PSCNV_VO_CONTIG, 0, 0xd15f1f0);
+	chan->pushbuf = pscnv_vram_alloc(dev, 0x1000, 0, PSCNV_VO_CONTIG, 0, 0xd15f1f0);
 	if (!chan->pushbuf) {
 		NV_ERROR(dev, "Error creating EVO DMA push buffer: %d\n", ret);
 		nv50_evo_channel_del(pchan);
@@ -69,8 +69,8 @@ int nv50_fifo_init(struct drm_device *dev) {
 	res->base.chan_obj_new = 0;
 	spin_lock_init(&res->lock);
 
-	res->playlist[0] = pscnv_vram_alloc(dev, 0x1000, PSCNV_VO_CONTIG, 0, 0x91a71157);
-	res->playlist[1] = pscnv_vram_alloc(dev, 0x1000, PSCNV_VO_CONTIG, 0, 0x91a71157);
+	res->playlist[0] = pscnv_vram_alloc(dev, 0x1000, 0, PSCNV_VO_CONTIG, 0, 0x91a71157);
+	res->playlist[1] = pscnv_vram_alloc(dev, 0x1000, 0, PSCNV_VO_CONTIG, 0, 0x91a71157);
 	if (!res->playlist[0] || !res->playlist[1]) {
 		NV_ERROR(dev, "PFIFO: Couldn't allocate playlists!\n");
 		if (res->playlist[0])
@@ -152,7 +152,9 @@ void nv50_fifo_playlist_update (struct pscnv_engine *eng) {
 }
 
 int nv50_fifo_chan_alloc(struct pscnv_engine *eng, struct pscnv_chan *ch) {
+	mutex_lock(&ch->vspace->lock);
 	ch->vspace->engref[PSCNV_ENGINE_FIFO]--;
+	mutex_unlock(&ch->vspace->lock);
 	ch->engdata[PSCNV_ENGINE_FIFO] = ch; /* dummy */
 	return 0;
 }
@@ -198,7 +200,9 @@ void nv50_fifo_chan_kill(struct pscnv_engine *eng, struct pscnv_chan *ch) {
 }
 
 void nv50_fifo_chan_free(struct pscnv_engine *eng, struct pscnv_chan *ch) {
+	mutex_lock(&ch->vspace->lock);
 	ch->vspace->engref[PSCNV_ENGINE_FIFO]--;
+	mutex_unlock(&ch->vspace->lock);
 	ch->engdata[PSCNV_ENGINE_FIFO] = 0;
 }
 
@@ -218,25 +222,25 @@ int pscnv_ioctl_fifo_init(struct drm_device *dev, void *data,
 	if (!eng)
 		return -ENODEV;
 
-	mutex_lock (&dev_priv->vm_mutex);
-
 	ch = pscnv_get_chan(dev, file_priv, req->cid);
-	if (!ch) {
-		mutex_unlock (&dev_priv->vm_mutex);
+	if (!ch)
 		return -ENOENT;
-	}
+
+	mutex_lock (&ch->lock);
 
 	/* XXX: verify that we get a DMA object. */
 	pb_inst = pscnv_ramht_find(&ch->ramht, req->pb_handle);
 	if (!pb_inst || pb_inst & 0xffff0000) {
-		mutex_unlock (&dev_priv->vm_mutex);
+		mutex_unlock (&ch->lock);
+		kref_put(&ch->ref, pscnv_chan_ref_free);
 		return -ENOENT;
 	}
 
 	if (!ch->engdata[PSCNV_ENGINE_FIFO]) {
 		ret = eng->chan_alloc(eng, ch);
 		if (ret) {
-			mutex_unlock (&dev_priv->vm_mutex);
+			mutex_unlock (&ch->lock);
+			kref_put(&ch->ref, pscnv_chan_ref_free);
 			return ret;
 		}
 	}
@@ -294,7 +298,8 @@ int pscnv_ioctl_fifo_init(struct drm_device *dev, void *data,
 	nv50_fifo_playlist_update(eng);
 	spin_unlock_irqrestore(&fifo->lock, flags);
 
-	mutex_unlock (&dev_priv->vm_mutex);
+	mutex_unlock (&ch->lock);
+	kref_put(&ch->ref, pscnv_chan_ref_free);
 	return 0;
 }
 
@@ -311,25 +316,25 @@ int pscnv_ioctl_fifo_init_ib(struct drm_device *dev, void *data,
 
 	NOUVEAU_CHECK_INITIALISED_WITH_RETURN;
 
-	mutex_lock (&dev_priv->vm_mutex);
-
 	ch = pscnv_get_chan(dev, file_priv, req->cid);
-	if (!ch) {
-		mutex_unlock (&dev_priv->vm_mutex);
+	if (!ch)
 		return -ENOENT;
-	}
+
+	mutex_lock (&ch->lock);
 
 	/* XXX: verify that we get a DMA object. */
 	pb_inst = pscnv_ramht_find(&ch->ramht, req->pb_handle);
 	if (!pb_inst || pb_inst & 0xffff0000) {
-		mutex_unlock (&dev_priv->vm_mutex);
+		mutex_unlock (&ch->lock);
+		kref_put(&ch->ref, pscnv_chan_ref_free);
 		return -ENOENT;
 	}
 
 	if (!ch->engdata[PSCNV_ENGINE_FIFO]) {
 		ret = eng->chan_alloc(eng, ch);
 		if (ret) {
-			mutex_unlock (&dev_priv->vm_mutex);
+			mutex_unlock (&ch->lock);
+			kref_put(&ch->ref, pscnv_chan_ref_free);
 			return ret;
 		}
 	}
@@ -387,7 +392,8 @@ int pscnv_ioctl_fifo_init_ib(struct drm_device *dev, void *data,
 	nv50_fifo_playlist_update(eng);
 	spin_unlock_irqrestore(&fifo->lock, flags);
 
-	mutex_unlock (&dev_priv->vm_mutex);
+	mutex_unlock (&ch->lock);
+	kref_put(&ch->ref, pscnv_chan_ref_free);
 	return 0;
 }
 
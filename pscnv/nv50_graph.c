@@ -270,7 +270,6 @@ int nv50_graph_chan_alloc(struct pscnv_engine *eng, struct pscnv_chan *ch) {
 	struct nouveau_grctx ctx = {};
 	uint32_t hdr;
 	uint64_t limit;
-	int i;
 	struct nv50_graph_chan *grch = kzalloc(sizeof *grch, GFP_KERNEL);
 
 	if (!grch) {
@@ -282,14 +281,12 @@ int nv50_graph_chan_alloc(struct pscnv_engine *eng, struct pscnv_chan *ch) {
 		hdr = 0x200;
 	else
 		hdr = 0x20;
-	grch->grctx = pscnv_vram_alloc(dev, graph->grctx_size, PSCNV_VO_CONTIG, 0, 0x97c07e47);
+	grch->grctx = pscnv_vram_alloc(dev, graph->grctx_size, 0, PSCNV_VO_CONTIG | PSCNV_VO_ZERO, 0, 0x97c07e47);
 	if (!grch->grctx) {
 		NV_ERROR(dev, "PGRAPH: No VRAM for context!\n");
 		kfree(grch);
 		return -ENOMEM;
 	}
-	for (i = 0; i < graph->grctx_size; i += 4)
-		nv_wv32(grch->grctx, i, 0);
 	ctx.dev = dev;
 	ctx.mode = NOUVEAU_GRCTX_VALS;
 	ctx.data = grch->grctx;
@@ -300,7 +297,9 @@ int nv50_graph_chan_alloc(struct pscnv_engine *eng, struct pscnv_chan *ch) {
 	nv_wv32(ch->vo, hdr + 0x08, grch->grctx->start);
 	nv_wv32(ch->vo, hdr + 0x0c, (limit >> 32) << 24 | (grch->grctx->start >> 32));
 	dev_priv->vm->bar_flush(dev);
+	mutex_lock(&ch->vspace->lock);
 	ch->vspace->engref[PSCNV_ENGINE_GRAPH]++;
+	mutex_unlock(&ch->vspace->lock);
 	ch->engdata[PSCNV_ENGINE_GRAPH] = grch;
 	return 0;
 }
@@ -355,7 +354,9 @@ void nv50_graph_chan_free(struct pscnv_engine *eng, struct pscnv_chan *ch) {
 	struct nv50_graph_chan *grch = ch->engdata[PSCNV_ENGINE_GRAPH];
 	pscnv_vram_free(grch->grctx);
 	kfree(grch);
+	mutex_lock(&ch->vspace->lock);
 	ch->vspace->engref[PSCNV_ENGINE_GRAPH]--;
+	mutex_unlock(&ch->vspace->lock);
 	ch->engdata[PSCNV_ENGINE_GRAPH] = 0;
 }
 
@@ -1,3 +1,6 @@
+#include <linux/vmalloc.h>
+#include <linux/seq_file.h>
+
 #include "drmP.h"
 #include "drm.h"
 #include "nouveau_drv.h"
@@ -20,22 +23,64 @@ nv50_vm_flush(struct drm_device *dev, int unit) {
 	return 0;
 }
 
-static int
-nv50_vspace_fill_pd_slot (struct pscnv_vspace *vs, uint32_t pdenum) {
-	struct drm_nouveau_private *dev_priv = vs->dev->dev_private;
-	struct list_head *pos;
-	int i;
-	uint32_t chan_pd;
-	nv50_vs(vs)->pt[pdenum] = pscnv_vram_alloc(vs->dev, NV50_VM_SPTE_COUNT * 8, PSCNV_VO_CONTIG, 0, 0xa9e7ab1e);
-	if (!nv50_vs(vs)->pt[pdenum]) {
-		return -ENOMEM;
+/* pushes the staged PTEs out in one block write */
+static void
+nv50_vspace_batch_flush (struct pscnv_vspace *vs) {
+	struct nv50_vspace *nvs = nv50_vs(vs);
+	if (nvs->batch_count)
+		nv_wvblock(nvs->batch_pt, nvs->batch_start * 8, nvs->batch, nvs->batch_count * 8);
+	nvs->batch_count = 0;
+}
+
+/* stages a write of pte to entry ptenum of page table pt, unless its
+ * shadow says it's already there */
+static void
+nv50_vspace_batch_pte (struct pscnv_vspace *vs, struct pscnv_vo *pt, uint64_t *shadow, uint32_t ptenum, uint64_t pte) {
+	struct nv50_vspace *nvs = nv50_vs(vs);
+	if (shadow[ptenum] == pte)
+		return;
+	shadow[ptenum] = pte;
+	if (nvs->batch_count && (nvs->batch_pt != pt || nvs->batch_count == NV50_VM_PTE_BATCH ||
+				ptenum != nvs->batch_start + nvs->batch_count))
+		nv50_vspace_batch_flush(vs);
+	if (!nvs->batch_count) {
+		nvs->batch_pt = pt;
+		nvs->batch_start = ptenum;
 	}
+	nvs->batch[nvs->batch_count * 2] = pte;
+	nvs->batch[nvs->batch_count * 2 + 1] = pte >> 32;
+	nvs->batch_count++;
+}
 
-	if (!vs->isbar)
-		nv50_vm_map_kernel(nv50_vs(vs)->pt[pdenum]);
+/* stages pte for entry ptenum of page table pdenum, keeping the PTE
+ * counts in step with what's present */
+static void
+nv50_vspace_set_pte (struct pscnv_vspace *vs, uint32_t pdenum, uint32_t ptenum, uint64_t pte) {
+	struct nv50_vspace *nvs = nv50_vs(vs);
+	int was = nvs->pt_shadow[pdenum][ptenum] & 1;
+	if (!was && (pte & 1)) {
+		nvs->pt_live[pdenum]++;
+		if (nvs->pt_large[pdenum])
+			vs->pte_large++;
+		else
+			vs->pte_small++;
+	} else if (was && !(pte & 1)) {
+		nvs->pt_live[pdenum]--;
+		if (nvs->pt_large[pdenum])
+			vs->pte_large--;
+		else
+			vs->pte_small--;
+	}
+	nv50_vspace_batch_pte(vs, nvs->pt[pdenum], nvs->pt_shadow[pdenum], ptenum, pte);
+}
 
-	for (i = 0; i < NV50_VM_SPTE_COUNT; i++)
-		nv_wv32(nv50_vs(vs)->pt[pdenum], i * 8, 0);
+/* points every channel of the vspace at page table pdenum */
+static void
+nv50_vspace_write_pde (struct pscnv_vspace *vs, uint32_t pdenum) {
+	struct drm_nouveau_private *dev_priv = vs->dev->dev_private;
+	struct list_head *pos;
+	uint64_t pde = nv50_vs_pde(vs, pdenum);
+	uint32_t chan_pd;
 
 	if (dev_priv->chipset == 0x50)
 		chan_pd = NV50_CHAN_PD;
@@ -44,61 +89,264 @@ nv50_vspace_fill_pd_slot (struct pscnv_vspace *vs, uint32_t pdenum) {
 
 	list_for_each(pos, &vs->chan_list) {
 		struct pscnv_chan *ch = list_entry(pos, struct pscnv_chan, vspace_list);
-		uint64_t pde = nv50_vs(vs)->pt[pdenum]->start | 3;
 		nv_wv32(ch->vo, chan_pd + pdenum * 8 + 4, pde >> 32);
 		nv_wv32(ch->vo, chan_pd + pdenum * 8, pde);
 	}
+}
+
+static struct pscnv_vo *
+nv50_vm_pt_cache_get (struct drm_device *dev, int large) {
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	struct nv50_vm_engine *vme = nv50_vm(dev_priv->vm);
+	struct pscnv_vo *res = 0;
+	mutex_lock(&vme->pt_cache_lock);
+	if (vme->pt_cache_num[large])
+		res = vme->pt_cache[large][--vme->pt_cache_num[large]];
+	mutex_unlock(&vme->pt_cache_lock);
+	return res;
+}
+
+/* takes an all-zero page table back, or frees it if the cache is full */
+static void
+nv50_vm_pt_cache_put (struct pscnv_vo *pt, int large) {
+	struct drm_nouveau_private *dev_priv = pt->dev->dev_private;
+	struct nv50_vm_engine *vme = nv50_vm(dev_priv->vm);
+	mutex_lock(&vme->pt_cache_lock);
+	if (vme->pt_cache_num[large] < NV50_VM_PT_CACHE) {
+		vme->pt_cache[large][vme->pt_cache_num[large]++] = pt;
+		pt = 0;
+	}
+	mutex_unlock(&vme->pt_cache_lock);
+	if (pt)
+		pscnv_vram_free(pt);
+}
+
+/* keeps a page table of each kind in the cache, allocated and mapped
+ * outside of any vspace lock */
+static void
+nv50_vm_prealloc (struct drm_device *dev) {
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	struct nv50_vm_engine *vme = nv50_vm(dev_priv->vm);
+	struct pscnv_vo *pt;
+	int large, have;
+	for (large = 0; large < 2; large++) {
+		mutex_lock(&vme->pt_cache_lock);
+		have = vme->pt_cache_num[large];
+		mutex_unlock(&vme->pt_cache_lock);
+		if (have)
+			continue;
+		pt = pscnv_vram_alloc(dev, (large ? NV50_VM_LPTE_COUNT : NV50_VM_SPTE_COUNT) * 8, 0,
+				PSCNV_VO_CONTIG | PSCNV_VO_ZERO, 0, 0xa9e7ab1e);
+		if (!pt)
+			continue;
+		nv50_vm_map_kernel(pt);
+		nv50_vm_pt_cache_put(pt, large);
+	}
+}
+
+static uint64_t *
+nv50_vm_shadow_alloc (int large) {
+	uint32_t size = (large ? NV50_VM_LPTE_COUNT : NV50_VM_SPTE_COUNT) * 8;
+	uint64_t *res = vmalloc(size);
+	if (res)
+		memset(res, 0, size);
+	return res;
+}
+
+static int
+nv50_vspace_fill_pd_slot (struct pscnv_vspace *vs, uint32_t pdenum, int large) {
+	uint32_t count = large ? NV50_VM_LPTE_COUNT : NV50_VM_SPTE_COUNT;
+	nv50_vs(vs)->pt_shadow[pdenum] = nv50_vm_shadow_alloc(large);
+	if (!nv50_vs(vs)->pt_shadow[pdenum])
+		return -ENOMEM;
+	nv50_vs(vs)->pt[pdenum] = 0;
+	if (!vs->isbar)
+		nv50_vs(vs)->pt[pdenum] = nv50_vm_pt_cache_get(vs->dev, large);
+	if (!nv50_vs(vs)->pt[pdenum])
+		nv50_vs(vs)->pt[pdenum] = pscnv_vram_alloc(vs->dev, count * 8, 0, PSCNV_VO_CONTIG | PSCNV_VO_ZERO, 0, 0xa9e7ab1e);
+	if (!nv50_vs(vs)->pt[pdenum]) {
+		vfree(nv50_vs(vs)->pt_shadow[pdenum]);
+		nv50_vs(vs)->pt_shadow[pdenum] = 0;
+		return -ENOMEM;
+	}
+	nv50_vs(vs)->pt_large[pdenum] = large;
+	nv50_vs(vs)->pt_live[pdenum] = 0;
+
+	if (!vs->isbar)
+		nv50_vm_map_kernel(nv50_vs(vs)->pt[pdenum]);
+
+	nv50_vspace_write_pde(vs, pdenum);
+	return 0;
+}
+
+/* replaces a large page table with a small one mapping the same pages,
+ * so that pages that aren't large-page aligned can go into its slot too. */
+static int
+nv50_vspace_split_pd_slot (struct pscnv_vspace *vs, uint32_t pdenum) {
+	struct drm_nouveau_private *dev_priv = vs->dev->dev_private;
+	struct pscnv_vo *lpt = nv50_vs(vs)->pt[pdenum];
+	uint64_t *lshadow = nv50_vs(vs)->pt_shadow[pdenum];
+	struct pscnv_vo *spt;
+	uint64_t *sshadow;
+	int i, j;
+	sshadow = nv50_vm_shadow_alloc(0);
+	if (!sshadow)
+		return -ENOMEM;
+	/* normally stocked by nv50_vm_prealloc before vs->lock was taken */
+	spt = nv50_vm_pt_cache_get(vs->dev, 0);
+	if (!spt)
+		spt = pscnv_vram_alloc(vs->dev, NV50_VM_SPTE_COUNT * 8, 0, PSCNV_VO_CONTIG | PSCNV_VO_ZERO, 0, 0xa9e7ab1e);
+	if (!spt) {
+		vfree(sshadow);
+		return -ENOMEM;
+	}
+	nv50_vm_map_kernel(spt);
+	nv50_vspace_batch_flush(vs);
+	for (i = 0; i < NV50_VM_LPTE_COUNT; i++) {
+		if (!(lshadow[i] & 1))
+			continue;
+		for (j = 0; j < NV50_VM_LPAGE_SIZE / NV50_VM_SPAGE_SIZE; j++)
+			nv50_vspace_batch_pte(vs, spt, sshadow, i * 16 + j,
+					lshadow[i] + j * NV50_VM_SPAGE_SIZE);
+		vs->pte_large--;
+		vs->pte_small += NV50_VM_LPAGE_SIZE / NV50_VM_SPAGE_SIZE;
+	}
+	nv50_vspace_batch_flush(vs);
+	nv50_vs(vs)->pt[pdenum] = spt;
+	nv50_vs(vs)->pt_shadow[pdenum] = sshadow;
+	nv50_vs(vs)->pt_large[pdenum] = 0;
+	nv50_vs(vs)->pt_live[pdenum] *= NV50_VM_LPAGE_SIZE / NV50_VM_SPAGE_SIZE;
+	nv50_vspace_write_pde(vs, pdenum);
+	dev_priv->vm->bar_flush(vs->dev);
+	pscnv_vspace_tlb_flush(vs);
+	pscnv_vram_free(lpt);
+	vfree(lshadow);
+	vs->pt_splits++;
+	if (pscnv_vm_debug >= 1)
+		NV_INFO(vs->dev, "VM: Split large page table %d of vspace %d\n", pdenum, vs->vid);
 	return 0;
 }
 
+/* can size bytes of the VO from vo_off on be mapped at offset with large
+ * pages only? */
+static int
+nv50_vspace_large_ok (struct pscnv_vspace *vs, struct pscnv_vo *vo, uint64_t offset,
+		uint64_t vo_off, uint64_t size) {
+	struct pscnv_vram_region *reg;
+	if (vs->isbar || (offset | vo_off | size) & (NV50_VM_LPAGE_SIZE - 1))
+		return 0;
+	list_for_each_entry(reg, &vo->regions, local_list)
+		if ((reg->start | reg->size) & (NV50_VM_LPAGE_SIZE - 1))
+			return 0;
+	return 1;
+}
+
+/* maps size bytes of the VO, from vo_off on, at offset. Whatever was
+ * mapped there before is replaced, and PTEs that stay the same aren't
+ * written. */
 int
-nv50_vspace_do_map (struct pscnv_vspace *vs, struct pscnv_vo *vo, uint64_t offset) {
+nv50_vspace_do_map (struct pscnv_vspace *vs, struct pscnv_vo *vo, uint64_t offset,
+		uint64_t vo_off, uint64_t size) {
 	struct drm_nouveau_private *dev_priv = vs->dev->dev_private;
 	struct list_head *pos;
+	uint64_t start = offset, rbase = 0;
+	int large = nv50_vspace_large_ok(vs, vo, offset, vo_off, size);
 	int ret;
 	list_for_each(pos, &vo->regions) {
-		/* XXX: beef up to use contig blocks */
+		/* every page table is either all large pages or all small
+		 * pages. VOs made of large page aligned regions get large
+		 * pages wherever the page table allows. */
 		struct pscnv_vram_region *reg = list_entry(pos, struct pscnv_vram_region, local_list);
-		uint64_t roff;
-		for (roff = 0; roff < reg->size; roff += 0x1000, offset += 0x1000) {
-			uint32_t pgnum = offset / 0x1000;
-			uint32_t pdenum = pgnum / NV50_VM_SPTE_COUNT;
-			uint32_t ptenum = pgnum % NV50_VM_SPTE_COUNT;
+		uint64_t roff, rend, psize;
+		/* the part of the region inside the window */
+		if (rbase >= vo_off + size)
+			break;
+		roff = vo_off > rbase ? vo_off - rbase : 0;
+		rend = min(reg->size, vo_off + size - rbase);
+		rbase += reg->size;
+		for (; roff < rend; roff += psize, offset += psize) {
+			uint32_t pdenum = offset / NV50_VM_PDE_SPAN;
+			uint32_t ptenum;
 			uint64_t pte = reg->start + roff;
 			pte |= (uint64_t)vo->tile_flags << 40;
 			pte |= 1; /* present */
-			if (!nv50_vs(vs)->pt[pdenum])
-				if ((ret = nv50_vspace_fill_pd_slot (vs, pdenum))) {
-					nv50_vspace_do_unmap (vs, offset, vo->size);
-					return ret;
-				}
-			nv_wv32(nv50_vs(vs)->pt[pdenum], ptenum * 8 + 4, pte >> 32);
-			nv_wv32(nv50_vs(vs)->pt[pdenum], ptenum * 8, pte);
+			if (!nv50_vs(vs)->pt[pdenum]) {
+				nv50_vspace_batch_flush(vs);
+				ret = nv50_vspace_fill_pd_slot (vs, pdenum, large);
+			}
+			else if (nv50_vs(vs)->pt_large[pdenum] && !large)
+				ret = nv50_vspace_split_pd_slot (vs, pdenum);
+			else
+				ret = 0;
+			if (ret) {
+				nv50_vspace_batch_flush(vs);
+				nv50_vspace_do_unmap (vs, start, offset - start);
+				return ret;
+			}
+			if (nv50_vs(vs)->pt_large[pdenum])
+				psize = NV50_VM_LPAGE_SIZE;
+			else
+				psize = NV50_VM_SPAGE_SIZE;
+			ptenum = (offset % NV50_VM_PDE_SPAN) / psize;
+			nv50_vspace_set_pte(vs, pdenum, ptenum, pte);
 		}
 	}
-	dev_priv->vm->bar_flush(vs->dev);
+	nv50_vspace_batch_flush(vs);
+	pscnv_vspace_bar_flush_later(vs);
 	return 0;
 }
 
+/* drops the empty page table of slot pdenum. The PDEs are cleared and
+ * the TLBs flushed before the page table goes, since the card may still
+ * be walking it. */
+static void
+nv50_vspace_reclaim_pd_slot (struct pscnv_vspace *vs, uint32_t pdenum) {
+	struct drm_nouveau_private *dev_priv = vs->dev->dev_private;
+	struct pscnv_vo *pt = nv50_vs(vs)->pt[pdenum];
+	int large = nv50_vs(vs)->pt_large[pdenum];
+	nv50_vs(vs)->pt[pdenum] = 0;
+	nv50_vs(vs)->pt_large[pdenum] = 0;
+	vfree(nv50_vs(vs)->pt_shadow[pdenum]);
+	nv50_vs(vs)->pt_shadow[pdenum] = 0;
+	nv50_vspace_write_pde(vs, pdenum);
+	dev_priv->vm->bar_flush(vs->dev);
+	pscnv_vspace_tlb_flush(vs);
+	nv50_vm_pt_cache_put(pt, large);
+	vs->pt_reclaims++;
+	if (pscnv_vm_debug >= 1)
+		NV_INFO(vs->dev, "VM: Freed empty page table %d of vspace %d\n", pdenum, vs->vid);
+}
+
 int
 nv50_vspace_do_unmap (struct pscnv_vspace *vs, uint64_t offset, uint64_t length) {
 	struct drm_nouveau_private *dev_priv = vs->dev->dev_private;
+	uint32_t pdefirst = offset / NV50_VM_PDE_SPAN, i;
+	uint64_t psize;
 	while (length) {
-		uint32_t pgnum = offset / 0x1000;
-		uint32_t pdenum = pgnum / NV50_VM_SPTE_COUNT;
-		uint32_t ptenum = pgnum % NV50_VM_SPTE_COUNT;
+		uint32_t pdenum = offset / NV50_VM_PDE_SPAN;
+		psize = NV50_VM_SPAGE_SIZE;
 		if (nv50_vs(vs)->pt[pdenum]) {
-			nv_wv32(nv50_vs(vs)->pt[pdenum], ptenum * 8, 0);
+			/* large page tables only ever get whole large pages */
+			if (nv50_vs(vs)->pt_large[pdenum])
+				psize = NV50_VM_LPAGE_SIZE;
+			nv50_vspace_set_pte(vs, pdenum, (offset % NV50_VM_PDE_SPAN) / psize, 0);
 		}
-		offset += 0x1000;
-		length -= 0x1000;
+		if (psize > length)
+			psize = length;
+		offset += psize;
+		length -= psize;
 	}
-	dev_priv->vm->bar_flush(vs->dev);
+	nv50_vspace_batch_flush(vs);
+	pscnv_vspace_bar_flush_later(vs);
 	if (vs->isbar) {
 		return nv50_vm_flush(vs->dev, 6);
 	} else {
-		pscnv_vspace_tlb_flush(vs);
+		pscnv_vspace_tlb_flush_later(vs);
 	}
+	/* offset is now the end of the range */
+	for (i = pdefirst; (uint64_t)i * NV50_VM_PDE_SPAN < offset; i++)
+		if (nv50_vs(vs)->pt[i] && !nv50_vs(vs)->pt_live[i])
+			nv50_vspace_reclaim_pd_slot(vs, i);
 	return 0;
 }
 
@@ -116,6 +364,70 @@ void nv50_vspace_free(struct pscnv_vspace *vs) {
 	for (i = 0; i < NV50_VM_PDE_COUNT; i++) {
 		if (nv50_vs(vs)->pt[i]) {
 			pscnv_vram_free(nv50_vs(vs)->pt[i]);
+			vfree(nv50_vs(vs)->pt_shadow[i]);
+		}
+	}
+}
+
+int
+nv50_vspace_translate (struct pscnv_vspace *vs, uint64_t addr, uint64_t *pte) {
+	uint32_t pdenum = addr / NV50_VM_PDE_SPAN;
+	uint64_t psize, res;
+	if (addr >= NV50_VM_SIZE || !nv50_vs(vs)->pt[pdenum])
+		return -ENOENT;
+	psize = nv50_vs(vs)->pt_large[pdenum] ? NV50_VM_LPAGE_SIZE : NV50_VM_SPAGE_SIZE;
+	res = nv50_vs(vs)->pt_shadow[pdenum][(addr % NV50_VM_PDE_SPAN) / psize];
+	if (!(res & 1))
+		return -ENOENT;
+	*pte = res;
+	return 0;
+}
+
+uint64_t
+nv50_vspace_next_mapped (struct pscnv_vspace *vs, uint64_t start, uint64_t end) {
+	uint64_t psize;
+	uint32_t pdenum, i;
+	if (end > NV50_VM_SIZE)
+		end = NV50_VM_SIZE;
+	while (start < end) {
+		pdenum = start / NV50_VM_PDE_SPAN;
+		if (!nv50_vs(vs)->pt[pdenum]) {
+			start = (uint64_t)(pdenum + 1) * NV50_VM_PDE_SPAN;
+			continue;
+		}
+		psize = nv50_vs(vs)->pt_large[pdenum] ? NV50_VM_LPAGE_SIZE : NV50_VM_SPAGE_SIZE;
+		for (i = (start % NV50_VM_PDE_SPAN) / psize; i < NV50_VM_PDE_SPAN / psize; i++)
+			if (nv50_vs(vs)->pt_shadow[pdenum][i] & 1)
+				return max(start, pdenum * NV50_VM_PDE_SPAN + i * psize);
+		start = (uint64_t)(pdenum + 1) * NV50_VM_PDE_SPAN;
+	}
+	return end;
+}
+
+/* prints the page tables, with runs of contiguous PTEs folded into
+ * a single line */
+void
+nv50_vspace_dump (struct pscnv_vspace *vs, struct seq_file *m) {
+	uint64_t psize, first, pte;
+	uint32_t pdenum, i, j, count;
+	for (pdenum = 0; pdenum < NV50_VM_PDE_COUNT; pdenum++) {
+		uint64_t *shadow = nv50_vs(vs)->pt_shadow[pdenum];
+		if (!nv50_vs(vs)->pt[pdenum])
+			continue;
+		psize = nv50_vs(vs)->pt_large[pdenum] ? NV50_VM_LPAGE_SIZE : NV50_VM_SPAGE_SIZE;
+		count = NV50_VM_PDE_SPAN / psize;
+		seq_printf(m, "PDE %d: %016llx, %d live PTEs\n", pdenum,
+				nv50_vs_pde(vs, pdenum), nv50_vs(vs)->pt_live[pdenum]);
+		for (i = 0; i < count; i = j) {
+			pte = shadow[i];
+			for (j = i + 1; j < count; j++)
+				if (shadow[j] != (pte & 1 ? pte + (j - i) * psize : pte))
+					break;
+			if (!(pte & 1))
+				continue;
+			first = pdenum * NV50_VM_PDE_SPAN + i * psize;
+			seq_printf(m, "  %010llx-%010llx: %016llx\n", first,
+					first + (j - i) * psize, pte);
 		}
 	}
 }
@@ -125,7 +437,7 @@ int nv50_vm_map_user(struct pscnv_vo *vo) {
 	struct nv50_vm_engine *vme = nv50_vm(dev_priv->vm);
 	if (vo->map1)
 		return 0;
-	return pscnv_vspace_map(vme->barvm, vo, 0, dev_priv->fb_size, 0, &vo->map1);
+	return pscnv_vspace_map(vme->barvm, vo, 0, dev_priv->fb_size, 0, 0, &vo->map1);
 }
 
 int nv50_vm_map_kernel(struct pscnv_vo *vo) {
@@ -133,7 +445,7 @@ int nv50_vm_map_kernel(struct pscnv_vo *vo) {
 	struct nv50_vm_engine *vme = nv50_vm(dev_priv->vm);
 	if (vo->map3)
 		return 0;
-	return pscnv_vspace_map(vme->barvm, vo, dev_priv->fb_size, dev_priv->fb_size + dev_priv->ramin_size, 0, &vo->map3);
+	return pscnv_vspace_map(vme->barvm, vo, dev_priv->fb_size, dev_priv->fb_size + dev_priv->ramin_size, 0, 0, &vo->map3);
 }
 
 void
@@ -172,6 +484,12 @@ nv50_vm_init(struct drm_device *dev) {
 		vme->base.bar_flush = nv50_vm_bar_flush;
 	else
 		vme->base.bar_flush = nv84_vm_bar_flush;
+	vme->base.prealloc = nv50_vm_prealloc;
+	vme->base.translate = nv50_vspace_translate;
+	vme->base.next_mapped = nv50_vspace_next_mapped;
+	vme->base.dump = nv50_vspace_dump;
+	vme->base.lpage_size = NV50_VM_LPAGE_SIZE;
+	mutex_init(&vme->pt_cache_lock);
 	dev_priv->vm = &vme->base;
 
 	/* This is needed to get meaningful information from 100c90
@@ -210,6 +528,11 @@ nv50_vm_init(struct drm_device *dev) {
 	nv_wr32(dev, 0x1708, 0x80000000 | bar1dma >> 4);
 	nv_wr32(dev, 0x170c, 0x80000000 | bar3dma >> 4);
 	mutex_init(&dev_priv->vm_mutex);
+	idr_init(&dev_priv->vspace_idr);
+	idr_init(&dev_priv->chan_idr);
+	mutex_init(&dev_priv->bar1_mutex);
+	INIT_LIST_HEAD(&dev_priv->bar1_lru);
+	idr_init(&dev_priv->mmap_idr);
 	nv50_vm_map_kernel(vme->barch->vo);
 	nv50_vm_map_kernel(nv50_vs(vme->barvm)->pt[0]);
 	return 0;
@@ -221,7 +544,11 @@ nv50_vm_takedown(struct drm_device *dev) {
 	struct nv50_vm_engine *vme = nv50_vm(dev_priv->vm);
 	struct pscnv_vspace *vs = vme->barvm;
 	struct pscnv_chan *ch = vme->barch;
+	int i;
 	/* XXX: write me. */
+	for (i = 0; i < 2; i++)
+		while (vme->pt_cache_num[i])
+			pscnv_vram_free(vme->pt_cache[i][--vme->pt_cache_num[i]]);
 	vme->barvm = 0;
 	vme->barch = 0;
 	nv_wr32(dev, 0x1708, 0);
@@ -230,6 +557,9 @@ nv50_vm_takedown(struct drm_device *dev) {
 	nv_wr32(dev, 0x1704, 0);
 	pscnv_chan_free(ch);
 	pscnv_vspace_free(vs);
+	idr_destroy(&dev_priv->vspace_idr);
+	idr_destroy(&dev_priv->chan_idr);
+	idr_destroy(&dev_priv->mmap_idr);
 	dev_priv->vm = 0;
 	kfree(vme);
 }
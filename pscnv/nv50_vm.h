@@ -9,6 +9,14 @@
 #define NV50_VM_PDE_COUNT	0x800
 #define NV50_VM_SPTE_COUNT	0x20000
 #define NV50_VM_LPTE_COUNT	0x2000
+#define NV50_VM_SPAGE_SIZE	0x1000
+#define NV50_VM_LPAGE_SIZE	0x10000
+/* address space covered by a single PDE */
+#define NV50_VM_PDE_SPAN	0x20000000ULL
+/* PTEs staged in host memory before a block write */
+#define NV50_VM_PTE_BATCH	512
+/* emptied page tables kept around for reuse, of each size */
+#define NV50_VM_PT_CACHE	4
 
 #define nv50_vm(x) container_of(x, struct nv50_vm_engine, base)
 #define nv50_vs(x) ((struct nv50_vspace *)(x)->engdata)
@@ -17,12 +25,40 @@ struct nv50_vm_engine {
 	struct pscnv_vm_engine base;
 	struct pscnv_vspace *barvm;
 	struct pscnv_chan *barch;
+	/* all-zero page tables, still mapped through BAR3. [0] small,
+	 * [1] large. */
+	struct mutex pt_cache_lock;
+	struct pscnv_vo *pt_cache[2][NV50_VM_PT_CACHE];
+	int pt_cache_num[2];
 };
 
 struct nv50_vspace {
 	struct pscnv_vo *pt[NV50_VM_PDE_COUNT];
+	/* nonzero if pt[i] is a large page table */
+	uint8_t pt_large[NV50_VM_PDE_COUNT];
+	/* present PTEs in pt[i]. The page table goes away when it drops
+	 * to 0. */
+	uint32_t pt_live[NV50_VM_PDE_COUNT];
+	/* host copy of every PTE in pt[i], so that lookups don't have to
+	 * read VRAM. Protected by the vspace lock. */
+	uint64_t *pt_shadow[NV50_VM_PDE_COUNT];
+	/* PTE writes not yet pushed to page table batch_pt, starting at
+	 * entry batch_start. Protected by the vspace lock. */
+	struct pscnv_vo *batch_pt;
+	uint32_t batch_start;
+	int batch_count;
+	uint32_t batch[NV50_VM_PTE_BATCH * 2];
 };
 
+/* PDE pointing to page table i, or 0 if there's none */
+static inline uint64_t
+nv50_vs_pde (struct pscnv_vspace *vs, int i)
+{
+	if (!nv50_vs(vs)->pt[i])
+		return 0;
+	return nv50_vs(vs)->pt[i]->start | (nv50_vs(vs)->pt_large[i] ? 1 : 3);
+}
+
 int nv50_vm_flush (struct drm_device *dev, int unit);
 void nv50_vm_trap(struct drm_device *dev);
 
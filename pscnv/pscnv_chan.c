@@ -35,26 +35,30 @@
 
 struct pscnv_chan *
 pscnv_chan_new (struct pscnv_vspace *vs) {
+	struct drm_nouveau_private *dev_priv = vs->dev->dev_private;
 	struct pscnv_chan *res = kzalloc(sizeof *res, GFP_KERNEL);
 	if (!res)
 		return 0;
-	mutex_lock(&vs->lock);
 	res->isbar = vs->isbar;
 	res->vspace = vs;
-	kref_get(&vs->ref);
 	spin_lock_init(&res->instlock);
 	spin_lock_init(&res->ramht.lock);
+	mutex_init(&res->lock);
 	kref_init(&res->ref);
-	list_add(&res->vspace_list, &vs->chan_list);
 
 	if (nv50_chan_new (res)) {
-		list_del(&res->vspace_list);
-		mutex_unlock(&vs->lock);
 		kfree(res);
 		return 0;
 	}
 
+	/* only the PD copy has to be in step with the vspace's PDE
+	 * updates, which go to every channel on chan_list */
+	kref_get(&vs->ref);
+	mutex_lock(&vs->lock);
+	list_add(&res->vspace_list, &vs->chan_list);
+	nv50_chan_fill_pd(res);
 	mutex_unlock(&vs->lock);
+	dev_priv->vm->bar_flush(vs->dev);
 	return res;
 }
 
@@ -77,20 +81,56 @@ pscnv_chan_free(struct pscnv_chan *ch) {
 	if (ch->cache)
 		pscnv_vram_free(ch->cache);
 	pscnv_vram_free(ch->vo);
+	/* the hardware is done with the ID, it can be given out again */
+	if (ch->cid) {
+		mutex_lock(&dev_priv->vm_mutex);
+		idr_remove(&dev_priv->chan_idr, ch->cid);
+		mutex_unlock(&dev_priv->vm_mutex);
+	}
 	kref_put(&ch->vspace->ref, pscnv_vspace_ref_free);
 	kfree(ch);
 }
 
-/* needs vm_mutex held */
+/* looks up a channel of the file and takes a reference to it, to be
+ * dropped with kref_put. vm_mutex only guards the ID table. */
 struct pscnv_chan *
 pscnv_get_chan(struct drm_device *dev, struct drm_file *file_priv, int cid)
 {
 	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	struct pscnv_chan *ch = 0;
+
+	if (cid < 0)
+		return 0;
+	mutex_lock (&dev_priv->vm_mutex);
+	ch = idr_find(&dev_priv->chan_idr, cid);
+	if (ch && ch->filp == file_priv)
+		kref_get(&ch->ref);
+	else
+		ch = 0;
+	mutex_unlock (&dev_priv->vm_mutex);
+	return ch;
+}
+
+/* disowns a channel of the file, so that lookups don't find it anymore,
+ * and hands the ID table's reference to the caller */
+static struct pscnv_chan *
+pscnv_chan_disown(struct drm_device *dev, struct drm_file *file_priv, int cid)
+{
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	struct pscnv_chan *ch = 0;
 
-	if (cid < 128 && cid >= 0 && dev_priv->chans[cid] && dev_priv->chans[cid]->filp == file_priv) {
-		return dev_priv->chans[cid];
+	if (cid < 0)
+		return 0;
+	mutex_lock (&dev_priv->vm_mutex);
+	ch = idr_find(&dev_priv->chan_idr, cid);
+	if (ch && ch->filp == file_priv) {
+		list_del(&ch->file_list);
+		ch->filp = 0;
+	} else {
+		ch = 0;
 	}
-	return 0;
+	mutex_unlock (&dev_priv->vm_mutex);
+	return ch;
 }
 
 int pscnv_ioctl_chan_new(struct drm_device *dev, void *data,
@@ -98,92 +138,84 @@ int pscnv_ioctl_chan_new(struct drm_device *dev, void *data,
 {
 	struct drm_pscnv_chan_new *req = data;
 	struct drm_nouveau_private *dev_priv = dev->dev_private;
-	int cid = -1;
+	struct pscnv_fpriv *fpriv = file_priv->driver_priv;
+	int cid;
 	struct pscnv_vspace *vs;
 	struct pscnv_chan *ch;
-	int i;
+	int ret;
 
 	NOUVEAU_CHECK_INITIALISED_WITH_RETURN;
 
-	mutex_lock (&dev_priv->vm_mutex);
-
 	vs = pscnv_get_vspace(dev, file_priv, req->vid);
-	if (!vs) {
-		mutex_unlock (&dev_priv->vm_mutex);
+	if (!vs)
 		return -ENOENT;
-	}
 
-	for (i = 1; i < 128; i++)
-		if (!dev_priv->chans[i]) {
-			cid = i;
+	/* the channel keeps its own reference to the vspace */
+	ch = pscnv_chan_new(vs);
+	kref_put(&vs->ref, pscnv_vspace_ref_free);
+	if (!ch)
+		return -ENOMEM;
+
+	do {
+		if (!idr_pre_get(&dev_priv->chan_idr, GFP_KERNEL)) {
+			ret = -ENOMEM;
 			break;
 		}
-
-	if (cid == -1) {
+		mutex_lock (&dev_priv->vm_mutex);
+		ret = idr_get_new_above(&dev_priv->chan_idr, ch, 1, &cid);
+		if (!ret && cid >= PSCNV_CHAN_NUM) {
+			idr_remove(&dev_priv->chan_idr, cid);
+			ret = -ENOSPC;
+		}
+		if (!ret) {
+			ch->cid = cid;
+			ch->filp = file_priv;
+			list_add(&ch->file_list, &fpriv->chans);
+			nv50_chan_init(ch);
+		}
 		mutex_unlock (&dev_priv->vm_mutex);
-		return -ENOSPC;
-	}
+	} while (ret == -EAGAIN);
 
-	ch = dev_priv->chans[cid] = pscnv_chan_new(vs);
-	if (!dev_priv->chans[cid]) {
-		mutex_unlock (&dev_priv->vm_mutex);
-		return -ENOMEM;
+	if (ret) {
+		pscnv_chan_free(ch);
+		return ret;
 	}
-	ch->cid = cid;
 
-	ch->filp = file_priv;
-	
 	req->cid = cid;
 	req->map_handle = 0xc0000000 | cid << 16;
 
-	nv50_chan_init(ch);
-
 	NV_INFO(dev, "Allocating FIFO %d\n", cid);
 
-	mutex_unlock (&dev_priv->vm_mutex);
 	return 0;
 }
 
-static void pscnv_chan_ref_free(struct kref *ref) {
+void pscnv_chan_ref_free(struct kref *ref) {
 	struct pscnv_chan *ch = container_of(ref, struct pscnv_chan, ref);
-	int cid = ch->cid;
-	struct drm_nouveau_private *dev_priv = ch->vspace->dev->dev_private;
 
-	NV_INFO(ch->vspace->dev, "Freeing FIFO %d\n", cid);
+	NV_INFO(ch->vspace->dev, "Freeing FIFO %d\n", ch->cid);
 
 	pscnv_chan_free(ch);
-
-	dev_priv->chans[cid] = 0;
 }
 
 int pscnv_ioctl_chan_free(struct drm_device *dev, void *data,
 						struct drm_file *file_priv)
 {
 	struct drm_pscnv_chan_free *req = data;
-	struct drm_nouveau_private *dev_priv = dev->dev_private;
-	int cid = req->cid;
 	struct pscnv_chan *ch;
 
 	NOUVEAU_CHECK_INITIALISED_WITH_RETURN;
 
-	mutex_lock (&dev_priv->vm_mutex);
-	ch = pscnv_get_chan(dev, file_priv, cid);
-	if (!ch) {
-		mutex_unlock (&dev_priv->vm_mutex);
+	ch = pscnv_chan_disown(dev, file_priv, req->cid);
+	if (!ch)
 		return -ENOENT;
-	}
 
-	ch->filp = 0;
 	kref_put(&ch->ref, pscnv_chan_ref_free);
-
-	mutex_unlock (&dev_priv->vm_mutex);
 	return 0;
 }
 
 int pscnv_ioctl_obj_vdma_new(struct drm_device *dev, void *data,
 						struct drm_file *file_priv) {
 	struct drm_pscnv_obj_vdma_new *req = data;
-	struct drm_nouveau_private *dev_priv = dev->dev_private;
 	struct pscnv_chan *ch;
 	int ret;
 	uint32_t oclass, inst;
@@ -195,23 +227,17 @@ int pscnv_ioctl_obj_vdma_new(struct drm_device *dev, void *data,
 	if (oclass != 2 && oclass != 3 && oclass != 0x3d)
 		return -EINVAL;
 
-	mutex_lock (&dev_priv->vm_mutex);
-
 	ch = pscnv_get_chan(dev, file_priv, req->cid);
-	if (!ch) {
-		mutex_unlock (&dev_priv->vm_mutex);
+	if (!ch)
 		return -ENOENT;
-	}
 
 	inst = nv50_chan_dmaobj_new(ch, 0x7fc00000 | oclass, req->start, req->size);
-	if (!inst) {
-		mutex_unlock (&dev_priv->vm_mutex);
-		return -ENOMEM;
-	}
-
-	ret = pscnv_ramht_insert (&ch->ramht, req->handle, inst >> 4);
+	if (!inst)
+		ret = -ENOMEM;
+	else
+		ret = pscnv_ramht_insert (&ch->ramht, req->handle, inst >> 4);
 
-	mutex_unlock (&dev_priv->vm_mutex);
+	kref_put(&ch->ref, pscnv_chan_ref_free);
 	return ret;
 }
 
@@ -222,10 +248,7 @@ static void pscnv_chan_vm_open(struct vm_area_struct *vma) {
 
 static void pscnv_chan_vm_close(struct vm_area_struct *vma) {
 	struct pscnv_chan *ch = vma->vm_private_data;
-	struct drm_nouveau_private *dev_priv = ch->vspace->dev->dev_private;
-	mutex_lock (&dev_priv->vm_mutex);
 	kref_put(&ch->ref, pscnv_chan_ref_free);
-	mutex_unlock (&dev_priv->vm_mutex);
 }
 
 static struct vm_operations_struct pscnv_chan_vm_ops = {
@@ -244,15 +267,11 @@ int pscnv_chan_mmap(struct file *filp, struct vm_area_struct *vma)
 	if ((vma->vm_pgoff * PAGE_SIZE & ~0x7f0000ull) == 0xc0000000) {
 		if (vma->vm_end - vma->vm_start > 0x2000)
 			return -EINVAL;
-		mutex_lock (&dev_priv->vm_mutex);
 		cid = (vma->vm_pgoff * PAGE_SIZE >> 16) & 0x7f;
+		/* the reference is kept by the mapping */
 		ch = pscnv_get_chan(dev, filp->private_data, cid);
-		if (!ch) {
-			mutex_unlock (&dev_priv->vm_mutex);
+		if (!ch)
 			return -ENOENT;
-		}
-		kref_get(&ch->ref);
-		mutex_unlock (&dev_priv->vm_mutex);
 
 		vma->vm_flags |= VM_RESERVED | VM_IO | VM_PFNMAP | VM_DONTEXPAND;
 		vma->vm_ops = &pscnv_chan_vm_ops;
@@ -266,16 +285,17 @@ int pscnv_chan_mmap(struct file *filp, struct vm_area_struct *vma)
 
 void pscnv_chan_cleanup(struct drm_device *dev, struct drm_file *file_priv) {
 	struct drm_nouveau_private *dev_priv = dev->dev_private;
-	int cid;
+	struct pscnv_fpriv *fpriv = file_priv->driver_priv;
 	struct pscnv_chan *ch;
 
 	mutex_lock (&dev_priv->vm_mutex);
-	for (cid = 0; cid < 128; cid++) {
-		ch = pscnv_get_chan(dev, file_priv, cid);
-		if (!ch)
-			continue;
+	while (!list_empty(&fpriv->chans)) {
+		ch = list_first_entry(&fpriv->chans, struct pscnv_chan, file_list);
+		list_del(&ch->file_list);
 		ch->filp = 0;
+		mutex_unlock (&dev_priv->vm_mutex);
 		kref_put(&ch->ref, pscnv_chan_ref_free);
+		mutex_lock (&dev_priv->vm_mutex);
 	}
 	mutex_unlock (&dev_priv->vm_mutex);
 }
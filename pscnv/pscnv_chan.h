@@ -32,6 +32,9 @@
 #include "pscnv_engine.h"
 #include <linux/kref.h>
 
+/* PFIFO channels. 0 is the BAR channel. */
+#define PSCNV_CHAN_NUM 128
+
 struct pscnv_chan {
 	int cid;
 	struct pscnv_vspace *vspace;
@@ -44,7 +47,11 @@ struct pscnv_chan {
 	uint32_t ramfc;
 	struct pscnv_vo *cache;
 	struct drm_file *filp;
+	/* link in the owning file's list, see struct pscnv_fpriv */
+	struct list_head file_list;
 	struct kref ref;
+	/* serializes setting up engines and the FIFO */
+	struct mutex lock;
 	void *engdata[PSCNV_ENGINES_NUM];
 };
 
@@ -53,7 +60,9 @@ extern void pscnv_chan_free(struct pscnv_chan *);
 
 extern void pscnv_chan_cleanup(struct drm_device *dev, struct drm_file *file_priv);
 extern int pscnv_chan_mmap(struct file *filp, struct vm_area_struct *vma);
+/* takes a reference, drop it with kref_put */
 struct pscnv_chan *pscnv_get_chan(struct drm_device *dev, struct drm_file *file_priv, int cid);
+extern void pscnv_chan_ref_free(struct kref *ref);
 
 int pscnv_ioctl_chan_new(struct drm_device *dev, void *data,
 						struct drm_file *file_priv);
@@ -0,0 +1,331 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * Copyright 2010 PathScale Inc.  All rights reserved.
+ * Use is subject to license terms.
+ */
+
+#include "drmP.h"
+#include "drm.h"
+#include "nouveau_drv.h"
+#include "pscnv_vram.h"
+#include "pscnv_vm.h"
+#include <linux/list.h>
+#include <linux/kernel.h>
+#include <linux/mutex.h>
+#include <linux/workqueue.h>
+
+/* VRAM compaction.
+ *
+ * A pass walks used regions from the top of VRAM down, and tries to move
+ * every movable VO it meets: sane VOs into free space below all of their
+ * current regions, LSR VOs into free space above them. Since VOs only ever
+ * move towards their end of VRAM, a pass always terminates, and what it
+ * leaves behind are larger free extents in the middle.
+ *
+ * Moving a VO means allocating a new set of regions for it, copying the
+ * contents with the device's mover, swapping the region lists and then
+ * rewriting PTEs of every mapping on vo->maps. We have no way to idle
+ * the GPU or the CPU users of a VO yet, so a VO is only movable if it's
+ * a GEM object, isn't pinned, has no BAR mappings, and is only mapped into
+ * vspaces without channels.
+ *
+ * Compaction never waits for a vspace lock or a VO's maps_lock - it may be
+ * called from an allocation done with those held - it just skips VOs it
+ * can't lock right away.
+ */
+
+/* the default mover: copies and clears through the PRAMIN window, a page
+ * at a time. */
+static int
+pscnv_vram_cpu_copy (struct drm_device *dev, uint64_t dst, uint64_t src, uint64_t size)
+{
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	uint32_t *buf = kmalloc(PSCNV_VRAM_PAGE_SIZE, GFP_KERNEL);
+	uint64_t off;
+	int i;
+	if (!buf)
+		return -ENOMEM;
+	for (off = 0; off < size; off += PSCNV_VRAM_PAGE_SIZE) {
+		spin_lock(&dev_priv->pramin_lock);
+		dev_priv->pramin_start = (src + off) >> 16;
+		nv_wr32(dev, 0x1700, dev_priv->pramin_start);
+		for (i = 0; i < PSCNV_VRAM_PAGE_SIZE / 4; i++)
+			buf[i] = nv_rd32(dev, 0x700000 + ((src + off) & 0xffff) + i * 4);
+		dev_priv->pramin_start = (dst + off) >> 16;
+		nv_wr32(dev, 0x1700, dev_priv->pramin_start);
+		for (i = 0; i < PSCNV_VRAM_PAGE_SIZE / 4; i++)
+			nv_wr32(dev, 0x700000 + ((dst + off) & 0xffff) + i * 4, buf[i]);
+		spin_unlock(&dev_priv->pramin_lock);
+	}
+	kfree(buf);
+	return 0;
+}
+
+static int
+pscnv_vram_cpu_clear (struct drm_device *dev, uint64_t dst, uint64_t size)
+{
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	uint64_t off;
+	int i;
+	for (off = 0; off < size; off += PSCNV_VRAM_PAGE_SIZE) {
+		spin_lock(&dev_priv->pramin_lock);
+		dev_priv->pramin_start = (dst + off) >> 16;
+		nv_wr32(dev, 0x1700, dev_priv->pramin_start);
+		for (i = 0; i < PSCNV_VRAM_PAGE_SIZE / 4; i++)
+			nv_wr32(dev, 0x700000 + ((dst + off) & 0xffff) + i * 4, 0);
+		spin_unlock(&dev_priv->pramin_lock);
+	}
+	return 0;
+}
+
+struct pscnv_vram_mover pscnv_vram_cpu_mover = {
+	.name = "CPU",
+	.copy = pscnv_vram_cpu_copy,
+	.clear = pscnv_vram_cpu_clear,
+};
+
+/* copies contents of one VO into another of the same size, region by region */
+static int
+pscnv_vram_copy_vo (struct drm_device *dev, struct pscnv_vo *dst, struct pscnv_vo *src)
+{
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	struct pscnv_vram_region *dreg, *sreg;
+	uint64_t doff = 0, soff = 0;
+	int ret;
+	dreg = list_first_entry(&dst->regions, struct pscnv_vram_region, local_list);
+	sreg = list_first_entry(&src->regions, struct pscnv_vram_region, local_list);
+	while (&dreg->local_list != &dst->regions && &sreg->local_list != &src->regions) {
+		uint64_t len = min(dreg->size - doff, sreg->size - soff);
+		if ((ret = dev_priv->vram_mover->copy(dev, dreg->start + doff, sreg->start + soff, len)))
+			return ret;
+		doff += len;
+		soff += len;
+		if (doff == dreg->size) {
+			dreg = list_entry(dreg->local_list.next, struct pscnv_vram_region, local_list);
+			doff = 0;
+		}
+		if (soff == sreg->size) {
+			sreg = list_entry(sreg->local_list.next, struct pscnv_vram_region, local_list);
+			soff = 0;
+		}
+	}
+	return 0;
+}
+
+/* lowest and highest address used by a VO, returns its region count */
+static int
+pscnv_vram_vo_bounds (struct pscnv_vo *vo, uint64_t *lo, uint64_t *hi)
+{
+	struct pscnv_vram_region *reg;
+	int res = 0;
+	*lo = ~0ull;
+	*hi = 0;
+	list_for_each_entry(reg, &vo->regions, local_list) {
+		if (reg->start < *lo)
+			*lo = reg->start;
+		if (reg->start + reg->size > *hi)
+			*hi = reg->start + reg->size;
+		res++;
+	}
+	return res;
+}
+
+/* moves a VO to a better place, if there's one. Needs vo->maps_lock. */
+static int
+pscnv_vram_relocate (struct pscnv_vo *vo)
+{
+	struct drm_device *dev = vo->dev;
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	struct pscnv_vm_mapnode *node, *failed = 0;
+	struct pscnv_vram_region *reg;
+	struct pscnv_vo *nvo;
+	uint64_t olo, ohi, nlo, nhi, tmp;
+	int lsr, onum, nnum, ret = 0;
+	LIST_HEAD(regions);
+
+	if (vo->pinned || vo->map1 || vo->map3)
+		return -EBUSY;
+	list_for_each_entry(node, &vo->maps, vo_list) {
+		if (!mutex_trylock(&node->vspace->lock)) {
+			failed = node;
+			break;
+		}
+		/* a batch in progress may still have stale TLB entries */
+		if (!list_empty(&node->vspace->chan_list) || node->vspace->tlb_batch) {
+			mutex_unlock(&node->vspace->lock);
+			failed = node;
+			break;
+		}
+	}
+	if (failed) {
+		list_for_each_entry(node, &vo->maps, vo_list) {
+			if (node == failed)
+				break;
+			mutex_unlock(&node->vspace->lock);
+		}
+		return -EBUSY;
+	}
+
+	nvo = pscnv_vram_alloc(dev, vo->size, vo->align, vo->flags, vo->tile_flags, vo->cookie);
+	if (!nvo) {
+		ret = -ENOSPC;
+		goto out;
+	}
+	onum = pscnv_vram_vo_bounds(vo, &olo, &ohi);
+	nnum = pscnv_vram_vo_bounds(nvo, &nlo, &nhi);
+	reg = list_first_entry(&vo->regions, struct pscnv_vram_region, local_list);
+	lsr = reg->type == PSCNV_VRAM_USED_LSR;
+	if ((lsr ? nlo < ohi : nhi > olo) || nnum > onum) {
+		/* not an improvement */
+		pscnv_vram_free(nvo);
+		ret = -ENOSPC;
+		goto out;
+	}
+	if ((ret = pscnv_vram_copy_vo(dev, nvo, vo))) {
+		pscnv_vram_free(nvo);
+		goto out;
+	}
+
+	mutex_lock(&dev_priv->vram_mutex);
+	list_splice_init(&vo->regions, &regions);
+	list_splice_init(&nvo->regions, &vo->regions);
+	list_splice_init(&regions, &nvo->regions);
+	list_for_each_entry(reg, &vo->regions, local_list)
+		reg->vo = vo;
+	list_for_each_entry(reg, &nvo->regions, local_list)
+		reg->vo = nvo;
+	tmp = vo->start;
+	vo->start = nvo->start;
+	nvo->start = tmp;
+	mutex_unlock(&dev_priv->vram_mutex);
+	pscnv_vram_trace_move(vo, nvo);
+
+	/* mapping over the old PTEs leaves the page tables in place. The
+	 * batch end flushes the TLBs before the old regions are freed. */
+	list_for_each_entry(node, &vo->maps, vo_list) {
+		pscnv_vspace_batch_begin(node->vspace);
+		dev_priv->vm->do_map(node->vspace, vo, node->start, node->vo_off, node->size);
+		pscnv_vspace_tlb_flush_later(node->vspace);
+		pscnv_vspace_batch_end(node->vspace);
+	}
+
+	if (pscnv_vram_debug >= 1)
+		NV_INFO(dev, "VRAM: Moved VO %d of type %08x from %llx-%llx to %llx-%llx\n",
+				vo->serial, vo->cookie, (unsigned long long)olo, (unsigned long long)ohi,
+				(unsigned long long)nlo, (unsigned long long)nhi);
+	dev_priv->vram_compact_moved++;
+	dev_priv->vram_compact_bytes += vo->size;
+
+	/* the old regions go away with the temporary VO */
+	pscnv_vram_free(nvo);
+out:
+	list_for_each_entry(node, &vo->maps, vo_list)
+		mutex_unlock(&node->vspace->lock);
+	return ret;
+}
+
+/* runs a single compaction pass, returning the number of VOs moved. */
+int
+pscnv_vram_compact (struct drm_device *dev)
+{
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	struct pscnv_vram_region *reg;
+	struct pscnv_vo *vo;
+	uint64_t cursor = ~0ull;
+	int moved = 0;
+
+	/* one pass at a time. A failed alloc from inside a pass won't
+	 * recurse either. */
+	if (!mutex_trylock(&dev_priv->vram_compact_mutex))
+		return 0;
+
+	for (;;) {
+		/* find the next movable candidate below the cursor */
+		vo = 0;
+		mutex_lock(&dev_priv->vram_mutex);
+		list_for_each_entry_reverse(reg, &dev_priv->vram_global_list, global_list) {
+			if (reg->start >= cursor)
+				continue;
+			if (reg->type <= PSCNV_VRAM_LAST_FREE)
+				continue;
+			cursor = reg->start;
+			if (!reg->vo->gem || reg->vo->pinned)
+				continue;
+			if (!mutex_trylock(&reg->vo->maps_lock))
+				continue;
+			/* pinned VOs include ones on their way out. */
+			if (reg->vo->pinned) {
+				mutex_unlock(&reg->vo->maps_lock);
+				continue;
+			}
+			vo = reg->vo;
+			break;
+		}
+		mutex_unlock(&dev_priv->vram_mutex);
+		if (!vo)
+			break;
+		if (!pscnv_vram_relocate(vo))
+			moved++;
+		mutex_unlock(&vo->maps_lock);
+	}
+
+	if (moved && pscnv_vram_debug >= 1)
+		NV_INFO(dev, "VRAM: Compaction moved %d VOs, %lld VOs/%lld bytes total\n",
+				moved, (long long)dev_priv->vram_compact_moved, (long long)dev_priv->vram_compact_bytes);
+	mutex_unlock(&dev_priv->vram_compact_mutex);
+	return moved;
+}
+
+static void
+pscnv_vram_compact_work (struct work_struct *work)
+{
+	struct drm_nouveau_private *dev_priv =
+		container_of(work, struct drm_nouveau_private, vram_compact_work.work);
+	pscnv_vram_compact(dev_priv->dev);
+}
+
+void
+pscnv_vram_compact_init (struct drm_device *dev)
+{
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	mutex_init(&dev_priv->vram_compact_mutex);
+	INIT_DELAYED_WORK(&dev_priv->vram_compact_work, pscnv_vram_compact_work);
+	dev_priv->vram_mover = &pscnv_vram_cpu_mover;
+}
+
+void
+pscnv_vram_compact_takedown (struct drm_device *dev)
+{
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	cancel_delayed_work_sync(&dev_priv->vram_compact_work);
+}
+
+/* called after VRAM got freed - lets the background worker have a go at
+ * it, once things settle down. */
+void
+pscnv_vram_compact_kick (struct drm_device *dev)
+{
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	if (pscnv_vram_compact_mode >= PSCNV_VRAM_COMPACT_BACKGROUND)
+		schedule_delayed_work(&dev_priv->vram_compact_work, HZ);
+}
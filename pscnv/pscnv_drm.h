@@ -66,6 +66,29 @@ struct drm_pscnv_gem_info {	/* n i */
 #define PSCNV_GEM_CONTIG	0x00000001	/* needs to be contiguous in VRAM */
 #define PSCNV_GEM_MAPPABLE	0x00000002	/* intended to be mmapped by host */
 #define PSCNV_GEM_GART		0x00000004	/* should be allocated in GART */
+#define PSCNV_GEM_SPREAD	0x00000008	/* spread evenly over memory partitions */
+#define PSCNV_GEM_HOT		0x00000010	/* small and busy, keep with other hot objects */
+/* how the host mmaps the BO */
+#define PSCNV_GEM_MAP_MASK	0x00000300
+#define PSCNV_GEM_MAP_WC	0x00000000	/* write-combined, for uploads */
+#define PSCNV_GEM_MAP_UC	0x00000100	/* uncached */
+#define PSCNV_GEM_MAP_CACHED	0x00000200	/* cached host staging copy, moved with gem_sync */
+
+/* for gem_sync */
+struct drm_pscnv_gem_sync {
+	uint32_t handle;	/* < */
+	uint32_t flags;		/* < */
+};
+#define PSCNV_GEM_SYNC_TO_VRAM		0x00000001	/* staging copy -> VRAM */
+#define PSCNV_GEM_SYNC_FROM_VRAM	0x00000002	/* VRAM -> staging copy */
+
+/* for gem_new_aligned */
+struct drm_pscnv_gem_new_aligned {
+	/* as for gem_new */
+	struct drm_pscnv_gem_info info;
+	/* VRAM alignment, power of two. 0 means page size. */
+	uint64_t align;		/* < > */
+};
 
 /* for vspace_new and vspace_free */
 struct drm_pscnv_vspace_req {	/* n f */
@@ -78,17 +101,82 @@ struct drm_pscnv_vspace_map {
 	uint64_t start;		/* < */
 	uint64_t end;		/* < */
 	uint32_t back;		/* < */
-	/* none defined yet */
+	/* PSCNV_MAP_* */
 	uint32_t flags;		/* < */
 	uint64_t offset;	/* > */
 };
+#define PSCNV_MAP_FIXED		0x00000001	/* map at exactly start, which has to be free or reserved */
 
+/* maps length bytes of a BO from bo_offset on. Both page aligned. */
+struct drm_pscnv_vspace_map_range {
+	uint32_t vid;		/* < */
+	uint32_t handle;	/* < */
+	uint64_t bo_offset;	/* < */
+	uint64_t length;	/* < */
+	uint64_t start;		/* < */
+	uint64_t end;		/* < */
+	uint32_t back;		/* < */
+	/* PSCNV_MAP_* */
+	uint32_t flags;		/* < */
+	uint64_t offset;	/* > */
+};
+
+/* moves the window of the mapping at offset to bo_offset in its BO */
+struct drm_pscnv_vspace_remap {
+	uint32_t vid;		/* < */
+	uint32_t _pad;
+	uint64_t offset;	/* < */
+	uint64_t bo_offset;	/* < */
+};
+
+/* for vspace_unmap and vspace_unreserve */
 struct drm_pscnv_vspace_unmap {
 	uint32_t vid;		/* < */
 	uint32_t _pad;
 	uint64_t offset;	/* < */
 };
 
+/* takes a range of address space out of normal allocation. Only maps
+ * with PSCNV_MAP_FIXED go there. */
+struct drm_pscnv_vspace_reserve {
+	uint32_t vid;		/* < */
+	/* PSCNV_MAP_FIXED to reserve at exactly start */
+	uint32_t flags;		/* < */
+	uint64_t size;		/* < */
+	uint64_t start;		/* < */
+	uint64_t end;		/* < */
+	uint32_t back;		/* < */
+	uint32_t _pad;
+	uint64_t offset;	/* > */
+};
+
+/* for vspace_map_batch: one per BO to map, results filled in */
+struct drm_pscnv_vspace_map_entry {
+	uint32_t handle;	/* < */
+	uint32_t back;		/* < */
+	uint64_t start;		/* < */
+	uint64_t end;		/* < */
+	uint32_t flags;		/* < */
+	int32_t result;		/* > 0 or -errno */
+	uint64_t offset;	/* > */
+};
+
+struct drm_pscnv_vspace_map_batch {
+	uint32_t vid;		/* < */
+	uint32_t count;		/* < */
+	/* user pointer to count drm_pscnv_vspace_map_entry */
+	uint64_t entries;	/* < */
+};
+
+struct drm_pscnv_vspace_unmap_batch {
+	uint32_t vid;		/* < */
+	uint32_t count;		/* < */
+	/* user pointer to count uint64_t offsets */
+	uint64_t offsets;	/* < */
+	/* user pointer to count int32_t results, 0 or -errno. May be 0. */
+	uint64_t results;	/* < */
+};
+
 struct drm_pscnv_chan_new {
 	uint32_t vid;		/* < */
 	uint32_t cid;		/* > */
@@ -148,5 +236,13 @@ struct drm_pscnv_obj_eng_new {
 #define DRM_PSCNV_FIFO_INIT          0x29	/* Initialises PFIFO processing on a channel */
 #define DRM_PSCNV_OBJ_ENG_NEW        0x2a	/* Create a new engine object on a channel */
 #define DRM_PSCNV_FIFO_INIT_IB       0x2b	/* Initialises IB PFIFO processing on a channel */
+#define DRM_PSCNV_VSPACE_MAP_BATCH   0x2c	/* Maps a list of BOs to a vspace */
+#define DRM_PSCNV_VSPACE_UNMAP_BATCH 0x2d	/* Unmaps a list of BOs from a vspace */
+#define DRM_PSCNV_VSPACE_RESERVE     0x2e	/* Reserves a range of a vspace */
+#define DRM_PSCNV_VSPACE_UNRESERVE   0x2f	/* Drops a reserved range of a vspace */
+#define DRM_PSCNV_VSPACE_MAP_RANGE   0x30	/* Maps part of a BO to a vspace */
+#define DRM_PSCNV_VSPACE_REMAP       0x31	/* Moves a partial mapping over its BO */
+#define DRM_PSCNV_GEM_SYNC           0x32	/* Syncs a cached BO's staging copy with VRAM */
+#define DRM_PSCNV_GEM_NEW_ALIGNED    0x33	/* create a new BO with a given VRAM alignment */
 
 #endif /* __PSCNV_DRM_H__ */
@@ -3,16 +3,32 @@
 
 struct pscnv_chan;
 struct pscnv_vspace;
+struct seq_file;
 
 struct pscnv_vm_engine {
 	void (*takedown) (struct drm_device *dev);
 	int (*do_vspace_new) (struct pscnv_vspace *vs);
 	void (*do_vspace_free) (struct pscnv_vspace *vs);
-	int (*do_map) (struct pscnv_vspace *vs, struct pscnv_vo *vo, uint64_t offset);
+	/* maps size bytes of vo from vo_off on at offset, replacing what
+	 * was there */
+	int (*do_map) (struct pscnv_vspace *vs, struct pscnv_vo *vo, uint64_t offset, uint64_t vo_off, uint64_t size);
 	int (*do_unmap) (struct pscnv_vspace *vs, uint64_t offset, uint64_t length);
 	int (*map_user) (struct pscnv_vo *);
 	int (*map_kernel) (struct pscnv_vo *);
 	void (*bar_flush) (struct drm_device *dev);
+	/* optional: stocks up on page tables before the vspace lock is
+	 * taken, so that do_map seldom has to allocate one under it */
+	void (*prealloc) (struct drm_device *dev);
+	/* page table queries, answered without touching VRAM. Called
+	 * with the vspace lock held. translate gives the PTE mapping addr
+	 * or -ENOENT, next_mapped the first mapped address in [start, end)
+	 * or end. */
+	int (*translate) (struct pscnv_vspace *vs, uint64_t addr, uint64_t *pte);
+	uint64_t (*next_mapped) (struct pscnv_vspace *vs, uint64_t start, uint64_t end);
+	void (*dump) (struct pscnv_vspace *vs, struct seq_file *m);
+	/* large page size, 0 if none. VOs aligned to it are mapped at
+	 * addresses aligned to it. */
+	uint64_t lpage_size;
 };
 
 struct pscnv_engine {
@@ -24,6 +24,8 @@
  * Use is subject to license terms.
  */
 
+#include <linux/vmalloc.h>
+
 #include "drmP.h"
 #include "drm.h"
 #include "nouveau_drv.h"
@@ -31,24 +33,38 @@
 #include "pscnv_vram.h"
 #include "pscnv_drm.h"
 
+/* called with struct_mutex held */
 void pscnv_gem_free_object (struct drm_gem_object *obj) {
 	struct pscnv_vo *vo = obj->driver_private;
+	struct drm_nouveau_private *dev_priv = obj->dev->dev_private;
+	if (vo->mmap_id)
+		idr_remove(&dev_priv->mmap_idr, vo->mmap_id);
+	vfree(vo->staging);
 	pscnv_vram_free(vo);
 }
 
-struct drm_gem_object *pscnv_gem_new(struct drm_device *dev, uint64_t size, uint32_t flags,
-		uint32_t tile_flags, uint32_t cookie, uint32_t *user)
+struct drm_gem_object *pscnv_gem_new(struct drm_device *dev, uint64_t size, uint64_t align,
+		uint32_t flags, uint32_t tile_flags, uint32_t cookie, uint32_t *user)
 {
 	int i;
 	struct drm_gem_object *obj;
 	struct pscnv_vo *vo;
 
-	vo = pscnv_vram_alloc(dev, size, flags, tile_flags, cookie);
+	vo = pscnv_vram_alloc(dev, size, align, flags, tile_flags, cookie);
 	if (!vo)
 		return 0;
 
+	if ((flags & PSCNV_GEM_MAP_MASK) == PSCNV_GEM_MAP_CACHED) {
+		vo->staging = vmalloc_user(vo->size);
+		if (!vo->staging) {
+			pscnv_vram_free(vo);
+			return 0;
+		}
+	}
+
 	obj = drm_gem_object_alloc(dev, vo->size);
 	if (!obj) {
+		vfree(vo->staging);
 		pscnv_vram_free(vo);
 		return 0;
 	}
@@ -65,17 +81,35 @@ struct drm_gem_object *pscnv_gem_new(struct drm_device *dev, uint64_t size, uint
 	return obj;
 }
 
-int pscnv_ioctl_gem_new(struct drm_device *dev, void *data,
-						struct drm_file *file_priv)
+/* gives vo an mmap ID, unique across the device */
+static int pscnv_gem_mmap_id(struct drm_device *dev, struct pscnv_vo *vo)
+{
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	int ret, id;
+	do {
+		if (!idr_pre_get(&dev_priv->mmap_idr, GFP_KERNEL))
+			return -ENOMEM;
+		mutex_lock(&dev->struct_mutex);
+		ret = idr_get_new_above(&dev_priv->mmap_idr, vo, 1, &id);
+		if (!ret)
+			vo->mmap_id = id;
+		mutex_unlock(&dev->struct_mutex);
+	} while (ret == -EAGAIN);
+	return ret;
+}
+
+static int pscnv_gem_new_handle(struct drm_device *dev, struct drm_file *file_priv,
+		struct drm_pscnv_gem_info *info, uint64_t *align)
 {
-	struct drm_pscnv_gem_info *info = data;
 	struct drm_gem_object *obj;
 	struct pscnv_vo *vo;
 	int ret;
 
-	NOUVEAU_CHECK_INITIALISED_WITH_RETURN;
+	info->flags &= PSCNV_GEM_USER_FLAGS;
+	if ((info->flags & PSCNV_GEM_MAP_MASK) == PSCNV_GEM_MAP_MASK)
+		return -EINVAL;
 
-	obj = pscnv_gem_new(dev, info->size, info->flags, info->tile_flags, info->cookie, info->user);
+	obj = pscnv_gem_new(dev, info->size, *align, info->flags, info->tile_flags, info->cookie, info->user);
 	if (!obj) {
 		return -ENOMEM;
 	}
@@ -83,17 +117,48 @@ int pscnv_ioctl_gem_new(struct drm_device *dev, void *data,
 
 	/* could change due to page size align */
 	info->size = vo->size;
+	*align = vo->align;
+
+	ret = pscnv_gem_mmap_id(dev, vo);
+	if (ret) {
+		drm_gem_object_handle_unreference_unlocked (obj);
+		return ret;
+	}
 
 	ret = drm_gem_handle_create(file_priv, obj, &info->handle);
 
 	if (pscnv_gem_debug >= 1)
 		NV_INFO(dev, "GEM handle %x is VO %x/%d\n", info->handle, vo->cookie, vo->serial);
 
-	info->map_handle = (uint64_t)info->handle << 32;
+	info->map_handle = (uint64_t)vo->mmap_id << 32;
 	drm_gem_object_handle_unreference_unlocked (obj);
 	return ret;
 }
 
+int pscnv_ioctl_gem_new(struct drm_device *dev, void *data,
+						struct drm_file *file_priv)
+{
+	struct drm_pscnv_gem_info *info = data;
+	uint64_t align = 0;
+
+	NOUVEAU_CHECK_INITIALISED_WITH_RETURN;
+
+	return pscnv_gem_new_handle(dev, file_priv, info, &align);
+}
+
+int pscnv_ioctl_gem_new_aligned(struct drm_device *dev, void *data,
+						struct drm_file *file_priv)
+{
+	struct drm_pscnv_gem_new_aligned *req = data;
+
+	NOUVEAU_CHECK_INITIALISED_WITH_RETURN;
+
+	if (!pscnv_vram_align_valid(req->align))
+		return -EINVAL;
+
+	return pscnv_gem_new_handle(dev, file_priv, &req->info, &req->align);
+}
+
 int pscnv_ioctl_gem_info(struct drm_device *dev, void *data,
 						struct drm_file *file_priv)
 {
@@ -114,7 +179,7 @@ int pscnv_ioctl_gem_info(struct drm_device *dev, void *data,
 	info->flags = vo->flags;
 	info->tile_flags = vo->tile_flags;
 	info->size = obj->size;
-	info->map_handle = (uint64_t)info->handle << 32;
+	info->map_handle = (uint64_t)vo->mmap_id << 32;
 	for (i = 0; i < ARRAY_SIZE(vo->user); i++)
 		info->user[i] = vo->user[i];
 
@@ -123,3 +188,25 @@ int pscnv_ioctl_gem_info(struct drm_device *dev, void *data,
 	return 0;
 }
 
+int pscnv_ioctl_gem_sync(struct drm_device *dev, void *data,
+						struct drm_file *file_priv)
+{
+	struct drm_pscnv_gem_sync *req = data;
+	struct drm_gem_object *obj;
+	int ret;
+
+	NOUVEAU_CHECK_INITIALISED_WITH_RETURN;
+
+	if (req->flags != PSCNV_GEM_SYNC_TO_VRAM && req->flags != PSCNV_GEM_SYNC_FROM_VRAM)
+		return -EINVAL;
+
+	obj = drm_gem_object_lookup(dev, file_priv, req->handle);
+	if (!obj)
+		return -EBADF;
+
+	ret = pscnv_vo_staging_sync(obj->driver_private, req->flags == PSCNV_GEM_SYNC_TO_VRAM);
+
+	drm_gem_object_unreference_unlocked(obj);
+
+	return ret;
+}
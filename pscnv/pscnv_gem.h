@@ -29,13 +29,22 @@
 
 #include "drmP.h"
 
+/* the GEM flags userspace may pass to gem_new; the rest of the VO flag
+ * space, like PSCNV_VO_ZERO, is for kernel allocations only */
+#define PSCNV_GEM_USER_FLAGS	(PSCNV_GEM_CONTIG | PSCNV_GEM_MAPPABLE | PSCNV_GEM_GART | \
+				 PSCNV_GEM_SPREAD | PSCNV_GEM_HOT | PSCNV_GEM_MAP_MASK)
+
 void pscnv_gem_free_object (struct drm_gem_object *);
 struct drm_gem_object *pscnv_gem_new(struct drm_device *dev, uint64_t size,
-		uint32_t flags,	uint32_t tile_flags, uint32_t cookie,
+		uint64_t align, uint32_t flags,	uint32_t tile_flags, uint32_t cookie,
 		uint32_t *user);
 int pscnv_ioctl_gem_new(struct drm_device *dev, void *data,
 		struct drm_file *file_priv);
+int pscnv_ioctl_gem_new_aligned(struct drm_device *dev, void *data,
+		struct drm_file *file_priv);
 int pscnv_ioctl_gem_info(struct drm_device *dev, void *data,
 		struct drm_file *file_priv);
+int pscnv_ioctl_gem_sync(struct drm_device *dev, void *data,
+		struct drm_file *file_priv);
 
 #endif
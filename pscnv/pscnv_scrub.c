@@ -0,0 +1,217 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * Copyright 2010 PathScale Inc.  All rights reserved.
+ * Use is subject to license terms.
+ */
+
+#include "drmP.h"
+#include "drm.h"
+#include "nouveau_drv.h"
+#include "pscnv_vram.h"
+#include <linux/kernel.h>
+#include <linux/mutex.h>
+#include <linux/ktime.h>
+#include <linux/workqueue.h>
+
+/* VOs allocated with PSCNV_VO_ZERO start out zeroed. Clearing them through
+ * the mover is slow, and the kernel's zeroed VOs - graph contexts, page
+ * tables - are allocated on the channel creation and first map paths. So
+ * every distinct shape of zeroed allocation gets a small pool of VOs that
+ * a worker allocates and clears in the background. An allocation that
+ * finds its pool empty clears its VO in place and kicks the worker.
+ *
+ * Only the first PSCNV_VRAM_SCRUB_CLASSES shapes seen get a pool, and only
+ * if they're at most PSCNV_VRAM_SCRUB_MAX_SIZE bytes, so userspace can't
+ * make us sit on lots of VRAM.
+ */
+
+#define PSCNV_VRAM_SCRUB_MAX_SIZE	0x400000
+
+static int
+pscnv_vram_scrub_do_clear (struct pscnv_vo *vo, uint64_t *ns)
+{
+	struct drm_nouveau_private *dev_priv = vo->dev->dev_private;
+	struct pscnv_vram_region *reg;
+	uint64_t t0 = ktime_to_ns(ktime_get());
+	int ret;
+	list_for_each_entry(reg, &vo->regions, local_list)
+		if ((ret = dev_priv->vram_mover->clear(vo->dev, reg->start, reg->size)))
+			return ret;
+	*ns = ktime_to_ns(ktime_get()) - t0;
+	return 0;
+}
+
+/* zeroes a freshly allocated VO on the caller's time */
+int
+pscnv_vram_scrub_clear (struct pscnv_vo *vo)
+{
+	struct drm_nouveau_private *dev_priv = vo->dev->dev_private;
+	uint64_t ns;
+	int ret = pscnv_vram_scrub_do_clear(vo, &ns);
+	if (ret)
+		return ret;
+	mutex_lock(&dev_priv->vram_scrub_mutex);
+	dev_priv->vram_scrub_fg_clears++;
+	dev_priv->vram_scrub_fg_ns += ns;
+	mutex_unlock(&dev_priv->vram_scrub_mutex);
+	return 0;
+}
+
+/* takes a pre-zeroed VO of the given shape, if there's one. Either way,
+ * lets the worker know the pool is in use. */
+struct pscnv_vo *
+pscnv_vram_scrub_take (struct drm_device *dev, uint64_t size, uint64_t align,
+		int flags, int tile_flags, uint32_t cookie)
+{
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	struct pscnv_vram_scrub_class *cl = 0, *empty = 0;
+	struct pscnv_vo *res = 0;
+	int i;
+	if (pscnv_vram_scrub_depth <= 0 || !size || size > PSCNV_VRAM_SCRUB_MAX_SIZE)
+		return 0;
+	size = ALIGN(size, PSCNV_VRAM_PAGE_SIZE);
+	if (align < PSCNV_VRAM_PAGE_SIZE)
+		align = PSCNV_VRAM_PAGE_SIZE;
+
+	mutex_lock(&dev_priv->vram_scrub_mutex);
+	for (i = 0; i < PSCNV_VRAM_SCRUB_CLASSES; i++) {
+		struct pscnv_vram_scrub_class *tmp = &dev_priv->vram_scrub[i];
+		if (!tmp->size) {
+			if (!empty)
+				empty = tmp;
+		} else if (tmp->size == size && tmp->align == align &&
+				tmp->flags == flags && tmp->tile_flags == tile_flags) {
+			cl = tmp;
+			break;
+		}
+	}
+	if (!cl && empty) {
+		cl = empty;
+		cl->size = size;
+		cl->align = align;
+		cl->flags = flags;
+		cl->tile_flags = tile_flags;
+		cl->cookie = cookie;
+		cl->count = 0;
+		if (pscnv_vram_debug >= 1)
+			NV_INFO(dev, "VRAM: Keeping zeroed %#llx-byte VOs of type %08x around\n",
+					(unsigned long long)size, cookie);
+	}
+	if (cl && cl->count) {
+		cl->count--;
+		res = cl->vos[cl->count];
+		dev_priv->vram_scrub_hits++;
+		dev_priv->vram_scrub_saved_ns += cl->ns[cl->count];
+	}
+	mutex_unlock(&dev_priv->vram_scrub_mutex);
+
+	if (cl)
+		schedule_work(&dev_priv->vram_scrub_work);
+	if (res)
+		res->cookie = cookie;
+	return res;
+}
+
+/* tops up all pools to the configured depth */
+static void
+pscnv_vram_scrub_work (struct work_struct *work)
+{
+	struct drm_nouveau_private *dev_priv =
+		container_of(work, struct drm_nouveau_private, vram_scrub_work);
+	struct drm_device *dev = dev_priv->dev;
+	struct pscnv_vram_scrub_class *cl;
+	struct pscnv_vo *vo;
+	uint64_t size, align, ns;
+	int flags, tile_flags, i;
+	uint32_t cookie;
+
+	for (i = 0; i < PSCNV_VRAM_SCRUB_CLASSES; i++) {
+		cl = &dev_priv->vram_scrub[i];
+		for (;;) {
+			mutex_lock(&dev_priv->vram_scrub_mutex);
+			if (!cl->size || cl->count >= min(pscnv_vram_scrub_depth, PSCNV_VRAM_SCRUB_DEPTH)) {
+				mutex_unlock(&dev_priv->vram_scrub_mutex);
+				break;
+			}
+			size = cl->size;
+			align = cl->align;
+			flags = cl->flags;
+			tile_flags = cl->tile_flags;
+			cookie = cl->cookie;
+			mutex_unlock(&dev_priv->vram_scrub_mutex);
+
+			/* if VRAM is that tight, better leave it to others */
+			vo = pscnv_vram_alloc(dev, size, align, flags & ~PSCNV_VO_ZERO, tile_flags, cookie);
+			if (!vo)
+				break;
+			vo->flags |= PSCNV_VO_ZERO;
+			if (pscnv_vram_scrub_do_clear(vo, &ns)) {
+				pscnv_vram_free(vo);
+				break;
+			}
+			if (pscnv_vram_debug >= 2)
+				NV_INFO(dev, "VRAM: Zeroed %#llx-byte VO %d in %lldns\n",
+						(unsigned long long)size, vo->serial, (long long)ns);
+
+			mutex_lock(&dev_priv->vram_scrub_mutex);
+			dev_priv->vram_scrub_bg_ns += ns;
+			if (cl->count < PSCNV_VRAM_SCRUB_DEPTH) {
+				cl->vos[cl->count] = vo;
+				cl->ns[cl->count] = ns;
+				cl->count++;
+				vo = 0;
+			}
+			mutex_unlock(&dev_priv->vram_scrub_mutex);
+			if (vo) {
+				pscnv_vram_free(vo);
+				break;
+			}
+		}
+	}
+}
+
+void
+pscnv_vram_scrub_init (struct drm_device *dev)
+{
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	mutex_init(&dev_priv->vram_scrub_mutex);
+	INIT_WORK(&dev_priv->vram_scrub_work, pscnv_vram_scrub_work);
+}
+
+void
+pscnv_vram_scrub_takedown (struct drm_device *dev)
+{
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	struct pscnv_vram_scrub_class *cl;
+	int i;
+	cancel_work_sync(&dev_priv->vram_scrub_work);
+	for (i = 0; i < PSCNV_VRAM_SCRUB_CLASSES; i++) {
+		cl = &dev_priv->vram_scrub[i];
+		while (cl->count)
+			pscnv_vram_free(cl->vos[--cl->count]);
+		cl->size = 0;
+	}
+	if (pscnv_vram_debug >= 1)
+		NV_INFO(dev, "VRAM: %lld zeroed allocations from the pools, %lld cleared in place\n",
+				(long long)dev_priv->vram_scrub_hits, (long long)dev_priv->vram_scrub_fg_clears);
+}
@@ -0,0 +1,200 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * Copyright 2010 PathScale Inc.  All rights reserved.
+ * Use is subject to license terms.
+ */
+
+#include "drmP.h"
+#include "drm.h"
+#include "nouveau_drv.h"
+#include "pscnv_vram.h"
+#include <linux/list.h>
+#include <linux/kernel.h>
+#include <linux/mutex.h>
+#include <linux/bitops.h>
+
+/* Sub-page kernel VOs are carved out of page-sized contig chunk VOs. A
+ * slab object's start points inside the chunk, and its map3 is the chunk's
+ * BAR3 mapping, if any. It has a single region describing its slot, which
+ * is on no global list or tree. Being smaller than a page, slab VOs can't
+ * be mapped into a vspace. Freed slots are recycled straight from the
+ * chunk bitmap, so the global region lists and vram_mutex are only touched
+ * when a whole chunk comes or goes. */
+
+struct pscnv_vram_slab *
+pscnv_vram_slab_new(struct drm_device *dev, uint32_t objsize, uint32_t cookie)
+{
+	struct pscnv_vram_slab *slab;
+	if (objsize < 0x10 || objsize > PSCNV_VRAM_SLAB_CHUNK / 4 || (objsize & (objsize - 1))) {
+		NV_ERROR(dev, "VRAM: Bad slab object size %#x\n", objsize);
+		return 0;
+	}
+	slab = kzalloc(sizeof *slab, GFP_KERNEL);
+	if (!slab)
+		return 0;
+	slab->dev = dev;
+	slab->objsize = objsize;
+	slab->cookie = cookie;
+	slab->chunk_objs = PSCNV_VRAM_SLAB_CHUNK / objsize;
+	mutex_init(&slab->lock);
+	INIT_LIST_HEAD(&slab->chunks);
+	return slab;
+}
+
+static struct pscnv_vram_slab_chunk *
+pscnv_vram_slab_grow(struct pscnv_vram_slab *slab)
+{
+	struct drm_nouveau_private *dev_priv = slab->dev->dev_private;
+	struct pscnv_vram_slab_chunk *chunk;
+	chunk = kzalloc(sizeof *chunk + BITS_TO_LONGS(slab->chunk_objs) * sizeof(unsigned long), GFP_KERNEL);
+	if (!chunk)
+		return 0;
+	chunk->slab = slab;
+	chunk->vo = pscnv_vram_alloc(slab->dev, PSCNV_VRAM_SLAB_CHUNK, 0, PSCNV_VO_CONTIG, 0, slab->cookie);
+	if (!chunk->vo) {
+		kfree(chunk);
+		return 0;
+	}
+	if (dev_priv->vm)
+		dev_priv->vm->map_kernel(chunk->vo);
+	list_add(&chunk->list, &slab->chunks);
+	slab->nempty++;
+	if (pscnv_vram_debug >= 2)
+		NV_INFO(slab->dev, "VRAM: New %#x-byte slab chunk at %llx\n", slab->objsize,
+				(unsigned long long)chunk->vo->start);
+	return chunk;
+}
+
+static void
+pscnv_vram_slab_shrink(struct pscnv_vram_slab_chunk *chunk)
+{
+	struct pscnv_vram_slab *slab = chunk->slab;
+	if (pscnv_vram_debug >= 2)
+		NV_INFO(slab->dev, "VRAM: Freeing %#x-byte slab chunk at %llx\n", slab->objsize,
+				(unsigned long long)chunk->vo->start);
+	list_del(&chunk->list);
+	slab->nempty--;
+	pscnv_vram_free(chunk->vo);
+	kfree(chunk);
+}
+
+struct pscnv_vo *
+pscnv_vram_slab_alloc(struct pscnv_vram_slab *slab, uint32_t cookie)
+{
+	struct pscnv_vram_slab_chunk *chunk = 0;
+	struct pscnv_vram_region *reg;
+	struct pscnv_vo *res;
+	int slot;
+
+	res = kzalloc(sizeof *res, GFP_KERNEL);
+	reg = kzalloc(sizeof *reg, GFP_KERNEL);
+	if (!res || !reg) {
+		kfree(res);
+		kfree(reg);
+		return 0;
+	}
+
+	mutex_lock(&slab->lock);
+	/* chunks with free slots are kept at the head of the list */
+	if (!list_empty(&slab->chunks))
+		chunk = list_first_entry(&slab->chunks, struct pscnv_vram_slab_chunk, list);
+	if (!chunk || chunk->nused == slab->chunk_objs)
+		chunk = pscnv_vram_slab_grow(slab);
+	if (!chunk) {
+		mutex_unlock(&slab->lock);
+		kfree(res);
+		kfree(reg);
+		return 0;
+	}
+	slot = find_first_zero_bit(chunk->used, slab->chunk_objs);
+	__set_bit(slot, chunk->used);
+	if (!chunk->nused++)
+		slab->nempty--;
+	if (chunk->nused == slab->chunk_objs)
+		list_move_tail(&chunk->list, &slab->chunks);
+	mutex_unlock(&slab->lock);
+
+	res->dev = slab->dev;
+	res->size = slab->objsize;
+	res->align = slab->objsize;
+	res->flags = PSCNV_VO_CONTIG;
+	res->cookie = cookie;
+	res->serial = chunk->vo->serial;
+	res->start = chunk->vo->start + slot * slab->objsize;
+	res->map3 = chunk->vo->map3;
+	res->slab = chunk;
+	/* slab objects never move */
+	res->pinned = 1;
+	INIT_LIST_HEAD(&res->regions);
+	INIT_LIST_HEAD(&reg->global_list);
+	reg->type = PSCNV_VRAM_USED_SANE;
+	reg->start = res->start;
+	reg->size = res->size;
+	reg->vo = res;
+	list_add(&reg->local_list, &res->regions);
+	INIT_LIST_HEAD(&res->maps);
+	INIT_LIST_HEAD(&res->bar1_lru);
+	mutex_init(&res->maps_lock);
+	if (pscnv_vram_debug >= 2)
+		NV_INFO(slab->dev, "Allocating %#x-byte slab VO of type %08x at %llx\n",
+				slab->objsize, cookie, (unsigned long long)res->start);
+	return res;
+}
+
+void
+pscnv_vram_slab_free(struct pscnv_vo *vo)
+{
+	struct pscnv_vram_slab_chunk *chunk = vo->slab;
+	struct pscnv_vram_slab *slab = chunk->slab;
+	struct pscnv_vram_region *reg = list_first_entry(&vo->regions, struct pscnv_vram_region, local_list);
+	int slot = (vo->start - chunk->vo->start) / slab->objsize;
+	if (pscnv_vram_debug >= 2)
+		NV_INFO(slab->dev, "Freeing %#x-byte slab VO of type %08x at %llx\n",
+				slab->objsize, vo->cookie, (unsigned long long)vo->start);
+	mutex_lock(&slab->lock);
+	__clear_bit(slot, chunk->used);
+	if (chunk->nused-- == slab->chunk_objs)
+		list_move(&chunk->list, &slab->chunks);
+	/* keep one empty chunk around to absorb alloc/free churn */
+	if (!chunk->nused && ++slab->nempty > 1)
+		pscnv_vram_slab_shrink(chunk);
+	mutex_unlock(&slab->lock);
+	kfree(reg);
+	kfree(vo);
+}
+
+void
+pscnv_vram_slab_destroy(struct pscnv_vram_slab *slab)
+{
+	struct pscnv_vram_slab_chunk *chunk, *next;
+	list_for_each_entry_safe(chunk, next, &slab->chunks, list) {
+		if (chunk->nused) {
+			NV_ERROR(slab->dev, "VRAM: %d objects still exist in %#x-byte slab chunk at %llx!\n",
+					chunk->nused, slab->objsize, (unsigned long long)chunk->vo->start);
+			/* count it as empty, so that shrink keeps the books straight */
+			slab->nempty++;
+		}
+		pscnv_vram_slab_shrink(chunk);
+	}
+	kfree(slab);
+}
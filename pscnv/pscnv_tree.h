@@ -2,6 +2,7 @@
  * Originally sys/tree.h from FreeBSD. Changes:
  *  - SPLAY removed
  *  - name changed to avoid collisions
+ *  - insert and remove propagate PSCNV_RB_AUGMENT all the way to the root
  */
 
 /*
@@ -324,7 +325,10 @@ name##_PSCNV_RB_REMOVE(struct name *head, struct type *elm)			\
 			PSCNV_RB_LEFT(parent, field) = child;			\
 		else							\
 			PSCNV_RB_RIGHT(parent, field) = child;		\
-		PSCNV_RB_AUGMENT(parent);					\
+		elm = parent;						\
+		do {							\
+			PSCNV_RB_AUGMENT(elm);				\
+		} while ((elm = PSCNV_RB_PARENT(elm, field)) != NULL);	\
 	} else								\
 		PSCNV_RB_ROOT(head) = child;					\
 color:									\
@@ -352,12 +356,16 @@ name##_PSCNV_RB_INSERT(struct name *head, struct type *elm)			\
 			return (tmp);					\
 	}								\
 	PSCNV_RB_SET(elm, parent, field);					\
+	PSCNV_RB_AUGMENT(elm);						\
 	if (parent != NULL) {						\
 		if (comp < 0)						\
 			PSCNV_RB_LEFT(parent, field) = elm;			\
 		else							\
 			PSCNV_RB_RIGHT(parent, field) = elm;			\
-		PSCNV_RB_AUGMENT(parent);					\
+		tmp = parent;						\
+		do {							\
+			PSCNV_RB_AUGMENT(tmp);				\
+		} while ((tmp = PSCNV_RB_PARENT(tmp, field)) != NULL);	\
 	} else								\
 		PSCNV_RB_ROOT(head) = elm;					\
 	name##_PSCNV_RB_INSERT_COLOR(head, elm);				\
@@ -24,6 +24,8 @@
  * Use is subject to license terms.
  */
 
+#include <linux/vmalloc.h>
+
 #include "drmP.h"
 #include "drm.h"
 #include "nouveau_drv.h"
@@ -31,40 +33,72 @@
 #include "pscnv_vm.h"
 #include "pscnv_chan.h"
 
-#undef PSCNV_RB_AUGMENT
-
-static void PSCNV_RB_AUGMENT(struct pscnv_vm_mapnode *node) {
-	uint64_t maxgap = 0;
-	struct pscnv_vm_mapnode *left = PSCNV_RB_LEFT(node, entry);
-	struct pscnv_vm_mapnode *right = PSCNV_RB_RIGHT(node, entry);
-	if (!node->vo)
-		maxgap = node->size;
-	if (left && left->maxgap > maxgap)
-		maxgap = left->maxgap;
-	if (right && right->maxgap > maxgap)
-		maxgap = right->maxgap;
-	node->maxgap = maxgap;
-}
-
-static int mapcmp(struct pscnv_vm_mapnode *a, struct pscnv_vm_mapnode *b) {
-	if (a->start < b->start)
-		return -1;
-	else if (a->start > b->start)
-		return 1;
-	return 0;
-}
-
-PSCNV_RB_GENERATE_STATIC(pscnv_vm_maptree, pscnv_vm_mapnode, entry, mapcmp)
-
-int pscnv_vspace_tlb_flush (struct pscnv_vspace *vs) {
+static int
+pscnv_vspace_do_tlb_flush (struct pscnv_vspace *vs) {
 	struct drm_nouveau_private *dev_priv = vs->dev->dev_private;
 	int i, ret;
+	if (vs->bar_dirty) {
+		dev_priv->vm->bar_flush(vs->dev);
+		vs->bar_dirty = 0;
+	}
+	vs->tlb_flushes++;
+	vs->tlb_dirty = 0;
 	for (i = 0; i < PSCNV_ENGINES_NUM; i++) {
 		struct pscnv_engine *eng = dev_priv->engines[i];
 		if (vs->engref[i])
 			if ((ret = eng->tlb_flush(eng, vs)))
 				return ret;
 	}
+	/* nothing can reach them through the vspace anymore */
+	while (vs->tlb_nheld)
+		drm_gem_object_unreference(vs->tlb_held[--vs->tlb_nheld]);
+	return 0;
+}
+
+/* flushes right now, batch or not */
+int pscnv_vspace_tlb_flush (struct pscnv_vspace *vs) {
+	vs->tlb_flush_requests++;
+	return pscnv_vspace_do_tlb_flush(vs);
+}
+
+/* flushes now, or when the current batch ends */
+int pscnv_vspace_tlb_flush_later (struct pscnv_vspace *vs) {
+	vs->tlb_flush_requests++;
+	if (vs->tlb_batch) {
+		vs->tlb_dirty = 1;
+		return 0;
+	}
+	return pscnv_vspace_do_tlb_flush(vs);
+}
+
+/* makes the page table writes visible to the card, now or when the
+ * current batch ends */
+void pscnv_vspace_bar_flush_later (struct pscnv_vspace *vs) {
+	struct drm_nouveau_private *dev_priv = vs->dev->dev_private;
+	if (vs->tlb_batch)
+		vs->bar_dirty = 1;
+	else
+		dev_priv->vm->bar_flush(vs->dev);
+}
+
+/* starts a batch of map/unmap operations, all of which get by with one
+ * TLB flush at the end. Batches nest. */
+void
+pscnv_vspace_batch_begin(struct pscnv_vspace *vs) {
+	vs->tlb_batch++;
+}
+
+int
+pscnv_vspace_batch_end(struct pscnv_vspace *vs) {
+	struct drm_nouveau_private *dev_priv = vs->dev->dev_private;
+	if (--vs->tlb_batch)
+		return 0;
+	if (vs->tlb_dirty)
+		return pscnv_vspace_do_tlb_flush(vs);
+	if (vs->bar_dirty) {
+		dev_priv->vm->bar_flush(vs->dev);
+		vs->bar_dirty = 0;
+	}
 	return 0;
 }
 
@@ -72,7 +106,6 @@ struct pscnv_vspace *
 pscnv_vspace_new (struct drm_device *dev) {
 	struct drm_nouveau_private *dev_priv = dev->dev_private;
 	struct pscnv_vspace *res = kzalloc(sizeof *res, GFP_KERNEL);
-	struct pscnv_vm_mapnode *fmap;
 	if (!res) {
 		NV_ERROR(dev, "VM: Couldn't alloc vspace\n");
 		return 0;
@@ -81,23 +114,16 @@ pscnv_vspace_new (struct drm_device *dev) {
 	kref_init(&res->ref);
 	mutex_init(&res->lock);
 	INIT_LIST_HEAD(&res->chan_list);
-	PSCNV_RB_INIT(&res->maps);
 	if (dev_priv->vm->do_vspace_new(res)) {
 		kfree(res);
 		return 0;
 	}
-	fmap = kzalloc(sizeof *fmap, GFP_KERNEL);
-	if (!fmap) {
+	if (pscnv_vspace_tree_init(res)) {
 		NV_ERROR(dev, "VM: Couldn't alloc mapping\n");
 		dev_priv->vm->do_vspace_free(res);
 		kfree(res);
 		return 0;
 	}
-	fmap->vspace = res;
-	fmap->start = 0;
-	fmap->size = 1ULL << 40;
-	fmap->maxgap = fmap->size;
-	PSCNV_RB_INSERT(pscnv_vm_maptree, &res->maps, fmap);
 	return res;
 }
 
@@ -106,12 +132,19 @@ pscnv_vspace_free(struct pscnv_vspace *vs) {
 	struct drm_nouveau_private *dev_priv = vs->dev->dev_private;
 	struct pscnv_vm_mapnode *node;
 	while ((node = PSCNV_RB_ROOT(&vs->maps))) {
+		if (node->vo) {
+			mutex_lock(&node->vo->maps_lock);
+			list_del(&node->vo_list);
+			mutex_unlock(&node->vo->maps_lock);
+		}
 		if (node->vo && !vs->isbar) {
 			drm_gem_object_unreference_unlocked(node->vo->gem);
 		}
 		PSCNV_RB_REMOVE(pscnv_vm_maptree, &vs->maps, node);
 		kfree(node);
 	}
+	if (vs->tlb_dirty)
+		pscnv_vspace_do_tlb_flush(vs);
 	dev_priv->vm->do_vspace_free(vs);
 	kfree(vs);
 }
@@ -123,114 +156,152 @@ void pscnv_vspace_ref_free(struct kref *ref) {
 
 	NV_INFO(vs->dev, "Freeing VSPACE %d\n", vid);
 
+	mutex_lock (&dev_priv->vm_mutex);
+	idr_remove(&dev_priv->vspace_idr, vid);
+	mutex_unlock (&dev_priv->vm_mutex);
+
 	pscnv_vspace_free(vs);
+}
 
-	dev_priv->vspaces[vid] = 0;
+/* to be called before taking vs->lock for a map */
+static void
+pscnv_vspace_prealloc(struct pscnv_vspace *vs) {
+	struct drm_nouveau_private *dev_priv = vs->dev->dev_private;
+	/* page tables are mapped into the BAR vspace, so it mustn't
+	 * recurse into this */
+	if (!vs->isbar && dev_priv->vm->prealloc)
+		dev_priv->vm->prealloc(vs->dev);
 }
 
-static struct pscnv_vm_mapnode *
-pscnv_vspace_map_int(struct pscnv_vspace *vs, struct pscnv_vo *vo,
-		uint64_t start, uint64_t end, int back,
-		struct pscnv_vm_mapnode *node)
+int
+pscnv_vspace_map_locked(struct pscnv_vspace *vs, struct pscnv_vo *vo,
+		uint64_t vo_off, uint64_t size,
+		uint64_t start, uint64_t end, int back, uint32_t flags,
+		struct pscnv_vm_mapnode **spare, struct pscnv_vm_mapnode **res)
 {
-	struct pscnv_vm_mapnode *left, *right, *res;
-	int lok, rok;
-	uint64_t mstart, mend;
-	left = PSCNV_RB_LEFT(node, entry);
-	right = PSCNV_RB_RIGHT(node, entry);
-	lok = left && left->maxgap >= vo->size && node->start > start;
-	rok = right && right->maxgap >= vo->size && node->start + node->size  < end;
-	if (pscnv_vm_debug >= 2)
-		NV_INFO (vs->dev, "VM map: %llx %llx %llx %llx %llx %llx %llx %llx %llx %d %d\n", node->start, node->size, node->maxgap,
-				left?left->start:0, left?left->size:0, left?left->maxgap:0,
-				right?right->start:0, right?right->size:0, right?right->maxgap:0, lok, rok);
-	if (!back && lok) {
-		res = pscnv_vspace_map_int(vs, vo, start, end, back, left);
-		if (res)
-			return res;
-	}
-	if (back && rok) {
-		res = pscnv_vspace_map_int(vs, vo, start, end, back, right);
-		if (res)
-			return res;
-	}
-	mstart = node->start;
-	if (mstart < start)
-		mstart = start;
-	mend = node->start + node->size;
-	if (mend > end)
-		mend = end;
-	if (mstart + vo->size <= mend && !node->vo) {
-		if (back)
-			mstart = mend - vo->size;
-		mend = mstart + vo->size;
-		if (node->start + node->size != mend) {
-			struct pscnv_vm_mapnode *split = kzalloc(sizeof *split, GFP_KERNEL);
-			if (!split)
-				return 0;
-			split->start = mend;
-			split->size = node->start + node->size - mend;
-			split->vspace = vs;
-			node->size = mend - node->start;
-			split->maxgap = split->size;
-			PSCNV_RB_INSERT(pscnv_vm_maptree, &vs->maps, split);
-		}
-		if (node->start != mstart) {
-			struct pscnv_vm_mapnode *split = kzalloc(sizeof *split, GFP_KERNEL);
-			if (!split)
-				return 0;
-			split->start = node->start;
-			split->size = mstart - node->start;
-			split->vspace = vs;
-			node->start = mstart;
-			node->size = mend - node->start;
-			split->maxgap = split->size;
-			PSCNV_RB_INSERT(pscnv_vm_maptree, &vs->maps, split);
-		}
-		node->vo = vo;
-		PSCNV_RB_AUGMENT(node);
-		return node;
+	struct pscnv_vm_mapnode *node;
+	struct drm_nouveau_private *dev_priv = vs->dev->dev_private;
+	uint64_t align = 0x1000;
+	int ret;
+	/* let large page aligned VOs use large pages */
+	if (dev_priv->vm->lpage_size && vo->align >= dev_priv->vm->lpage_size &&
+			!(vo_off & (dev_priv->vm->lpage_size - 1)))
+		align = dev_priv->vm->lpage_size;
+	if (flags & ~PSCNV_MAP_FIXED)
+		return -EINVAL;
+	if ((vo_off | size) & 0xfff || !size || size > vo->size || vo_off > vo->size - size)
+		return -EINVAL;
+	if (flags & PSCNV_MAP_FIXED) {
+		if (start & 0xfff || start + size > (1ull << 40))
+			return -EINVAL;
+	} else {
+		start += 0xfff;
+		start &= ~0xfffull;
+		end &= ~0xfffull;
+		if (end > (1ull << 40))
+			end = 1ull << 40;
+		if (start >= end)
+			return -EINVAL;
 	}
-	if (back && lok) {
-		res = pscnv_vspace_map_int(vs, vo, start, end, back, left);
-		if (res)
-			return res;
+	/* the new mapping may reuse addresses the TLB still remembers */
+	if (vs->tlb_dirty)
+		pscnv_vspace_do_tlb_flush(vs);
+	if (flags & PSCNV_MAP_FIXED) {
+		node = pscnv_vspace_tree_alloc_fixed(vs, vo, size, start, spare);
+		if (!node)
+			return -EBUSY;
+	} else {
+		node = pscnv_vspace_tree_alloc(vs, vo, size, start, end, align, back, spare);
+		if (!node)
+			return -ENOMEM;
 	}
-	if (!back && rok) {
-		res = pscnv_vspace_map_int(vs, vo, start, end, back, right);
-		if (res)
-			return res;
+	node->vo_off = vo_off;
+	if (pscnv_vm_debug >= 1)
+		NV_INFO(vs->dev, "Mapping VO %x/%d+%llx at %llx-%llx.\n", vo->cookie, vo->serial, vo_off,
+				node->start, node->start + node->size);
+	/* compaction looks at vo->maps to find the PTEs to rewrite, so
+	 * the VO can't move between writing them and getting on the list. */
+	mutex_lock(&vo->maps_lock);
+	ret = dev_priv->vm->do_map(vs, vo, node->start, vo_off, size);
+	if (ret) {
+		/* do_map has taken back whatever PTEs it wrote */
+		mutex_unlock(&vo->maps_lock);
+		pscnv_vspace_tree_release(node);
+		return ret;
 	}
+	list_add(&node->vo_list, &vo->maps);
+	mutex_unlock(&vo->maps_lock);
+	*res = node;
 	return 0;
 }
 
+int
+pscnv_vspace_map_range(struct pscnv_vspace *vs, struct pscnv_vo *vo,
+		uint64_t vo_off, uint64_t size,
+		uint64_t start, uint64_t end, int back, uint32_t flags,
+		struct pscnv_vm_mapnode **res)
+{
+	struct pscnv_vm_mapnode *spare[PSCNV_VM_SPARES] = { 0 };
+	int ret;
+	if (pscnv_vspace_spares_fill(spare, PSCNV_VM_SPARES)) {
+		pscnv_vspace_spares_free(spare, PSCNV_VM_SPARES);
+		return -ENOMEM;
+	}
+	pscnv_vspace_prealloc(vs);
+	mutex_lock(&vs->lock);
+	ret = pscnv_vspace_map_locked(vs, vo, vo_off, size, start, end, back, flags, spare, res);
+	mutex_unlock(&vs->lock);
+	pscnv_vspace_spares_free(spare, PSCNV_VM_SPARES);
+	return ret;
+}
+
 int
 pscnv_vspace_map(struct pscnv_vspace *vs, struct pscnv_vo *vo,
-		uint64_t start, uint64_t end, int back,
+		uint64_t start, uint64_t end, int back, uint32_t flags,
 		struct pscnv_vm_mapnode **res)
 {
-	struct pscnv_vm_mapnode *node;
+	return pscnv_vspace_map_range(vs, vo, 0, vo->size, start, end, back, flags, res);
+}
+
+/* slides a mapping over its VO. Only the PTEs that change get written,
+ * and the page tables stay. */
+int
+pscnv_vspace_remap(struct pscnv_vspace *vs, uint64_t start, uint64_t vo_off) {
 	struct drm_nouveau_private *dev_priv = vs->dev->dev_private;
-	start += 0xfff;
-	start &= ~0xfffull;
-	end &= ~0xfffull;
-	if (end > (1ull << 40))
-		end = 1ull << 40;
-	if (start >= end)
-		return -EINVAL;
+	struct pscnv_vm_mapnode *node;
+	int ret = -ENOENT;
+	pscnv_vspace_prealloc(vs);
 	mutex_lock(&vs->lock);
-	node = pscnv_vspace_map_int(vs, vo, start, end, back, PSCNV_RB_ROOT(&vs->maps));
-	if (!node) {
-		mutex_unlock(&vs->lock);
-		return -ENOMEM;
+	node = PSCNV_RB_ROOT(&vs->maps);
+	while (node && (node->start != start || !node->vo)) {
+		if (start < node->start)
+			node = PSCNV_RB_LEFT(node, entry);
+		else
+			node = PSCNV_RB_RIGHT(node, entry);
+	}
+	if (node && (vo_off & 0xfff || vo_off > node->vo->size - node->size))
+		ret = -EINVAL;
+	else if (node) {
+		if (pscnv_vm_debug >= 1)
+			NV_INFO(vs->dev, "Remapping %llx-%llx to VO offset %llx.\n", node->start,
+					node->start + node->size, vo_off);
+		mutex_lock(&node->vo->maps_lock);
+		ret = dev_priv->vm->do_map(vs, node->vo, node->start, vo_off, node->size);
+		if (!ret)
+			node->vo_off = vo_off;
+		/* do_map took back the PTEs it wrote, and with them the part
+		 * of the old window they had replaced. Put that back. */
+		else if (dev_priv->vm->do_map(vs, node->vo, node->start, node->vo_off, node->size))
+			NV_ERROR(vs->dev, "VM: Couldn't restore mapping at %llx after a failed remap!\n",
+					(unsigned long long)node->start);
+		mutex_unlock(&node->vo->maps_lock);
+		/* the old pages stay with the VO, so nothing needs to be held
+		 * until the flush */
+		if (!vs->isbar)
+			pscnv_vspace_tlb_flush_later(vs);
 	}
-	if (pscnv_vm_debug >= 1)
-		NV_INFO(vs->dev, "Mapping VO %x/%d at %llx-%llx.\n", vo->cookie, vo->serial, node->start,
-				node->start + node->size);
-	dev_priv->vm->do_map(vs, vo, node->start);
-	*res = node;
 	mutex_unlock(&vs->lock);
-	return 0;
+	return ret;
 }
 
 static int
@@ -239,14 +310,20 @@ pscnv_vspace_unmap_node_unlocked(struct pscnv_vm_mapnode *node) {
 	if (pscnv_vm_debug >= 1) {
 		NV_INFO(node->vspace->dev, "Unmapping range %llx-%llx.\n", node->start, node->start + node->size);
 	}
+	mutex_lock(&node->vo->maps_lock);
+	list_del(&node->vo_list);
+	mutex_unlock(&node->vo->maps_lock);
 	dev_priv->vm->do_unmap(node->vspace, node->start, node->size);
 	if (!node->vspace->isbar) {
-		drm_gem_object_unreference(node->vo->gem);
+		struct pscnv_vspace *vs = node->vspace;
+		if (vs->tlb_dirty && vs->tlb_nheld == PSCNV_VSPACE_TLB_HELD)
+			pscnv_vspace_do_tlb_flush(vs);
+		if (vs->tlb_dirty)
+			vs->tlb_held[vs->tlb_nheld++] = node->vo->gem;
+		else
+			drm_gem_object_unreference(node->vo->gem);
 	}
-	node->vo = 0;
-	node->maxgap = node->size;
-	PSCNV_RB_AUGMENT(node);
-	/* XXX: try merge */
+	pscnv_vspace_tree_release(node);
 	return 0;
 }
 
@@ -261,36 +338,247 @@ pscnv_vspace_unmap_node(struct pscnv_vm_mapnode *node) {
 }
 
 int
-pscnv_vspace_unmap(struct pscnv_vspace *vs, uint64_t start) {
+pscnv_vspace_unmap_locked(struct pscnv_vspace *vs, uint64_t start) {
 	struct pscnv_vm_mapnode *node;
-	int ret;
-	mutex_lock(&vs->lock);
 	node = PSCNV_RB_ROOT(&vs->maps);
 	while (node) {
-		if (node->start == start && node->vo) {
-			ret = pscnv_vspace_unmap_node_unlocked(node);
-			mutex_unlock(&vs->lock);
-			return ret;
-		}
+		if (node->start == start && node->vo)
+			return pscnv_vspace_unmap_node_unlocked(node);
 		if (start < node->start)
 			node = PSCNV_RB_LEFT(node, entry);
 		else
 			node = PSCNV_RB_RIGHT(node, entry);
 	}
-	mutex_unlock(&vs->lock);
 	return -ENOENT;
 }
 
+int
+pscnv_vspace_unmap(struct pscnv_vspace *vs, uint64_t start) {
+	int ret;
+	mutex_lock(&vs->lock);
+	ret = pscnv_vspace_unmap_locked(vs, start);
+	mutex_unlock(&vs->lock);
+	return ret;
+}
+
+int
+pscnv_vspace_reserve(struct pscnv_vspace *vs, uint64_t size,
+		uint64_t start, uint64_t end, int back, uint32_t flags,
+		uint64_t *res)
+{
+	struct drm_nouveau_private *dev_priv = vs->dev->dev_private;
+	struct pscnv_vm_mapnode *spare[PSCNV_VM_SPARES] = { 0 };
+	struct pscnv_vm_mapnode *node;
+	uint64_t align = 0x1000;
+	int ret = 0;
+	if (flags & ~PSCNV_MAP_FIXED)
+		return -EINVAL;
+	size = ALIGN(size, 0x1000);
+	if (!size)
+		return -EINVAL;
+	if (flags & PSCNV_MAP_FIXED) {
+		if (start & 0xfff || start + size > (1ull << 40))
+			return -EINVAL;
+	} else {
+		/* large page sized ranges get large page aligned, so that
+		 * large page VOs can fill them */
+		if (dev_priv->vm->lpage_size && !(size & (dev_priv->vm->lpage_size - 1)))
+			align = dev_priv->vm->lpage_size;
+		start = ALIGN(start, 0x1000);
+		if (end > (1ull << 40))
+			end = 1ull << 40;
+		if (start >= end)
+			return -EINVAL;
+	}
+	if (pscnv_vspace_spares_fill(spare, PSCNV_VM_SPARES)) {
+		pscnv_vspace_spares_free(spare, PSCNV_VM_SPARES);
+		return -ENOMEM;
+	}
+	mutex_lock(&vs->lock);
+	node = pscnv_vspace_tree_reserve(vs, size, start, end, align, back, flags & PSCNV_MAP_FIXED, spare);
+	if (node)
+		*res = node->start;
+	else
+		ret = flags & PSCNV_MAP_FIXED ? -EBUSY : -ENOMEM;
+	mutex_unlock(&vs->lock);
+	pscnv_vspace_spares_free(spare, PSCNV_VM_SPARES);
+	if (!ret && pscnv_vm_debug >= 1)
+		NV_INFO(vs->dev, "Reserved %llx-%llx.\n", *res, *res + size);
+	return ret;
+}
+
+int
+pscnv_vspace_unreserve(struct pscnv_vspace *vs, uint64_t start) {
+	int ret;
+	mutex_lock(&vs->lock);
+	ret = pscnv_vspace_tree_unreserve(vs, start);
+	mutex_unlock(&vs->lock);
+	return ret;
+}
+
+/* BAR1 is treated as a cache of windows for mmapped VOs. A window is
+ * made on the first fault, and taken away again, least recently faulted
+ * first, when another VO needs the room. Taking it away zaps the host PTEs
+ * pointing into it, so the next access faults it back in. Host PTEs are
+ * put in a few pages at a time, as they're touched. */
+
+/* takes vo's BAR1 window away. Needs bar1_mutex. */
+static void
+pscnv_vo_bar1_evict(struct pscnv_vo *vo)
+{
+	struct drm_nouveau_private *dev_priv = vo->dev->dev_private;
+	if (pscnv_vm_debug >= 1)
+		NV_INFO(vo->dev, "Evicting BAR1 window of VO %x/%d\n", vo->cookie, vo->serial);
+	/* the offset belongs to this VO alone, in every process */
+	unmap_mapping_range(vo->dev->dev_mapping, (loff_t)vo->mmap_id << 32, vo->size, 1);
+	list_del_init(&vo->bar1_lru);
+	pscnv_vspace_unmap_node(vo->map1);
+	vo->map1 = 0;
+	dev_priv->bar1_evictions++;
+}
+
+/* drops vo's BAR1 window for good, when the VO is freed */
+void
+pscnv_vo_bar1_release(struct pscnv_vo *vo)
+{
+	struct drm_nouveau_private *dev_priv = vo->dev->dev_private;
+	mutex_lock(&dev_priv->bar1_mutex);
+	if (vo->map1) {
+		list_del_init(&vo->bar1_lru);
+		pscnv_vspace_unmap_node(vo->map1);
+		vo->map1 = 0;
+	}
+	mutex_unlock(&dev_priv->bar1_mutex);
+}
+
+/* makes sure vo has a BAR1 window, evicting others if BAR1 is full.
+ * Needs bar1_mutex. */
+static int
+pscnv_vo_bar1_map(struct pscnv_vo *vo)
+{
+	struct drm_nouveau_private *dev_priv = vo->dev->dev_private;
+	int ret;
+	if (vo->map1) {
+		dev_priv->bar1_hits++;
+		/* windows made by the kernel for itself, like fbcon's,
+		 * aren't on the LRU and stay */
+		if (!list_empty(&vo->bar1_lru))
+			list_move_tail(&vo->bar1_lru, &dev_priv->bar1_lru);
+		return 0;
+	}
+	dev_priv->bar1_misses++;
+	while ((ret = dev_priv->vm->map_user(vo)) == -ENOMEM && !list_empty(&dev_priv->bar1_lru))
+		pscnv_vo_bar1_evict(list_first_entry(&dev_priv->bar1_lru, struct pscnv_vo, bar1_lru));
+	if (!ret)
+		list_add_tail(&vo->bar1_lru, &dev_priv->bar1_lru);
+	return ret;
+}
+
+static int
+pscnv_vm_fault(struct vm_area_struct *vma, struct vm_fault *vmf)
+{
+	struct drm_gem_object *obj = vma->vm_private_data;
+	struct pscnv_vo *vo = obj->driver_private;
+	struct drm_nouveau_private *dev_priv = vo->dev->dev_private;
+	unsigned long addr = (unsigned long)vmf->virtual_address & PAGE_MASK;
+	unsigned long end = vma->vm_end;
+	int prefault = pscnv_mmap_prefault;
+	int ret;
+
+	/* map the faulting page, and up to pscnv_mmap_prefault pages after
+	 * it that aren't mapped yet */
+	if (prefault >= 0 && (end - addr) / PAGE_SIZE > prefault)
+		end = addr + (prefault + 1) * PAGE_SIZE;
+
+	/* held until the PTEs are in, so the window can't be evicted
+	 * before they'd get zapped */
+	mutex_lock(&dev_priv->bar1_mutex);
+	ret = pscnv_vo_bar1_map(vo);
+	for (; !ret && addr < end; addr += PAGE_SIZE) {
+		ret = vm_insert_pfn(vma, addr,
+				(dev_priv->fb_phys + vo->map1->start + addr - vma->vm_start) >> PAGE_SHIFT);
+		/* already there */
+		if (ret == -EBUSY)
+			ret = 0;
+	}
+	mutex_unlock(&dev_priv->bar1_mutex);
+	if (ret == -ENOMEM)
+		return VM_FAULT_OOM;
+	if (ret)
+		return VM_FAULT_SIGBUS;
+	return VM_FAULT_NOPAGE;
+}
+
 static struct vm_operations_struct pscnv_vm_ops = {
 	.open = drm_gem_vm_open,
 	.close = drm_gem_vm_close,
+	.fault = pscnv_vm_fault,
 };	
 
+static struct vm_operations_struct pscnv_staging_vm_ops = {
+	.open = drm_gem_vm_open,
+	.close = drm_gem_vm_close,
+};
+
+/* copies a PSCNV_VO_MAP_CACHED VO's staging copy to VRAM, or back */
+int
+pscnv_vo_staging_sync(struct pscnv_vo *vo, int to_vram)
+{
+	struct drm_nouveau_private *dev_priv = vo->dev->dev_private;
+	void __iomem *io;
+	int ret;
+	if (!vo->staging)
+		return -EINVAL;
+	mutex_lock(&dev_priv->bar1_mutex);
+	ret = pscnv_vo_bar1_map(vo);
+	if (!ret) {
+		io = ioremap_wc(dev_priv->fb_phys + vo->map1->start, vo->size);
+		if (!io) {
+			ret = -ENOMEM;
+		} else {
+			if (to_vram)
+				memcpy_toio(io, vo->staging, vo->size);
+			else
+				memcpy_fromio(vo->staging, io, vo->size);
+			iounmap(io);
+		}
+	}
+	mutex_unlock(&dev_priv->bar1_mutex);
+	return ret;
+}
+
+static int
+pscnv_mmap_handle_is(int handle, void *p, void *data)
+{
+	return p == data;
+}
+
+/* looks up the GEM object mapped at an mmap ID, and takes a reference to
+ * it. Only files holding a handle to the object may map it. */
+static struct drm_gem_object *
+pscnv_mmap_lookup(struct drm_device *dev, struct drm_file *priv, int id)
+{
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	struct drm_gem_object *obj = 0;
+	struct pscnv_vo *vo;
+	mutex_lock(&dev->struct_mutex);
+	vo = idr_find(&dev_priv->mmap_idr, id);
+	if (vo) {
+		spin_lock(&priv->table_lock);
+		if (idr_for_each(&priv->object_idr, pscnv_mmap_handle_is, vo->gem))
+			obj = vo->gem;
+		spin_unlock(&priv->table_lock);
+	}
+	if (obj)
+		drm_gem_object_reference(obj);
+	mutex_unlock(&dev->struct_mutex);
+	return obj;
+}
+
 int pscnv_mmap(struct file *filp, struct vm_area_struct *vma)
 {
 	struct drm_file *priv = filp->private_data;
 	struct drm_device *dev = priv->minor->dev;
-	struct drm_nouveau_private *dev_priv = dev->dev_private;
 	struct drm_gem_object *obj;
 	struct pscnv_vo *vo;
 	int ret;
@@ -301,7 +589,7 @@ int pscnv_mmap(struct file *filp, struct vm_area_struct *vma)
 	if (vma->vm_pgoff * PAGE_SIZE < (1ull << 32))
 		return pscnv_chan_mmap(filp, vma);
 
-	obj = drm_gem_object_lookup(dev, priv, (vma->vm_pgoff * PAGE_SIZE) >> 32);
+	obj = pscnv_mmap_lookup(dev, priv, (vma->vm_pgoff * PAGE_SIZE) >> 32);
 	if (!obj)
 		return -ENOENT;
 	vo = obj->driver_private;
@@ -310,33 +598,78 @@ int pscnv_mmap(struct file *filp, struct vm_area_struct *vma)
 		drm_gem_object_unreference_unlocked(obj);
 		return -EINVAL;
 	}
-	if ((ret = dev_priv->vm->map_user(vo))) {
+
+	/* the fault handler inserts PFNs, which can't be done in a COW
+	 * mapping */
+	if (!(vma->vm_flags & VM_SHARED)) {
 		drm_gem_object_unreference_unlocked(obj);
+		return -EINVAL;
+	}
+
+	if ((vo->flags & PSCNV_VO_MAP_MASK) == PSCNV_VO_MAP_CACHED) {
+		vma->vm_ops = &pscnv_staging_vm_ops;
+		vma->vm_private_data = obj;
+		ret = remap_vmalloc_range(vma, vo->staging, 0);
+		if (ret)
+			drm_gem_object_unreference_unlocked(obj);
 		return ret;
 	}
 
 	vma->vm_flags |= VM_RESERVED | VM_IO | VM_PFNMAP | VM_DONTEXPAND;
 	vma->vm_ops = &pscnv_vm_ops;
 	vma->vm_private_data = obj;
-	vma->vm_page_prot = pgprot_writecombine(vm_get_page_prot(vma->vm_flags));
+	if ((vo->flags & PSCNV_VO_MAP_MASK) == PSCNV_VO_MAP_UC)
+		vma->vm_page_prot = pgprot_noncached(vm_get_page_prot(vma->vm_flags));
+	else
+		vma->vm_page_prot = pgprot_writecombine(vm_get_page_prot(vma->vm_flags));
 
 	vma->vm_file = filp;
 
-	return remap_pfn_range(vma, vma->vm_start, 
-			(dev_priv->fb_phys + vo->map1->start) >> PAGE_SHIFT,
-			vma->vm_end - vma->vm_start, PAGE_SHARED);
+	/* the BAR1 window and the PTEs come on the first fault */
+	return 0;
 }
 
-/* needs vm_mutex held */
+/* looks up a vspace of the file and takes a reference to it, to be dropped
+ * with kref_put. vm_mutex only guards the ID table, the vspace itself is
+ * protected by vs->lock. */
 struct pscnv_vspace *
 pscnv_get_vspace(struct drm_device *dev, struct drm_file *file_priv, int vid)
 {
 	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	struct pscnv_vspace *vs = 0;
+
+	if (vid < 0)
+		return 0;
+	mutex_lock (&dev_priv->vm_mutex);
+	vs = idr_find(&dev_priv->vspace_idr, vid);
+	if (vs && vs->filp == file_priv)
+		kref_get(&vs->ref);
+	else
+		vs = 0;
+	mutex_unlock (&dev_priv->vm_mutex);
+	return vs;
+}
+
+/* disowns a vspace of the file, so that lookups don't find it anymore, and
+ * hands the ID table's reference to the caller */
+static struct pscnv_vspace *
+pscnv_vspace_disown(struct drm_device *dev, struct drm_file *file_priv, int vid)
+{
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	struct pscnv_vspace *vs = 0;
 
-	if (vid < 128 && vid >= 0 && dev_priv->vspaces[vid] && dev_priv->vspaces[vid]->filp == file_priv) {
-		return dev_priv->vspaces[vid];
+	if (vid < 0)
+		return 0;
+	mutex_lock (&dev_priv->vm_mutex);
+	vs = idr_find(&dev_priv->vspace_idr, vid);
+	if (vs && vs->filp == file_priv) {
+		list_del(&vs->file_list);
+		vs->filp = 0;
+	} else {
+		vs = 0;
 	}
-	return 0;
+	mutex_unlock (&dev_priv->vm_mutex);
+	return vs;
 }
 
 int pscnv_ioctl_vspace_new(struct drm_device *dev, void *data,
@@ -344,38 +677,41 @@ int pscnv_ioctl_vspace_new(struct drm_device *dev, void *data,
 {
 	struct drm_pscnv_vspace_req *req = data;
 	struct drm_nouveau_private *dev_priv = dev->dev_private;
-	int vid = -1;
-	int i;
+	struct pscnv_fpriv *fpriv = file_priv->driver_priv;
+	struct pscnv_vspace *vs;
+	int vid;
+	int ret;
 
 	NOUVEAU_CHECK_INITIALISED_WITH_RETURN;
 
-	mutex_lock (&dev_priv->vm_mutex);
+	vs = pscnv_vspace_new(dev);
+	if (!vs)
+		return -ENOMEM;
 
-	for (i = 0; i < 128; i++)
-		if (!dev_priv->vspaces[i]) {
-			vid = i;
+	do {
+		if (!idr_pre_get(&dev_priv->vspace_idr, GFP_KERNEL)) {
+			ret = -ENOMEM;
 			break;
 		}
-
-	if (vid == -1) {
+		mutex_lock (&dev_priv->vm_mutex);
+		ret = idr_get_new_above(&dev_priv->vspace_idr, vs, 0, &vid);
+		if (!ret) {
+			vs->filp = file_priv;
+			vs->vid = vid;
+			list_add(&vs->file_list, &fpriv->vspaces);
+		}
 		mutex_unlock (&dev_priv->vm_mutex);
-		return -ENOSPC;
-	}
+	} while (ret == -EAGAIN);
 
-	dev_priv->vspaces[vid] = pscnv_vspace_new(dev);
-	if (!dev_priv->vspaces[i]) {
-		mutex_unlock (&dev_priv->vm_mutex);
-		return -ENOMEM;
+	if (ret) {
+		pscnv_vspace_free(vs);
+		return ret;
 	}
 
-	dev_priv->vspaces[vid]->filp = file_priv;
-	dev_priv->vspaces[vid]->vid = vid;
-	
 	req->vid = vid;
 
 	NV_INFO(dev, "Allocating VSPACE %d\n", vid);
 
-	mutex_unlock (&dev_priv->vm_mutex);
 	return 0;
 }
 
@@ -383,23 +719,15 @@ int pscnv_ioctl_vspace_free(struct drm_device *dev, void *data,
 						struct drm_file *file_priv)
 {
 	struct drm_pscnv_vspace_req *req = data;
-	struct drm_nouveau_private *dev_priv = dev->dev_private;
-	int vid = req->vid;
 	struct pscnv_vspace *vs;
 
 	NOUVEAU_CHECK_INITIALISED_WITH_RETURN;
 
-	mutex_lock (&dev_priv->vm_mutex);
-	vs = pscnv_get_vspace(dev, file_priv, vid);
-	if (!vs) {
-		mutex_unlock (&dev_priv->vm_mutex);
+	vs = pscnv_vspace_disown(dev, file_priv, req->vid);
+	if (!vs)
 		return -ENOENT;
-	}
 
-	vs->filp = 0;
 	kref_put(&vs->ref, pscnv_vspace_ref_free);
-
-	mutex_unlock (&dev_priv->vm_mutex);
 	return 0;
 }
 
@@ -407,7 +735,6 @@ int pscnv_ioctl_vspace_map(struct drm_device *dev, void *data,
 						struct drm_file *file_priv)
 {
 	struct drm_pscnv_vspace_map *req = data;
-	struct drm_nouveau_private *dev_priv = dev->dev_private;
 	struct pscnv_vspace *vs;
 	struct drm_gem_object *obj;
 	struct pscnv_vo *vo;
@@ -416,27 +743,25 @@ int pscnv_ioctl_vspace_map(struct drm_device *dev, void *data,
 
 	NOUVEAU_CHECK_INITIALISED_WITH_RETURN;
 
-	mutex_lock (&dev_priv->vm_mutex);
-
 	vs = pscnv_get_vspace(dev, file_priv, req->vid);
-	if (!vs) {
-		mutex_unlock (&dev_priv->vm_mutex);
+	if (!vs)
 		return -ENOENT;
-	}
 
 	obj = drm_gem_object_lookup(dev, file_priv, req->handle);
 	if (!obj) {
-		mutex_unlock (&dev_priv->vm_mutex);
+		kref_put(&vs->ref, pscnv_vspace_ref_free);
 		return -EBADF;
 	}
 
 	vo = obj->driver_private;
 
-	ret = pscnv_vspace_map(vs, vo, req->start, req->end, req->back, &map);
-	if (map)
+	ret = pscnv_vspace_map(vs, vo, req->start, req->end, req->back, req->flags, &map);
+	if (ret)
+		drm_gem_object_unreference_unlocked(obj);
+	else
 		req->offset = map->start;
 
-	mutex_unlock (&dev_priv->vm_mutex);
+	kref_put(&vs->ref, pscnv_vspace_ref_free);
 	return ret;
 }
 
@@ -444,38 +769,249 @@ int pscnv_ioctl_vspace_unmap(struct drm_device *dev, void *data,
 						struct drm_file *file_priv)
 {
 	struct drm_pscnv_vspace_unmap *req = data;
-	struct drm_nouveau_private *dev_priv = dev->dev_private;
 	struct pscnv_vspace *vs;
 	int ret;
 
 	NOUVEAU_CHECK_INITIALISED_WITH_RETURN;
 
-	mutex_lock (&dev_priv->vm_mutex);
+	vs = pscnv_get_vspace(dev, file_priv, req->vid);
+	if (!vs)
+		return -ENOENT;
+
+	ret = pscnv_vspace_unmap(vs, req->offset);
+
+	kref_put(&vs->ref, pscnv_vspace_ref_free);
+	return ret;
+}
+
+/* entries copied in and out at a time by the batch ioctls */
+#define PSCNV_VSPACE_BATCH_CHUNK 256
+
+int pscnv_ioctl_vspace_map_batch(struct drm_device *dev, void *data,
+						struct drm_file *file_priv)
+{
+	struct drm_pscnv_vspace_map_batch *req = data;
+	struct drm_pscnv_vspace_map_entry __user *uents = (void __user *)(unsigned long)req->entries;
+	struct drm_pscnv_vspace_map_entry *ents, *ent;
+	struct pscnv_vm_mapnode **spares;
+	struct pscnv_vspace *vs;
+	struct drm_gem_object *obj;
+	struct pscnv_vm_mapnode *map;
+	uint32_t done, i, n;
+	int ret = 0;
+
+	NOUVEAU_CHECK_INITIALISED_WITH_RETURN;
+
+	ents = kmalloc(PSCNV_VSPACE_BATCH_CHUNK * sizeof *ents, GFP_KERNEL);
+	spares = kzalloc(PSCNV_VSPACE_BATCH_CHUNK * PSCNV_VM_SPARES * sizeof *spares, GFP_KERNEL);
+	if (!ents || !spares) {
+		kfree(ents);
+		kfree(spares);
+		return -ENOMEM;
+	}
 
 	vs = pscnv_get_vspace(dev, file_priv, req->vid);
 	if (!vs) {
-		mutex_unlock (&dev_priv->vm_mutex);
+		kfree(ents);
+		kfree(spares);
 		return -ENOENT;
 	}
 
-	ret = pscnv_vspace_unmap(vs, req->offset);
+	/* vs->lock is only held while working on a chunk, so that copying
+	 * from and to userspace and allocating split nodes happen outside.
+	 * Each chunk is a batch of its own and gets flushed before the lock
+	 * is dropped, or other users of the vspace would see their flushes
+	 * put off too. */
+	for (done = 0; done < req->count && !ret; done += n) {
+		n = min(req->count - done, (uint32_t)PSCNV_VSPACE_BATCH_CHUNK);
+		if (copy_from_user(ents, uents + done, n * sizeof *ents)) {
+			ret = -EFAULT;
+			break;
+		}
+		if (pscnv_vspace_spares_fill(spares, n * PSCNV_VM_SPARES)) {
+			ret = -ENOMEM;
+			break;
+		}
+		pscnv_vspace_prealloc(vs);
+		mutex_lock(&vs->lock);
+		pscnv_vspace_batch_begin(vs);
+		for (i = 0; i < n; i++) {
+			ent = &ents[i];
+			ent->offset = 0;
+			obj = drm_gem_object_lookup(dev, file_priv, ent->handle);
+			if (!obj) {
+				ent->result = -EBADF;
+				continue;
+			}
+			ent->result = pscnv_vspace_map_locked(vs, obj->driver_private,
+					0, ((struct pscnv_vo *)obj->driver_private)->size,
+					ent->start, ent->end, ent->back, ent->flags,
+					&spares[i * PSCNV_VM_SPARES], &map);
+			if (ent->result)
+				drm_gem_object_unreference_unlocked(obj);
+			else
+				ent->offset = map->start;
+		}
+		pscnv_vspace_batch_end(vs);
+		mutex_unlock(&vs->lock);
+		if (copy_to_user(uents + done, ents, n * sizeof *ents))
+			ret = -EFAULT;
+	}
+	kref_put(&vs->ref, pscnv_vspace_ref_free);
+	pscnv_vspace_spares_free(spares, PSCNV_VSPACE_BATCH_CHUNK * PSCNV_VM_SPARES);
+	kfree(spares);
+	kfree(ents);
+	return ret;
+}
 
-	mutex_unlock (&dev_priv->vm_mutex);
+int pscnv_ioctl_vspace_unmap_batch(struct drm_device *dev, void *data,
+						struct drm_file *file_priv)
+{
+	struct drm_pscnv_vspace_unmap_batch *req = data;
+	uint64_t __user *uoffsets = (void __user *)(unsigned long)req->offsets;
+	int32_t __user *uresults = (void __user *)(unsigned long)req->results;
+	struct pscnv_vspace *vs;
+	uint64_t *offsets;
+	int32_t *results;
+	uint32_t done, i, n;
+	int ret = 0;
+
+	NOUVEAU_CHECK_INITIALISED_WITH_RETURN;
+
+	offsets = kmalloc(PSCNV_VSPACE_BATCH_CHUNK * (sizeof *offsets + sizeof *results), GFP_KERNEL);
+	if (!offsets)
+		return -ENOMEM;
+	results = (int32_t *)(offsets + PSCNV_VSPACE_BATCH_CHUNK);
+
+	vs = pscnv_get_vspace(dev, file_priv, req->vid);
+	if (!vs) {
+		kfree(offsets);
+		return -ENOENT;
+	}
+
+	/* one batch per chunk, see above */
+	for (done = 0; done < req->count && !ret; done += n) {
+		n = min(req->count - done, (uint32_t)PSCNV_VSPACE_BATCH_CHUNK);
+		if (copy_from_user(offsets, uoffsets + done, n * sizeof *offsets)) {
+			ret = -EFAULT;
+			break;
+		}
+		mutex_lock(&vs->lock);
+		pscnv_vspace_batch_begin(vs);
+		for (i = 0; i < n; i++)
+			results[i] = pscnv_vspace_unmap_locked(vs, offsets[i]);
+		pscnv_vspace_batch_end(vs);
+		mutex_unlock(&vs->lock);
+		if (uresults && copy_to_user(uresults + done, results, n * sizeof *results))
+			ret = -EFAULT;
+	}
+	kref_put(&vs->ref, pscnv_vspace_ref_free);
+	kfree(offsets);
+	return ret;
+}
+
+int pscnv_ioctl_vspace_reserve(struct drm_device *dev, void *data,
+						struct drm_file *file_priv)
+{
+	struct drm_pscnv_vspace_reserve *req = data;
+	struct pscnv_vspace *vs;
+	int ret;
+
+	NOUVEAU_CHECK_INITIALISED_WITH_RETURN;
+
+	vs = pscnv_get_vspace(dev, file_priv, req->vid);
+	if (!vs)
+		return -ENOENT;
+
+	ret = pscnv_vspace_reserve(vs, req->size, req->start, req->end, req->back, req->flags, &req->offset);
+
+	kref_put(&vs->ref, pscnv_vspace_ref_free);
+	return ret;
+}
+
+int pscnv_ioctl_vspace_unreserve(struct drm_device *dev, void *data,
+						struct drm_file *file_priv)
+{
+	struct drm_pscnv_vspace_unmap *req = data;
+	struct pscnv_vspace *vs;
+	int ret;
+
+	NOUVEAU_CHECK_INITIALISED_WITH_RETURN;
+
+	vs = pscnv_get_vspace(dev, file_priv, req->vid);
+	if (!vs)
+		return -ENOENT;
+
+	ret = pscnv_vspace_unreserve(vs, req->offset);
+
+	kref_put(&vs->ref, pscnv_vspace_ref_free);
+	return ret;
+}
+
+int pscnv_ioctl_vspace_map_range(struct drm_device *dev, void *data,
+						struct drm_file *file_priv)
+{
+	struct drm_pscnv_vspace_map_range *req = data;
+	struct pscnv_vspace *vs;
+	struct drm_gem_object *obj;
+	struct pscnv_vm_mapnode *map;
+	int ret;
+
+	NOUVEAU_CHECK_INITIALISED_WITH_RETURN;
+
+	vs = pscnv_get_vspace(dev, file_priv, req->vid);
+	if (!vs)
+		return -ENOENT;
+
+	obj = drm_gem_object_lookup(dev, file_priv, req->handle);
+	if (!obj) {
+		kref_put(&vs->ref, pscnv_vspace_ref_free);
+		return -EBADF;
+	}
+
+	ret = pscnv_vspace_map_range(vs, obj->driver_private, req->bo_offset, req->length,
+			req->start, req->end, req->back, req->flags, &map);
+	if (ret)
+		drm_gem_object_unreference_unlocked(obj);
+	else
+		req->offset = map->start;
+
+	kref_put(&vs->ref, pscnv_vspace_ref_free);
+	return ret;
+}
+
+int pscnv_ioctl_vspace_remap(struct drm_device *dev, void *data,
+						struct drm_file *file_priv)
+{
+	struct drm_pscnv_vspace_remap *req = data;
+	struct pscnv_vspace *vs;
+	int ret;
+
+	NOUVEAU_CHECK_INITIALISED_WITH_RETURN;
+
+	vs = pscnv_get_vspace(dev, file_priv, req->vid);
+	if (!vs)
+		return -ENOENT;
+
+	ret = pscnv_vspace_remap(vs, req->offset, req->bo_offset);
+
+	kref_put(&vs->ref, pscnv_vspace_ref_free);
 	return ret;
 }
 
 void pscnv_vspace_cleanup(struct drm_device *dev, struct drm_file *file_priv) {
 	struct drm_nouveau_private *dev_priv = dev->dev_private;
-	int vid;
+	struct pscnv_fpriv *fpriv = file_priv->driver_priv;
 	struct pscnv_vspace *vs;
 
 	mutex_lock (&dev_priv->vm_mutex);
-	for (vid = 0; vid < 128; vid++) {
-		vs = pscnv_get_vspace(dev, file_priv, vid);
-		if (!vs)
-			continue;
+	while (!list_empty(&fpriv->vspaces)) {
+		vs = list_first_entry(&fpriv->vspaces, struct pscnv_vspace, file_list);
+		list_del(&vs->file_list);
 		vs->filp = 0;
+		mutex_unlock (&dev_priv->vm_mutex);
 		kref_put(&vs->ref, pscnv_vspace_ref_free);
+		mutex_lock (&dev_priv->vm_mutex);
 	}
 	mutex_unlock (&dev_priv->vm_mutex);
 }
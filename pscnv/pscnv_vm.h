@@ -32,41 +32,117 @@
 
 PSCNV_RB_HEAD(pscnv_vm_maptree, pscnv_vm_mapnode);
 
+/* unmapped GEM objects a vspace can hold until a deferred TLB flush */
+#define PSCNV_VSPACE_TLB_HELD 64
+
 struct pscnv_vo;
 
 struct pscnv_vspace {
+	/* vid, filp and file_list are protected by vm_mutex, the rest
+	 * by lock */
 	int vid;
 	struct drm_device *dev;
 	struct mutex lock;
 	struct list_head chan_list;
 	struct pscnv_vm_maptree maps;
 	struct drm_file *filp;
+	/* link in the owning file's list, see struct pscnv_fpriv */
+	struct list_head file_list;
 	int engref[PSCNV_ENGINES_NUM];
 	struct kref ref;
 	void *engdata;
 	int isbar;
+	/* PTEs present, by page size, large page tables that had to be
+	 * split to small ones, and page tables freed once empty. Kept by
+	 * the VM engine. */
+	uint64_t pte_small;
+	uint64_t pte_large;
+	int pt_splits;
+	int pt_reclaims;
+	/* TLB flushes asked for by unmaps inside a batch are put off until
+	 * the batch ends. Until then, the GEM objects unmapped are kept
+	 * alive, so their VRAM can't be reused behind a stale TLB. */
+	int tlb_batch;
+	int tlb_dirty;
+	int bar_dirty;
+	int tlb_nheld;
+	struct drm_gem_object *tlb_held[PSCNV_VSPACE_TLB_HELD];
+	uint64_t tlb_flush_requests;
+	uint64_t tlb_flushes;
+	/* nodes in the maps tree, mapped and free */
+	int map_nodes;
 };
 
 struct pscnv_vm_mapnode {
 	PSCNV_RB_ENTRY(pscnv_vm_mapnode) entry;
 	struct pscnv_vspace *vspace;
-	/* NULL means free */
+	/* NULL means free, or a hole if reserved is set */
 	struct pscnv_vo *vo;
 	uint64_t start;
 	uint64_t size;
+	/* where in vo the mapping starts */
+	uint64_t vo_off;
 	uint64_t maxgap;
+	/* set if the node is in a reservation, starting at resv */
+	int reserved;
+	uint64_t resv;
+	/* link in vo->maps, for mapped nodes */
+	struct list_head vo_list;
 };
 
+PSCNV_RB_PROTOTYPE(pscnv_vm_maptree, pscnv_vm_mapnode, entry, mapcmp)
+
+/* the address space tree, see pscnv_vm_tree.c. Need vs->lock held. */
+extern int pscnv_vspace_tree_init(struct pscnv_vspace *);
+extern struct pscnv_vm_mapnode *pscnv_vspace_tree_alloc(struct pscnv_vspace *, struct pscnv_vo *,
+		uint64_t size, uint64_t start, uint64_t end, uint64_t align, int back,
+		struct pscnv_vm_mapnode **spare);
+extern struct pscnv_vm_mapnode *pscnv_vspace_tree_alloc_fixed(struct pscnv_vspace *, struct pscnv_vo *,
+		uint64_t size, uint64_t addr, struct pscnv_vm_mapnode **spare);
+extern struct pscnv_vm_mapnode *pscnv_vspace_tree_reserve(struct pscnv_vspace *, uint64_t size,
+		uint64_t start, uint64_t end, uint64_t align, int back, int fixed,
+		struct pscnv_vm_mapnode **spare);
+extern void pscnv_vspace_tree_release(struct pscnv_vm_mapnode *);
+extern int pscnv_vspace_tree_unreserve(struct pscnv_vspace *, uint64_t addr);
+
+/* a map may split a free node in three, needing this many new nodes.
+ * They're allocated up front, outside vs->lock. */
+#define PSCNV_VM_SPARES 2
+extern int pscnv_vspace_spares_fill(struct pscnv_vm_mapnode **spare, int num);
+extern void pscnv_vspace_spares_free(struct pscnv_vm_mapnode **spare, int num);
+
 extern struct pscnv_vspace *pscnv_vspace_new(struct drm_device *);
 extern void pscnv_vspace_free(struct pscnv_vspace *);
-extern int pscnv_vspace_map(struct pscnv_vspace *, struct pscnv_vo *, uint64_t start, uint64_t end, int back, struct pscnv_vm_mapnode **res);
+/* flags are PSCNV_MAP_* */
+extern int pscnv_vspace_map(struct pscnv_vspace *, struct pscnv_vo *, uint64_t start, uint64_t end, int back,
+		uint32_t flags, struct pscnv_vm_mapnode **res);
+/* same, for size bytes of the VO from vo_off on */
+extern int pscnv_vspace_map_range(struct pscnv_vspace *, struct pscnv_vo *, uint64_t vo_off, uint64_t size,
+		uint64_t start, uint64_t end, int back, uint32_t flags, struct pscnv_vm_mapnode **res);
 extern int pscnv_vspace_unmap(struct pscnv_vspace *, uint64_t start);
+/* same, with vs->lock already held and PSCNV_VM_SPARES spare nodes */
+extern int pscnv_vspace_map_locked(struct pscnv_vspace *, struct pscnv_vo *, uint64_t vo_off, uint64_t size,
+		uint64_t start, uint64_t end, int back, uint32_t flags,
+		struct pscnv_vm_mapnode **spare, struct pscnv_vm_mapnode **res);
+extern int pscnv_vspace_unmap_locked(struct pscnv_vspace *, uint64_t start);
 extern int pscnv_vspace_unmap_node(struct pscnv_vm_mapnode *node);
+/* points the mapping at start to another part of its VO */
+extern int pscnv_vspace_remap(struct pscnv_vspace *, uint64_t start, uint64_t vo_off);
+extern int pscnv_vspace_reserve(struct pscnv_vspace *, uint64_t size, uint64_t start, uint64_t end, int back,
+		uint32_t flags, uint64_t *res);
+extern int pscnv_vspace_unreserve(struct pscnv_vspace *, uint64_t start);
 extern void pscnv_vspace_ref_free(struct kref *ref);
 int pscnv_vspace_tlb_flush (struct pscnv_vspace *vs);
+int pscnv_vspace_tlb_flush_later (struct pscnv_vspace *vs);
+void pscnv_vspace_bar_flush_later (struct pscnv_vspace *vs);
+/* these need vs->lock held */
+extern void pscnv_vspace_batch_begin(struct pscnv_vspace *vs);
+extern int pscnv_vspace_batch_end(struct pscnv_vspace *vs);
 
 extern void pscnv_vspace_cleanup(struct drm_device *dev, struct drm_file *file_priv);
 extern int pscnv_mmap(struct file *filp, struct vm_area_struct *vma);
+extern void pscnv_vo_bar1_release(struct pscnv_vo *vo);
+extern int pscnv_vo_staging_sync(struct pscnv_vo *vo, int to_vram);
 
 int pscnv_ioctl_vspace_new(struct drm_device *dev, void *data,
 						struct drm_file *file_priv);
@@ -76,8 +152,20 @@ int pscnv_ioctl_vspace_map(struct drm_device *dev, void *data,
 						struct drm_file *file_priv);
 int pscnv_ioctl_vspace_unmap(struct drm_device *dev, void *data,
 						struct drm_file *file_priv);
+int pscnv_ioctl_vspace_map_batch(struct drm_device *dev, void *data,
+						struct drm_file *file_priv);
+int pscnv_ioctl_vspace_unmap_batch(struct drm_device *dev, void *data,
+						struct drm_file *file_priv);
+int pscnv_ioctl_vspace_reserve(struct drm_device *dev, void *data,
+						struct drm_file *file_priv);
+int pscnv_ioctl_vspace_unreserve(struct drm_device *dev, void *data,
+						struct drm_file *file_priv);
+int pscnv_ioctl_vspace_map_range(struct drm_device *dev, void *data,
+						struct drm_file *file_priv);
+int pscnv_ioctl_vspace_remap(struct drm_device *dev, void *data,
+						struct drm_file *file_priv);
 
-/* needs vm_mutex held */
+/* takes a reference, drop it with kref_put */
 struct pscnv_vspace *pscnv_get_vspace(struct drm_device *dev, struct drm_file *file_priv, int vid);
 
 #endif
@@ -0,0 +1,343 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * Copyright 2010 PathScale Inc.  All rights reserved.
+ * Use is subject to license terms.
+ */
+
+/* The address space of a vspace is kept in a tree of map nodes, ordered by
+ * address. Every address belongs to exactly one node: a mapped node, a
+ * free one, or a hole in a reservation. Adjacent free nodes, and adjacent
+ * holes of the same reservation, are always merged, and every node knows
+ * the largest free node in its subtree, so finding room for a mapping
+ * only walks down the tree. Reservations are left alone by searches and
+ * only filled by maps at a fixed address. */
+
+#include "drmP.h"
+#include "drm.h"
+#include "nouveau_drv.h"
+#include "pscnv_vram.h"
+#include "pscnv_vm.h"
+
+#undef PSCNV_RB_AUGMENT
+
+static void PSCNV_RB_AUGMENT(struct pscnv_vm_mapnode *node) {
+	uint64_t maxgap = 0;
+	struct pscnv_vm_mapnode *left = PSCNV_RB_LEFT(node, entry);
+	struct pscnv_vm_mapnode *right = PSCNV_RB_RIGHT(node, entry);
+	if (!node->vo && !node->reserved)
+		maxgap = node->size;
+	if (left && left->maxgap > maxgap)
+		maxgap = left->maxgap;
+	if (right && right->maxgap > maxgap)
+		maxgap = right->maxgap;
+	node->maxgap = maxgap;
+}
+
+static int mapcmp(struct pscnv_vm_mapnode *a, struct pscnv_vm_mapnode *b) {
+	if (a->start < b->start)
+		return -1;
+	else if (a->start > b->start)
+		return 1;
+	return 0;
+}
+
+PSCNV_RB_GENERATE(pscnv_vm_maptree, pscnv_vm_mapnode, entry, mapcmp)
+
+/* recomputes maxgap from node up to the root, after node changed in place */
+static void
+pscnv_vspace_augment_up(struct pscnv_vm_mapnode *node) {
+	for (; node; node = PSCNV_RB_PARENT(node, entry))
+		PSCNV_RB_AUGMENT(node);
+}
+
+static struct pscnv_vm_mapnode *
+pscnv_vspace_new_node(struct pscnv_vspace *vs, uint64_t start, uint64_t size) {
+	struct pscnv_vm_mapnode *node = kzalloc(sizeof *node, GFP_KERNEL);
+	if (!node)
+		return 0;
+	node->vspace = vs;
+	node->start = start;
+	node->size = size;
+	node->maxgap = size;
+	vs->map_nodes++;
+	return node;
+}
+
+static void
+pscnv_vspace_del_node(struct pscnv_vm_mapnode *node) {
+	struct pscnv_vspace *vs = node->vspace;
+	PSCNV_RB_REMOVE(pscnv_vm_maptree, &vs->maps, node);
+	vs->map_nodes--;
+	kfree(node);
+}
+
+int
+pscnv_vspace_tree_init(struct pscnv_vspace *vs) {
+	struct pscnv_vm_mapnode *fmap;
+	PSCNV_RB_INIT(&vs->maps);
+	fmap = pscnv_vspace_new_node(vs, 0, 1ULL << 40);
+	if (!fmap)
+		return -ENOMEM;
+	PSCNV_RB_INSERT(pscnv_vm_maptree, &vs->maps, fmap);
+	return 0;
+}
+
+/* preallocates split nodes for a map, to be done before taking vs->lock */
+int
+pscnv_vspace_spares_fill(struct pscnv_vm_mapnode **spare, int num) {
+	int i;
+	for (i = 0; i < num; i++)
+		if (!spare[i] && !(spare[i] = kzalloc(sizeof **spare, GFP_KERNEL)))
+			return -ENOMEM;
+	return 0;
+}
+
+void
+pscnv_vspace_spares_free(struct pscnv_vm_mapnode **spare, int num) {
+	int i;
+	for (i = 0; i < num; i++) {
+		kfree(spare[i]);
+		spare[i] = 0;
+	}
+}
+
+/* makes a new unmapped node of the same kind as from, for a piece split
+ * off of it */
+static struct pscnv_vm_mapnode *
+pscnv_vspace_use_spare(struct pscnv_vspace *vs, struct pscnv_vm_mapnode **spare,
+		struct pscnv_vm_mapnode *from, uint64_t start, uint64_t size) {
+	struct pscnv_vm_mapnode *node = spare[0] ? spare[0] : spare[1];
+	if (node == spare[0])
+		spare[0] = 0;
+	else
+		spare[1] = 0;
+	node->vspace = vs;
+	node->vo = 0;
+	node->start = start;
+	node->size = size;
+	node->reserved = from->reserved;
+	node->resv = from->resv;
+	node->maxgap = node->reserved ? 0 : size;
+	vs->map_nodes++;
+	PSCNV_RB_INSERT(pscnv_vm_maptree, &vs->maps, node);
+	return node;
+}
+
+/* can b be merged into its unmapped neighbour a? */
+static int
+pscnv_vspace_same_hole(struct pscnv_vm_mapnode *a, struct pscnv_vm_mapnode *b) {
+	return !b->vo && a->reserved == b->reserved && (!a->reserved || a->resv == b->resv);
+}
+
+/* the node containing addr */
+static struct pscnv_vm_mapnode *
+pscnv_vspace_tree_lookup(struct pscnv_vspace *vs, uint64_t addr) {
+	struct pscnv_vm_mapnode *node = PSCNV_RB_ROOT(&vs->maps);
+	while (node) {
+		if (addr < node->start)
+			node = PSCNV_RB_LEFT(node, entry);
+		else if (addr >= node->start + node->size)
+			node = PSCNV_RB_RIGHT(node, entry);
+		else
+			break;
+	}
+	return node;
+}
+
+/* shrinks the unmapped node to [mstart, mstart + size), splitting the
+ * rest off into up to two nodes from spare. maxgap is left for the
+ * caller to fix once the node is used. */
+static void
+pscnv_vspace_tree_take(struct pscnv_vspace *vs, struct pscnv_vm_mapnode *node,
+		uint64_t mstart, uint64_t size, struct pscnv_vm_mapnode **spare)
+{
+	uint64_t mend = mstart + size;
+	if (node->start + node->size != mend)
+		pscnv_vspace_use_spare(vs, spare, node, mend, node->start + node->size - mend);
+	if (node->start != mstart) {
+		uint64_t lstart = node->start;
+		node->start = mstart;
+		pscnv_vspace_use_spare(vs, spare, node, lstart, mstart - lstart);
+	}
+	node->start = mstart;
+	node->size = size;
+}
+
+/* where a VO would go in a free node, or 0 if it doesn't fit */
+static int
+pscnv_vspace_fit(struct pscnv_vm_mapnode *node, uint64_t size,
+		uint64_t start, uint64_t end, uint64_t align, int back, uint64_t *res)
+{
+	uint64_t mstart, mend;
+	if (node->vo || node->reserved)
+		return 0;
+	mstart = ALIGN(max(node->start, start), align);
+	mend = min(node->start + node->size, end);
+	if (mstart + size > mend)
+		return 0;
+	*res = back ? (mend - size) & ~(align - 1) : mstart;
+	return 1;
+}
+
+/* finds room for size bytes between start and end, lowest address
+ * first, or highest if back is set. Walks the tree in address order,
+ * skipping subtrees without a big enough gap or outside the range.
+ * Returns the free node and the address in it, or NULL. */
+static struct pscnv_vm_mapnode *
+pscnv_vspace_tree_search(struct pscnv_vspace *vs, uint64_t size,
+		uint64_t start, uint64_t end, uint64_t align, int back, uint64_t *res)
+{
+	struct pscnv_vm_mapnode *node = PSCNV_RB_ROOT(&vs->maps), *child, *left, *right;
+	int lok, rok, down = 1;
+	while (node) {
+		left = PSCNV_RB_LEFT(node, entry);
+		right = PSCNV_RB_RIGHT(node, entry);
+		lok = left && left->maxgap >= size && node->start > start;
+		rok = right && right->maxgap >= size && node->start + node->size < end;
+		if (pscnv_vm_debug >= 2)
+			NV_INFO (vs->dev, "VM map: %llx %llx %llx %d %d %d\n", (unsigned long long)node->start,
+					(unsigned long long)node->size, (unsigned long long)node->maxgap, lok, rok, down);
+		if (down && (back ? rok : lok)) {
+			node = back ? right : left;
+			continue;
+		}
+		if (pscnv_vspace_fit(node, size, start, end, align, back, res))
+			return node;
+		if (back ? lok : rok) {
+			node = back ? left : right;
+			down = 1;
+			continue;
+		}
+		/* done with this subtree, go up to the first ancestor we
+		 * came to from the side that goes first */
+		do {
+			child = node;
+			node = PSCNV_RB_PARENT(node, entry);
+		} while (node && child != (back ? PSCNV_RB_RIGHT(node, entry) : PSCNV_RB_LEFT(node, entry)));
+		down = 0;
+	}
+	return 0;
+}
+
+/* finds room for size bytes of vo between start and end and takes it.
+ * Splitting the free node uses up to two nodes from spare. Returns the
+ * new mapped node, or NULL if there's no room. */
+struct pscnv_vm_mapnode *
+pscnv_vspace_tree_alloc(struct pscnv_vspace *vs, struct pscnv_vo *vo, uint64_t size,
+		uint64_t start, uint64_t end, uint64_t align, int back,
+		struct pscnv_vm_mapnode **spare)
+{
+	struct pscnv_vm_mapnode *node;
+	uint64_t mstart;
+	node = pscnv_vspace_tree_search(vs, size, start, end, align, back, &mstart);
+	if (!node)
+		return 0;
+	pscnv_vspace_tree_take(vs, node, mstart, size, spare);
+	node->vo = vo;
+	pscnv_vspace_augment_up(node);
+	return node;
+}
+
+/* takes size bytes at exactly addr for vo. They have to be free or a
+ * hole in a single reservation. Returns NULL if they aren't. */
+struct pscnv_vm_mapnode *
+pscnv_vspace_tree_alloc_fixed(struct pscnv_vspace *vs, struct pscnv_vo *vo,
+		uint64_t size, uint64_t addr, struct pscnv_vm_mapnode **spare)
+{
+	struct pscnv_vm_mapnode *node = pscnv_vspace_tree_lookup(vs, addr);
+	if (!node || node->vo || addr + size > node->start + node->size)
+		return 0;
+	pscnv_vspace_tree_take(vs, node, addr, size, spare);
+	node->vo = vo;
+	pscnv_vspace_augment_up(node);
+	return node;
+}
+
+/* reserves size bytes of free address space, found like a mapping, or
+ * at exactly start if fixed is set. Returns the reservation's node, or
+ * NULL if there's no room. */
+struct pscnv_vm_mapnode *
+pscnv_vspace_tree_reserve(struct pscnv_vspace *vs, uint64_t size,
+		uint64_t start, uint64_t end, uint64_t align, int back, int fixed,
+		struct pscnv_vm_mapnode **spare)
+{
+	struct pscnv_vm_mapnode *node;
+	uint64_t mstart = start;
+	if (fixed) {
+		node = pscnv_vspace_tree_lookup(vs, start);
+		if (!node || node->vo || node->reserved || start + size > node->start + node->size)
+			return 0;
+	} else {
+		node = pscnv_vspace_tree_search(vs, size, start, end, align, back, &mstart);
+		if (!node)
+			return 0;
+	}
+	pscnv_vspace_tree_take(vs, node, mstart, size, spare);
+	node->reserved = 1;
+	node->resv = mstart;
+	pscnv_vspace_augment_up(node);
+	return node;
+}
+
+/* merges an unmapped node with its neighbours of the same kind. The node
+ * may be freed. */
+static void
+pscnv_vspace_tree_merge(struct pscnv_vm_mapnode *node) {
+	struct pscnv_vm_mapnode *prev, *next;
+	next = PSCNV_RB_NEXT(pscnv_vm_maptree, &node->vspace->maps, node);
+	if (next && pscnv_vspace_same_hole(node, next)) {
+		node->size += next->size;
+		pscnv_vspace_del_node(next);
+	}
+	prev = PSCNV_RB_PREV(pscnv_vm_maptree, &node->vspace->maps, node);
+	if (prev && pscnv_vspace_same_hole(node, prev)) {
+		prev->size += node->size;
+		pscnv_vspace_del_node(node);
+		node = prev;
+	}
+	pscnv_vspace_augment_up(node);
+}
+
+/* gives a mapped node's addresses back, to the free space or to the
+ * reservation they were in. The node may be freed. */
+void
+pscnv_vspace_tree_release(struct pscnv_vm_mapnode *node) {
+	node->vo = 0;
+	pscnv_vspace_tree_merge(node);
+}
+
+/* drops the reservation starting at addr. Returns -ENOENT if there's
+ * none, -EBUSY if something is still mapped in it. */
+int
+pscnv_vspace_tree_unreserve(struct pscnv_vspace *vs, uint64_t addr) {
+	struct pscnv_vm_mapnode *node = pscnv_vspace_tree_lookup(vs, addr), *next;
+	if (!node || !node->reserved || node->resv != addr)
+		return -ENOENT;
+	/* with nothing mapped, the reservation is a single hole */
+	next = PSCNV_RB_NEXT(pscnv_vm_maptree, &vs->maps, node);
+	if (node->vo || (next && next->reserved && next->resv == addr))
+		return -EBUSY;
+	node->reserved = 0;
+	pscnv_vspace_tree_merge(node);
+	return 0;
+}
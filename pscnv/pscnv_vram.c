@@ -31,6 +31,30 @@
 #include <linux/list.h>
 #include <linux/kernel.h>
 #include <linux/mutex.h>
+#include <linux/log2.h>
+
+#undef PSCNV_RB_AUGMENT
+
+static void PSCNV_RB_AUGMENT(struct pscnv_vram_region *reg) {
+	uint64_t maxsize = reg->size;
+	struct pscnv_vram_region *left = PSCNV_RB_LEFT(reg, entry);
+	struct pscnv_vram_region *right = PSCNV_RB_RIGHT(reg, entry);
+	if (left && left->maxsize > maxsize)
+		maxsize = left->maxsize;
+	if (right && right->maxsize > maxsize)
+		maxsize = right->maxsize;
+	reg->maxsize = maxsize;
+}
+
+static int regcmp(struct pscnv_vram_region *a, struct pscnv_vram_region *b) {
+	if (a->start < b->start)
+		return -1;
+	else if (a->start > b->start)
+		return 1;
+	return 0;
+}
+
+PSCNV_RB_GENERATE_STATIC(pscnv_vram_freetree, pscnv_vram_region, entry, regcmp)
 
 static inline uint64_t
 pscnv_roundup (uint64_t x, uint32_t y)
@@ -56,64 +80,156 @@ pscnv_vram_global_prev (struct drm_device *dev, struct pscnv_vram_region *reg)
 	return list_entry(reg->global_list.prev, struct pscnv_vram_region, global_list);
 }
 
-static inline struct pscnv_vram_region *
-pscnv_vram_free_next (struct drm_device *dev, struct pscnv_vram_region *reg)
+/* size class of a free region: every region in class n has at least
+ * 2^n pages */
+static inline int
+pscnv_vram_bucket (uint64_t size)
+{
+	int res = ilog2(size >> PSCNV_VRAM_PAGE_SHIFT);
+	if (res >= PSCNV_VRAM_BUCKETS)
+		res = PSCNV_VRAM_BUCKETS - 1;
+	return res;
+}
+
+/* links a free region into the free tree and size class list of its type */
+static void
+pscnv_vram_free_link (struct drm_device *dev, struct pscnv_vram_region *reg)
 {
 	struct drm_nouveau_private *dev_priv = dev->dev_private;
-	if (reg->local_list.next == &dev_priv->vram_free_list)
-		return 0;
-	return list_entry(reg->local_list.next, struct pscnv_vram_region, local_list);
+	PSCNV_RB_INSERT(pscnv_vram_freetree, &dev_priv->vram_free_tree[reg->type], reg);
+	list_add(&reg->local_list, &dev_priv->vram_free_bucket[reg->type][pscnv_vram_bucket(reg->size)]);
+	dev_priv->vram_free_bytes[reg->type] += reg->size;
 }
 
-static inline struct pscnv_vram_region *
-pscnv_vram_free_prev (struct drm_device *dev, struct pscnv_vram_region *reg)
+static void
+pscnv_vram_free_unlink (struct drm_device *dev, struct pscnv_vram_region *reg)
 {
 	struct drm_nouveau_private *dev_priv = dev->dev_private;
-	if (reg->local_list.prev == &dev_priv->vram_free_list)
-		return 0;
-	return list_entry(reg->local_list.prev, struct pscnv_vram_region, local_list);
+	PSCNV_RB_REMOVE(pscnv_vram_freetree, &dev_priv->vram_free_tree[reg->type], reg);
+	list_del(&reg->local_list);
+	dev_priv->vram_free_bytes[reg->type] -= reg->size;
 }
 
-/* splits off a new region starting from left side of existing region */
+/* changes type of a free region, moving it to the right index */
+static void
+pscnv_vram_free_retype (struct drm_device *dev, struct pscnv_vram_region *reg, int type)
+{
+	pscnv_vram_free_unlink(dev, reg);
+	reg->type = type;
+	pscnv_vram_free_link(dev, reg);
+}
+
+/* tops up the descriptor pool. Called without vram_mutex, may sleep. */
+static int
+pscnv_vram_pool_fill (struct drm_device *dev)
+{
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	while (dev_priv->vram_pool_count < PSCNV_VRAM_POOL_LOW) {
+		struct pscnv_vram_region *reg = kmalloc (sizeof *reg, GFP_KERNEL);
+		if (!reg)
+			return -ENOMEM;
+		spin_lock(&dev_priv->vram_pool_lock);
+		list_add(&reg->local_list, &dev_priv->vram_pool);
+		dev_priv->vram_pool_count++;
+		spin_unlock(&dev_priv->vram_pool_lock);
+	}
+	return 0;
+}
+
+/* makes sure the pool has at least n descriptors, dropping vram_mutex to
+ * refill it if needed. vram_mutex is held again on return. */
+static int
+pscnv_vram_pool_reserve (struct drm_device *dev, int n)
+{
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	int ret;
+	while (dev_priv->vram_pool_count < n) {
+		mutex_unlock(&dev_priv->vram_mutex);
+		ret = pscnv_vram_pool_fill(dev);
+		mutex_lock(&dev_priv->vram_mutex);
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
+
+static struct pscnv_vram_region *
+pscnv_vram_pool_get (struct drm_device *dev)
+{
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	struct pscnv_vram_region *res = 0;
+	spin_lock(&dev_priv->vram_pool_lock);
+	if (!list_empty(&dev_priv->vram_pool)) {
+		res = list_first_entry(&dev_priv->vram_pool, struct pscnv_vram_region, local_list);
+		list_del(&res->local_list);
+		dev_priv->vram_pool_count--;
+	}
+	spin_unlock(&dev_priv->vram_pool_lock);
+	return res;
+}
+
+static void
+pscnv_vram_pool_put (struct drm_device *dev, struct pscnv_vram_region *reg)
+{
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	spin_lock(&dev_priv->vram_pool_lock);
+	if (dev_priv->vram_pool_count < PSCNV_VRAM_POOL_HIGH) {
+		list_add(&reg->local_list, &dev_priv->vram_pool);
+		dev_priv->vram_pool_count++;
+		reg = 0;
+	}
+	spin_unlock(&dev_priv->vram_pool_lock);
+	kfree(reg);
+}
+
+/* splits off a new region starting from left side of existing free region */
 static struct pscnv_vram_region *
 pscnv_vram_split_left (struct drm_device *dev, struct pscnv_vram_region *reg, uint64_t size)
 {
-	struct pscnv_vram_region *left = kmalloc (sizeof *left, GFP_KERNEL);
+	struct pscnv_vram_region *left = pscnv_vram_pool_get(dev);
 	if (!left)
 		return 0;
+	pscnv_vram_free_unlink(dev, reg);
 	left->type = reg->type;
 	left->start = reg->start;
 	left->size = size;
-	list_add_tail(&left->local_list, &reg->local_list);
+	left->vo = 0;
 	list_add_tail(&left->global_list, &reg->global_list);
 	reg->size -= left->size;
 	reg->start += left->size;
+	pscnv_vram_free_link(dev, reg);
+	pscnv_vram_free_link(dev, left);
 	if (pscnv_vram_debug >= 3)
 		NV_INFO(dev, "Split left type %d: %llx:%llx:%llx\n", reg->type,
-				left->start, reg->start, reg->start + reg->size);
+				(unsigned long long)left->start, (unsigned long long)reg->start,
+				(unsigned long long)(reg->start + reg->size));
 	return left;
 }
 
-/* splits off a new region starting from right side of existing region */
+/* splits off a new region starting from right side of existing free region */
 static struct pscnv_vram_region *
 pscnv_vram_split_right (struct drm_device *dev, struct pscnv_vram_region *reg, uint64_t size)
 {
-	struct pscnv_vram_region *right = kmalloc (sizeof *right, GFP_KERNEL);
+	struct pscnv_vram_region *right = pscnv_vram_pool_get(dev);
 	if (!right)
 		return 0;
+	pscnv_vram_free_unlink(dev, reg);
 	right->type = reg->type;
 	right->start = reg->start + reg->size - size;
 	right->size = size;
-	list_add(&right->local_list, &reg->local_list);
+	right->vo = 0;
 	list_add(&right->global_list, &reg->global_list);
 	reg->size -= right->size;
+	pscnv_vram_free_link(dev, reg);
+	pscnv_vram_free_link(dev, right);
 	if (pscnv_vram_debug >= 3)
 		NV_INFO(dev, "Split right type %d: %llx:%llx:%llx\n", reg->type,
-				reg->start, right->start, right->start + right->size);
+				(unsigned long long)reg->start, (unsigned long long)right->start,
+				(unsigned long long)(right->start + right->size));
 	return right;
 }
 
-/* try to merge two regions, returning the merged region, or first region if merge failed. */
+/* try to merge two free regions, returning the merged region, or first region if merge failed. */
 static struct pscnv_vram_region *
 pscnv_vram_try_merge (struct drm_device *dev, struct pscnv_vram_region *a, struct pscnv_vram_region *b)
 {
@@ -123,18 +239,23 @@ pscnv_vram_try_merge (struct drm_device *dev, struct pscnv_vram_region *a, struc
 	else
 		c = b, d = a;
 	if (c->start + c->size != d->start) {
-		NV_ERROR(dev, "internal error: tried to merge non-adjacent regions at %llx-%llx and %llx-%llx!\n", a->start, a->start + a->size, b->start, b->start + b->size);
+		NV_ERROR(dev, "internal error: tried to merge non-adjacent regions at %llx-%llx and %llx-%llx!\n",
+				(unsigned long long)a->start, (unsigned long long)(a->start + a->size),
+				(unsigned long long)b->start, (unsigned long long)(b->start + b->size));
 		return a;
 	}
 	if (a->type != b->type)
 		return a;
 	if (pscnv_vram_debug >= 3)
 		NV_INFO(dev, "Merging type %d: %llx:%llx:%llx\n", a->type,
-				c->start, d->start, d->start + d->size);
+				(unsigned long long)c->start, (unsigned long long)d->start,
+				(unsigned long long)(d->start + d->size));
+	pscnv_vram_free_unlink(dev, c);
+	pscnv_vram_free_unlink(dev, d);
 	c->size += d->size;
 	list_del(&d->global_list);
-	list_del(&d->local_list);
-	kfree(d);
+	pscnv_vram_pool_put(dev, d);
+	pscnv_vram_free_link(dev, c);
 	return c;
 }
 
@@ -153,47 +274,359 @@ pscnv_vram_try_merge_adjacent (struct drm_device *dev, struct pscnv_vram_region
 }
 
 /* given a typed free region, try to convert to an untyped region, splitting
- * out the middle if needed */
+ * out the middle if needed. Free space of the region's type beyond its
+ * reserve is untyped, the rest stays typed for the next allocations. */
 static int
 pscnv_vram_try_untype(struct drm_device *dev, struct pscnv_vram_region *reg) {
 	struct drm_nouveau_private *dev_priv = dev->dev_private;
-	uint64_t split = pscnv_roundup (reg->start, dev_priv->vram_rblock_size);
-	uint64_t finalsize;
+	uint64_t rblock = dev_priv->vram_rblock_size;
+	uint64_t lo = pscnv_roundup (reg->start, rblock);
+	uint64_t hi = (reg->start + reg->size) / rblock * rblock;
+	int lsr = reg->type == PSCNV_VRAM_FREE_LSR;
+	uint64_t excess;
 	/* can we fit one full rblock to untype? */
-	if (split + dev_priv->vram_rblock_size > reg->start + reg->size)
+	if (lo + rblock > hi)
 		/* if not, return */
 		return 0;
+	/* is there anything over the reserve? */
+	if (dev_priv->vram_free_bytes[reg->type] < dev_priv->vram_reserve[lsr] + rblock)
+		return 0;
+	/* keep the reserved part on the side allocations of this type
+	 * come from */
+	excess = (dev_priv->vram_free_bytes[reg->type] - dev_priv->vram_reserve[lsr]) / rblock * rblock;
+	if (hi - lo > excess) {
+		if (lsr)
+			hi = lo + excess;
+		else
+			lo = hi - excess;
+	}
 	/* okay. proceed with untyping. check if we need to cut off the
 	 * left part. */
-	if (split != reg->start) {
-		if (!pscnv_vram_split_left(dev, reg, split - reg->start))
+	if (lo != reg->start) {
+		if (!pscnv_vram_split_left(dev, reg, lo - reg->start))
 			return -ENOMEM;
 	}
-	/* compute what the final size of the new region will be */
-	finalsize = reg->size / dev_priv->vram_rblock_size * dev_priv->vram_rblock_size;
 	/* if needed, cut off the right part too */
-	if (finalsize != reg->size) {
-		if (!pscnv_vram_split_right(dev, reg, reg->size - finalsize))
+	if (hi != reg->start + reg->size) {
+		if (!pscnv_vram_split_right(dev, reg, reg->start + reg->size - hi))
 			return -ENOMEM;
 	}
 	/* ok, we can untype the region now. */
-	reg->type = PSCNV_VRAM_FREE_UNTYPED;
+	dev_priv->vram_untyped[lsr] += reg->size / rblock;
+	pscnv_vram_free_retype(dev, reg, PSCNV_VRAM_FREE_UNTYPED);
 	pscnv_vram_try_merge_adjacent(dev, reg);
 	return 0;
 }
 
+/* does the region have room for size bytes starting at an aligned address? */
+static inline int
+pscnv_vram_fits (struct pscnv_vram_region *reg, uint64_t size, uint64_t align)
+{
+	return reg->size >= size && ALIGN(reg->start, align) <= reg->start + reg->size - size;
+}
+
+/* finds the lowest [or, if top is set, highest] free region in the subtree
+ * that fits size bytes at given alignment, skipping subtrees by maxsize.
+ * With page alignment, any subtree that passes the maxsize check has a fit,
+ * so this is a plain descent. Otherwise misaligned regions can make it
+ * backtrack, up to visiting every large enough region. */
+static struct pscnv_vram_region *
+pscnv_vram_tree_fit_node (struct pscnv_vram_region *reg, uint64_t size, uint64_t align, int top)
+{
+	struct pscnv_vram_region *res;
+	if (!reg || reg->maxsize < size)
+		return 0;
+	if ((res = pscnv_vram_tree_fit_node(top ? PSCNV_RB_RIGHT(reg, entry) : PSCNV_RB_LEFT(reg, entry), size, align, top)))
+		return res;
+	if (pscnv_vram_fits(reg, size, align))
+		return reg;
+	return pscnv_vram_tree_fit_node(top ? PSCNV_RB_LEFT(reg, entry) : PSCNV_RB_RIGHT(reg, entry), size, align, top);
+}
+
+static inline struct pscnv_vram_region *
+pscnv_vram_tree_fit (struct pscnv_vram_freetree *tree, uint64_t size, uint64_t align, int top)
+{
+	return pscnv_vram_tree_fit_node(PSCNV_RB_ROOT(tree), size, align, top);
+}
+
+/* finds a free region from the smallest size class guaranteed to fit */
+static struct pscnv_vram_region *
+pscnv_vram_bucket_fit (struct drm_device *dev, int type, uint64_t size)
+{
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	int i;
+	for (i = order_base_2(size >> PSCNV_VRAM_PAGE_SHIFT); i < PSCNV_VRAM_BUCKETS; i++)
+		if (!list_empty(&dev_priv->vram_free_bucket[type][i]))
+			return list_first_entry(&dev_priv->vram_free_bucket[type][i], struct pscnv_vram_region, local_list);
+	return 0;
+}
+
+/* picks whichever of two candidate regions comes first in allocation order */
+static struct pscnv_vram_region *
+pscnv_vram_first (struct pscnv_vram_region *a, struct pscnv_vram_region *b, int lsr)
+{
+	if (!a)
+		return b;
+	if (!b)
+		return a;
+	if (lsr)
+		return a->start > b->start ? a : b;
+	else
+		return a->start < b->start ? a : b;
+}
+
+/* finds the first free region usable for sane [or LSR] pages, typed or
+ * not, that can hold size bytes at given alignment. */
+static struct pscnv_vram_region *
+pscnv_vram_trees_fit (struct drm_device *dev, uint64_t size, uint64_t align, int lsr)
+{
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	struct pscnv_vram_freetree *typed = &dev_priv->vram_free_tree[lsr ? PSCNV_VRAM_FREE_LSR : PSCNV_VRAM_FREE_SANE];
+	struct pscnv_vram_freetree *untyped = &dev_priv->vram_free_tree[PSCNV_VRAM_FREE_UNTYPED];
+	struct pscnv_vram_region *res;
+	if (align > PSCNV_VRAM_PAGE_SIZE) {
+		/* any region of worst bytes fits regardless of its alignment,
+		 * so searching by that is a plain descent. It may skip a lower
+		 * [higher] region that happens to be aligned well. Only when
+		 * there is no region that large do we backtrack through the
+		 * misaligned ones. */
+		uint64_t worst = size + align - PSCNV_VRAM_PAGE_SIZE;
+		res = pscnv_vram_first(
+			pscnv_vram_tree_fit(typed, worst, PSCNV_VRAM_PAGE_SIZE, lsr),
+			pscnv_vram_tree_fit(untyped, worst, PSCNV_VRAM_PAGE_SIZE, lsr),
+			lsr);
+		if (res)
+			return res;
+	}
+	return pscnv_vram_first(
+		pscnv_vram_tree_fit(typed, size, align, lsr),
+		pscnv_vram_tree_fit(untyped, size, align, lsr),
+		lsr);
+}
+
+/* finds a free region usable for sane [or LSR] pages that can hold size
+ * bytes at given alignment in one piece. Already typed regions are preferred
+ * by the size class policy, to avoid typing new rblocks. */
+static struct pscnv_vram_region *
+pscnv_vram_find_fit (struct drm_device *dev, uint64_t size, uint64_t align, int lsr)
+{
+	int typed = lsr ? PSCNV_VRAM_FREE_LSR : PSCNV_VRAM_FREE_SANE;
+	struct pscnv_vram_region *res;
+	if (pscnv_vram_policy == PSCNV_VRAM_POLICY_SIZE_CLASS) {
+		/* any region this large fits regardless of its alignment */
+		uint64_t worst = size + align - PSCNV_VRAM_PAGE_SIZE;
+		if ((res = pscnv_vram_bucket_fit(dev, typed, worst)))
+			return res;
+		if ((res = pscnv_vram_bucket_fit(dev, PSCNV_VRAM_FREE_UNTYPED, worst)))
+			return res;
+		/* nothing in the guaranteed classes, but there still may be
+		 * a fitting region in the classes just below. */
+	}
+	return pscnv_vram_trees_fit(dev, size, align, lsr);
+}
+
+/* can a free region be part of an extent used for sane [or LSR] pages? */
+static inline int
+pscnv_vram_compatible (struct pscnv_vram_region *reg, int lsr)
+{
+	return reg && (reg->type == PSCNV_VRAM_FREE_UNTYPED ||
+			reg->type == (lsr ? PSCNV_VRAM_FREE_LSR : PSCNV_VRAM_FREE_SANE));
+}
+
+/* computes the extent of adjacent compatible free regions around reg.
+ * Returns the lowest region of the extent. */
+static struct pscnv_vram_region *
+pscnv_vram_extent (struct drm_device *dev, struct pscnv_vram_region *reg, int lsr, uint64_t *lo, uint64_t *hi)
+{
+	struct pscnv_vram_region *first = reg, *tmp;
+	while (pscnv_vram_compatible(tmp = pscnv_vram_global_prev(dev, first), lsr))
+		first = tmp;
+	for (tmp = reg; pscnv_vram_compatible(pscnv_vram_global_next(dev, tmp), lsr); )
+		tmp = pscnv_vram_global_next(dev, tmp);
+	*lo = first->start;
+	*hi = tmp->start + tmp->size;
+	return first;
+}
+
+/* finds the lowest [or highest] extent containing an untyped region that
+ * fits size bytes at given alignment. Typed regions next to an untyped one
+ * are always smaller than an rblock plus the reserve, or they'd have been
+ * untyped, so only untyped subtrees with large enough maxsize are searched. */
+static struct pscnv_vram_region *
+pscnv_vram_extent_fit_node (struct drm_device *dev, struct pscnv_vram_region *reg, uint64_t min,
+		uint64_t size, uint64_t align, int lsr, uint64_t *lo, uint64_t *hi)
+{
+	struct pscnv_vram_region *res;
+	if (!reg || reg->maxsize < min)
+		return 0;
+	if ((res = pscnv_vram_extent_fit_node(dev, lsr ? PSCNV_RB_RIGHT(reg, entry) : PSCNV_RB_LEFT(reg, entry), min, size, align, lsr, lo, hi)))
+		return res;
+	if (reg->size >= min) {
+		res = pscnv_vram_extent(dev, reg, lsr, lo, hi);
+		if (*hi - *lo >= size && ALIGN(*lo, align) <= *hi - size)
+			return res;
+	}
+	return pscnv_vram_extent_fit_node(dev, lsr ? PSCNV_RB_LEFT(reg, entry) : PSCNV_RB_RIGHT(reg, entry), min, size, align, lsr, lo, hi);
+}
+
+static struct pscnv_vram_region *
+pscnv_vram_extent_fit (struct drm_device *dev, uint64_t size, uint64_t align, int lsr, uint64_t *lo, uint64_t *hi)
+{
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	uint64_t slack = 2 * (dev_priv->vram_rblock_size + dev_priv->vram_reserve[lsr]);
+	return pscnv_vram_extent_fit_node(dev, PSCNV_RB_ROOT(&dev_priv->vram_free_tree[PSCNV_VRAM_FREE_UNTYPED]),
+			size > slack ? size - slack : 0, size, align, lsr, lo, hi);
+}
+
+/* finds the lowest free region in the tree that ends above addr */
+static struct pscnv_vram_region *
+pscnv_vram_tree_after (struct pscnv_vram_freetree *tree, uint64_t addr)
+{
+	struct pscnv_vram_region *reg = PSCNV_RB_ROOT(tree), *res = 0;
+	while (reg) {
+		if (reg->start + reg->size > addr) {
+			res = reg;
+			reg = PSCNV_RB_LEFT(reg, entry);
+		} else {
+			reg = PSCNV_RB_RIGHT(reg, entry);
+		}
+	}
+	return res;
+}
+
+/* finds room for a hot VO in the row the previous hot VO went to, so that
+ * they share DRAM pages. lo and hi get clipped to the row. */
+static struct pscnv_vram_region *
+pscnv_vram_hot_fit (struct drm_device *dev, uint64_t size, uint64_t align, int lsr, uint64_t *lo, uint64_t *hi)
+{
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	uint64_t wlo = dev_priv->vram_hot_row[lsr];
+	uint64_t whi = wlo + dev_priv->vram_row_size;
+	struct pscnv_vram_region *reg, *res;
+	if (wlo == ~0ull)
+		return 0;
+	reg = pscnv_vram_first(
+		pscnv_vram_tree_after(&dev_priv->vram_free_tree[lsr ? PSCNV_VRAM_FREE_LSR : PSCNV_VRAM_FREE_SANE], wlo),
+		pscnv_vram_tree_after(&dev_priv->vram_free_tree[PSCNV_VRAM_FREE_UNTYPED], wlo),
+		0);
+	for (; reg && reg->start < whi; reg = pscnv_vram_global_next(dev, reg)) {
+		if (!pscnv_vram_compatible(reg, lsr))
+			continue;
+		res = pscnv_vram_extent(dev, reg, lsr, lo, hi);
+		*lo = max(*lo, wlo);
+		*hi = min(*hi, whi);
+		if (ALIGN(*lo, align) + size <= *hi)
+			return res;
+	}
+	return 0;
+}
+
+/* finds a free region usable for sane [or LSR] pages to use as a piece of
+ * a non-contig VO when no single region is large enough. The piece has to
+ * hold at least min bytes at given alignment. */
+static struct pscnv_vram_region *
+pscnv_vram_find_piece (struct drm_device *dev, uint64_t min, uint64_t align, int lsr)
+{
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	struct pscnv_vram_freetree *typed = &dev_priv->vram_free_tree[lsr ? PSCNV_VRAM_FREE_LSR : PSCNV_VRAM_FREE_SANE];
+	struct pscnv_vram_freetree *untyped = &dev_priv->vram_free_tree[PSCNV_VRAM_FREE_UNTYPED];
+	struct pscnv_vram_region *a = 0, *b = 0;
+	if (pscnv_vram_policy == PSCNV_VRAM_POLICY_SIZE_CLASS) {
+		/* take the largest piece, to keep region count down. */
+		if (PSCNV_RB_ROOT(typed) && PSCNV_RB_ROOT(typed)->maxsize >= min)
+			a = pscnv_vram_tree_fit(typed, PSCNV_RB_ROOT(typed)->maxsize, align, lsr);
+		if (PSCNV_RB_ROOT(untyped) && PSCNV_RB_ROOT(untyped)->maxsize >= min)
+			b = pscnv_vram_tree_fit(untyped, PSCNV_RB_ROOT(untyped)->maxsize, align, lsr);
+		if (a && b)
+			return a->size >= b->size ? a : b;
+		if (a || b)
+			return a ? a : b;
+		/* the largest regions are misaligned, settle for any. */
+	}
+	return pscnv_vram_trees_fit(dev, min, align, lsr);
+}
+
+/* carves a used region of at most size bytes, starting at an aligned address,
+ * out of the free space between lo and hi, typing rblocks as needed. The
+ * space starts in region cur and may span several adjacent compatible
+ * regions. Sane pages are taken from the bottom, LSR pages from the top.
+ * Whatever is left on either side stays on the free lists. */
+static struct pscnv_vram_region *
+pscnv_vram_take (struct drm_device *dev, struct pscnv_vram_region *cur, uint64_t lo, uint64_t hi,
+		uint64_t size, uint64_t align, int lsr)
+{
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	uint64_t start = ALIGN(lo, align);
+	uint64_t pos;
+	if (lsr && hi - lo > size && hi - size > start)
+		start = (hi - size) & ~(align - 1);
+	/* pieces of non-contig VOs are kept to multiples of the alignment */
+	if (hi - start < size)
+		size = (hi - start) & ~(align - 1);
+	while (cur->start + cur->size <= start)
+		cur = pscnv_vram_global_next(dev, cur);
+	/* untyped regions in the way need to be converted to typed first,
+	 * but only in the rblocks we actually use. Merging with typed
+	 * neighbours leaves us with a single region covering it all. */
+	for (pos = start; pos < start + size; pos = cur->start + cur->size) {
+		if (pos >= cur->start + cur->size)
+			cur = pscnv_vram_global_next(dev, cur);
+		if (cur->type == PSCNV_VRAM_FREE_UNTYPED) {
+			uint64_t end = cur->start + cur->size;
+			uint64_t tstart = pos / dev_priv->vram_rblock_size * dev_priv->vram_rblock_size;
+			uint64_t tend = pscnv_roundup(start + size, dev_priv->vram_rblock_size);
+			if (tend > end)
+				tend = end;
+			if (tstart != cur->start)
+				if (!pscnv_vram_split_left(dev, cur, tstart - cur->start))
+					return 0;
+			if (tend != end)
+				if (!pscnv_vram_split_right(dev, cur, end - tend))
+					return 0;
+			dev_priv->vram_typed[lsr] += cur->size / dev_priv->vram_rblock_size;
+			pscnv_vram_free_retype(dev, cur, lsr ? PSCNV_VRAM_FREE_LSR : PSCNV_VRAM_FREE_SANE);
+			/* keep free regions of the same type merged */
+			cur = pscnv_vram_try_merge_adjacent(dev, cur);
+		}
+	}
+	if (cur->start > start || cur->start + cur->size < start + size) {
+		NV_ERROR(dev, "internal error: free space at %llx-%llx not merged into one region!\n",
+				(unsigned long long)start, (unsigned long long)(start + size));
+		return 0;
+	}
+	if (start != cur->start)
+		if (!pscnv_vram_split_left(dev, cur, start - cur->start))
+			return 0;
+	if (cur->size != size)
+		if (!pscnv_vram_split_right(dev, cur, cur->size - size))
+			return 0;
+	pscnv_vram_free_unlink(dev, cur);
+	cur->type = (lsr?PSCNV_VRAM_USED_LSR:PSCNV_VRAM_USED_SANE);
+	return cur;
+}
+
 int
 pscnv_vram_init(struct drm_device *dev)
 {
 	struct drm_nouveau_private *dev_priv = dev->dev_private;
-	struct pscnv_vram_region *allmem;
+	struct pscnv_vram_region *allmem, *reg;
 	uint32_t r0, r4, rc, ru, rt;
-	int parts, i, colbits, rowbitsa, rowbitsb, banks;
+	int parts, i, j, colbits, rowbitsa, rowbitsb, banks;
 	uint64_t rowsize, predicted;
 	INIT_LIST_HEAD(&dev_priv->vram_global_list);
-	INIT_LIST_HEAD(&dev_priv->vram_free_list);
+	for (i = 0; i <= PSCNV_VRAM_LAST_FREE; i++) {
+		PSCNV_RB_INIT(&dev_priv->vram_free_tree[i]);
+		for (j = 0; j < PSCNV_VRAM_BUCKETS; j++)
+			INIT_LIST_HEAD(&dev_priv->vram_free_bucket[i][j]);
+	}
 	mutex_init(&dev_priv->vram_mutex);
 	spin_lock_init(&dev_priv->pramin_lock);
+	INIT_LIST_HEAD(&dev_priv->vram_pool);
+	dev_priv->vram_pool_count = 0;
+	spin_lock_init(&dev_priv->vram_pool_lock);
+	pscnv_vram_compact_init(dev);
+	pscnv_vram_scrub_init(dev);
+	pscnv_vram_trace_init(dev);
 
 	if (dev_priv->card_type != NV_50) {
 		NV_ERROR(dev, "Sorry, no memory allocator for NV%02x. Bailing.\n",
@@ -229,7 +662,8 @@ pscnv_vram_init(struct drm_device *dev)
 		return -ENODEV;
 	}
 	if (dev_priv->vram_size != predicted) {
-		NV_WARN(dev, "Memory controller reports VRAM size of 0x%llx, inconsistent with our calculation of 0x%llx!\n", dev_priv->vram_size, predicted);
+		NV_WARN(dev, "Memory controller reports VRAM size of 0x%llx, inconsistent with our calculation of 0x%llx!\n",
+				(unsigned long long)dev_priv->vram_size, (unsigned long long)predicted);
 	}
 	if (dev_priv->chipset == 0xaa || dev_priv->chipset == 0xac)
 		dev_priv->vram_sys_base = (uint64_t)nv_rd32(dev, 0x100e10) << 12;
@@ -240,37 +674,58 @@ pscnv_vram_init(struct drm_device *dev)
 	else
 		dev_priv->vram_rblock_size = rowsize;
 
-	NV_INFO(dev, "VRAM: size 0x%llx, LSR period %x\n",
-			dev_priv->vram_size, dev_priv->vram_rblock_size);
+	/* XXX: we assume every partition holds a contiguous 1/parts of each
+	 * row, in order. Good enough to tell apart placements that use all
+	 * partitions evenly from ones that don't. */
+	dev_priv->vram_parts = parts;
+	dev_priv->vram_row_size = parts ? rowsize : 0;
+	dev_priv->vram_part_stride = parts ? rowsize / parts : 0;
+	dev_priv->vram_hot_row[0] = dev_priv->vram_hot_row[1] = ~0ull;
+
+	dev_priv->vram_reserve[0] = ((uint64_t)max(pscnv_vram_reserve_sane, 0) << 10)
+		/ dev_priv->vram_rblock_size * dev_priv->vram_rblock_size;
+	dev_priv->vram_reserve[1] = ((uint64_t)max(pscnv_vram_reserve_lsr, 0) << 10)
+		/ dev_priv->vram_rblock_size * dev_priv->vram_rblock_size;
+
+	NV_INFO(dev, "VRAM: size 0x%llx, LSR period %x, %d partitions, row size %x\n",
+			(unsigned long long)dev_priv->vram_size, dev_priv->vram_rblock_size, parts, dev_priv->vram_row_size);
 
 	allmem = kmalloc (sizeof *allmem, GFP_KERNEL);
 	if (!allmem)
 		return -ENOMEM;
+	/* the first 256kiB are VGA memory, still used by the console until
+	 * we take over the display, and the last 8kiB are left alone too.
+	 * This has nothing to do with alignment: EVO gets its own aligned
+	 * VO when the display is set up. */
 	allmem->type = PSCNV_VRAM_FREE_SANE;
-	allmem->start = 0x40000;
-	allmem->size = dev_priv->vram_size - 0x40000 - 0x2000;
+	allmem->start = PSCNV_VRAM_RSVD_HEAD;
+	allmem->size = dev_priv->vram_size - PSCNV_VRAM_RSVD_HEAD - PSCNV_VRAM_RSVD_TAIL;
+	allmem->vo = 0;
 	list_add(&allmem->global_list, &dev_priv->vram_global_list);
-	list_add(&allmem->local_list, &dev_priv->vram_free_list);
+	pscnv_vram_free_link(dev, allmem);
+	if (pscnv_vram_pool_fill(dev))
+		return -ENOMEM;
+	/* untyping leaves the sane reserve at the bottom. Type the LSR one
+	 * at the top. */
 	pscnv_vram_try_untype(dev, allmem);
+	reg = pscnv_vram_tree_fit(&dev_priv->vram_free_tree[PSCNV_VRAM_FREE_UNTYPED],
+			dev_priv->vram_reserve[1], dev_priv->vram_rblock_size, 1);
+	if (reg && dev_priv->vram_reserve[1]) {
+		if (reg->size > dev_priv->vram_reserve[1])
+			reg = pscnv_vram_split_right(dev, reg, dev_priv->vram_reserve[1]);
+		if (reg)
+			pscnv_vram_free_retype(dev, reg, PSCNV_VRAM_FREE_LSR);
+	}
+	/* only count conversions done for allocations */
+	dev_priv->vram_untyped[0] = 0;
 
 	dev_priv->fb_mtrr = drm_mtrr_add(drm_get_resource_start(dev, 1),
 					 drm_get_resource_len(dev, 1),
 					 DRM_MTRR_WC);
 
-	/* XXX BIG HACK ALERT
-	 *
-	 * EVO is the only thing we use right now that needs >4kiB alignment.
-	 * We could do this correctly, but that'd require rewriting a lot of
-	 * the allocator code. So, since there's only a single EVO channel
-	 * per card, we just statically allocate EVO at address 0x40000.
-	 *
-	 * This is first alloc ever, so it's guaranteed to land at the correct
-	 * place.
-	 */
-
-	if (drm_core_check_feature(dev, DRIVER_MODESET)) {
-		dev_priv->evo_obj = pscnv_vram_alloc(dev, 0x2000, PSCNV_VO_CONTIG, 0, 0xd1501a7);
-	}
+	dev_priv->vram_slab = pscnv_vram_slab_new(dev, 0x400, 0x51ab51ab);
+	if (!dev_priv->vram_slab)
+		return -ENOMEM;
 
 	return 0;
 }
@@ -280,9 +735,10 @@ pscnv_vram_takedown(struct drm_device *dev)
 {
 	struct drm_nouveau_private *dev_priv = dev->dev_private;
 	struct list_head *pos, *next;
-	if (drm_core_check_feature(dev, DRIVER_MODESET)) {
-		pscnv_vram_free(dev_priv->evo_obj);
-	}
+	pscnv_vram_compact_takedown(dev);
+	pscnv_vram_scrub_takedown(dev);
+	if (dev_priv->vram_slab)
+		pscnv_vram_slab_destroy(dev_priv->vram_slab);
 restart:
 	list_for_each_safe(pos, next, &dev_priv->vram_global_list) {
 		struct pscnv_vram_region *reg = list_entry(pos, struct pscnv_vram_region, global_list);
@@ -297,6 +753,12 @@ restart:
 		struct pscnv_vram_region *reg = list_entry(pos, struct pscnv_vram_region, global_list);
 		kfree (reg);
 	}
+	list_for_each_safe(pos, next, &dev_priv->vram_pool) {
+		struct pscnv_vram_region *reg = list_entry(pos, struct pscnv_vram_region, local_list);
+		kfree (reg);
+	}
+	dev_priv->vram_pool_count = 0;
+	pscnv_vram_trace_takedown(dev);
 
 	if (dev_priv->fb_mtrr >= 0) {
 		drm_mtrr_del(dev_priv->fb_mtrr, drm_get_resource_start(dev, 1),
@@ -307,15 +769,66 @@ restart:
 	return 0;
 }
 
-struct pscnv_vo *
-pscnv_vram_alloc(struct drm_device *dev,
-		uint64_t size, int flags, int tile_flags, uint32_t cookie)
+static int
+pscnv_vram_free_region (struct drm_device *dev, struct pscnv_vram_region *reg) {
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	mutex_lock(&dev_priv->vram_mutex);
+	/* if this fails, we'll just fail to untype below. */
+	pscnv_vram_pool_reserve(dev, PSCNV_VRAM_POOL_FREE);
+	if (reg->type == PSCNV_VRAM_USED_LSR) {
+		reg->type = PSCNV_VRAM_FREE_LSR;
+	} else if (reg->type == PSCNV_VRAM_USED_SANE) {
+		reg->type = PSCNV_VRAM_FREE_SANE;
+	} else {
+		NV_ERROR (dev, "Trying to free block %llx-%llx of type %d.\n",
+				(unsigned long long)reg->start, (unsigned long long)(reg->start+reg->size), reg->type);
+		mutex_unlock(&dev_priv->vram_mutex);
+		return -EINVAL;
+	}
+	if (pscnv_vram_debug >= 3)
+		NV_INFO (dev, "Freeing block %llx-%llx of type %d.\n",
+				(unsigned long long)reg->start, (unsigned long long)(reg->start+reg->size), reg->type);
+	list_del(&reg->local_list);
+	reg->vo = 0;
+	pscnv_vram_free_link(dev, reg);
+	reg = pscnv_vram_try_merge_adjacent (dev, reg);
+	pscnv_vram_try_untype (dev, reg);
+	mutex_unlock(&dev_priv->vram_mutex);
+	return 0;
+}
+
+/* gives back vo's VRAM and mappings, without tracing it as a free */
+static void
+pscnv_vram_release (struct pscnv_vo *vo)
+{
+	struct drm_nouveau_private *dev_priv = vo->dev->dev_private;
+	struct list_head *pos, *next;
+	/* waits for compaction to be done with it, and keeps it away */
+	mutex_lock(&vo->maps_lock);
+	vo->pinned++;
+	mutex_unlock(&vo->maps_lock);
+	if (dev_priv->vm)
+		pscnv_vo_bar1_release(vo);
+	if (dev_priv->vm && vo->map3)
+		pscnv_vspace_unmap_node(vo->map3);
+	list_for_each_safe(pos, next, &vo->regions) {
+		struct pscnv_vram_region *reg = list_entry(pos, struct pscnv_vram_region, local_list);
+		pscnv_vram_free_region (vo->dev, reg);
+	}
+}
+
+static struct pscnv_vo *
+pscnv_vram_do_alloc(struct drm_device *dev,
+		uint64_t size, uint64_t align, int flags, int tile_flags, uint32_t cookie)
 {
 	static int serial = 0;
 	struct drm_nouveau_private *dev_priv = dev->dev_private;
 	int lsr;
 	struct pscnv_vo *res;
-	struct pscnv_vram_region *cur, *next;
+	struct pscnv_vram_region *cur;
+	uint64_t lo, hi, piece, want;
+	uint32_t row = dev_priv->vram_row_size;
+	int newhot;
 	switch (tile_flags) {
 		case 0:
 		case 0x10:
@@ -395,169 +908,184 @@ pscnv_vram_alloc(struct drm_device *dev,
 		return 0;
 	if (!size)
 		return 0;
+	/* 0 means default page alignment */
+	if (!align)
+		align = PSCNV_VRAM_PAGE_SIZE;
+	size = ALIGN(size, PSCNV_VRAM_PAGE_SIZE);
+	/* pieces of non-contig VOs hold at least one aligned block */
+	piece = align;
+	/* a spread VO is made of whole rows, each of them covering all
+	 * partitions evenly, no matter how many pieces it's in. */
+	if ((flags & PSCNV_VO_SPREAD) && row) {
+		if (align < dev_priv->vram_part_stride)
+			align = dev_priv->vram_part_stride;
+		size = pscnv_roundup(size, row);
+		piece = row;
+	}
+	/* hot VOs need to be small enough to share a row */
+	if (size * 4 > row)
+		flags &= ~PSCNV_VO_HOT;
 
 	res = kzalloc (sizeof *res, GFP_KERNEL);
 	if (!res)
 		return 0;
-	size = ALIGN(size, PSCNV_VRAM_PAGE_SIZE);
 	res->dev = dev;
 	res->size = size;
 	res->flags = flags;
 	res->tile_flags = tile_flags;
+	res->align = align;
 	res->cookie = cookie;
 	res->gem = 0;
 	INIT_LIST_HEAD(&res->regions);
+	INIT_LIST_HEAD(&res->maps);
+	INIT_LIST_HEAD(&res->bar1_lru);
+	mutex_init(&res->maps_lock);
 
 	mutex_lock(&dev_priv->vram_mutex);
 	res->serial = serial++;
 	if (pscnv_vram_debug >= 1)
-		NV_INFO(dev, "Allocating %d, %#llx-byte %sVO of type %08x, tile_flags %x\n", res->serial, size,
-				(flags & PSCNV_VO_CONTIG ? "contig " : ""), cookie, tile_flags);
-	if (list_empty(&dev_priv->vram_free_list)) {
-		mutex_unlock(&dev_priv->vram_mutex);
-		return 0;
-	}
-	if (!lsr)
-		cur = list_entry(dev_priv->vram_free_list.next, struct pscnv_vram_region, local_list);
-	else
-		cur = list_entry(dev_priv->vram_free_list.prev, struct pscnv_vram_region, local_list);
+		NV_INFO(dev, "Allocating %d, %#llx-byte %sVO of type %08x, tile_flags %x, align %#llx\n", res->serial, (unsigned long long)size,
+				(flags & PSCNV_VO_CONTIG ? "contig " : ""), cookie, tile_flags, (unsigned long long)align);
 
-	/* go through the list, looking for free region that might fit the bill */
-	while (cur) {
-		if (!lsr)
-			next = pscnv_vram_free_next(dev, cur);
-		else
-			next = pscnv_vram_free_prev(dev, cur);
-		/* if contig VO is wanted, skip too small regions */
-		if (cur->size >= size || !(flags & PSCNV_VO_CONTIG)) {
-			/* if region is untyped, we can use it but we need to
-			 * convert to typed first.
-			 */
-			/* XXX here: if we have adjacent typed and untyped
-			 * free regions, we should treat them as a single large
-			 * typed region for purposes of allocating memory.
-			 * With the current code, we'll get these blocks
-			 * allocated in sequence, but represented by two
-			 * separate regions in the region list. This kills
-			 * contig optimisations. And if asked for contig
-			 * allocation, it'll just ignore the first region.
-			 *
-			 * Fix this later.
-			 */
-			if (cur->type == PSCNV_VRAM_FREE_UNTYPED) {
-				uint64_t ssize = pscnv_roundup(size, dev_priv->vram_rblock_size);
-				if (ssize > cur->size)
-					ssize = cur->size;
-				if (ssize != cur->size) {
-					if (!lsr)
-						pscnv_vram_split_right(dev, cur, cur->size - ssize);
-					else
-						pscnv_vram_split_left(dev, cur, cur->size - ssize);
-				}
-				if (!lsr)
-					cur->type = PSCNV_VRAM_FREE_SANE;
-				else
-					cur->type = PSCNV_VRAM_FREE_LSR;
-				/* now fall through. */
-			}
-			if (cur->type == (lsr?PSCNV_VRAM_FREE_LSR:PSCNV_VRAM_FREE_SANE)) {
-				if (cur->size > size) {
-					if (lsr)
-						cur = pscnv_vram_split_right(dev, cur, size);
-					else
-						cur = pscnv_vram_split_left(dev, cur, size);
+	while (size) {
+		/* splits must not fail halfway through taking a piece */
+		if (pscnv_vram_pool_reserve(dev, PSCNV_VRAM_POOL_TAKE))
+			break;
+		/* find a free region that can hold the rest of the VO. If
+		 * there's none and the VO doesn't need to be contig, settle
+		 * for a piece of it. */
+		cur = 0;
+		newhot = 0;
+		if (flags & PSCNV_VO_HOT) {
+			cur = pscnv_vram_hot_fit(dev, size, align, lsr, &lo, &hi);
+			/* the row is full. Move on to a free one if there's
+			 * any, taking the one at the far end of its region,
+			 * out of the way of ordinary allocations. */
+			if (!cur) {
+				newhot = 1;
+				if ((cur = pscnv_vram_find_fit(dev, 2 * row, align, lsr))) {
+					lo = cur->start;
+					hi = cur->start + cur->size;
+					if (lsr) {
+						lo = pscnv_roundup(lo, row);
+						hi = lo + row;
+					} else {
+						hi = hi / row * row;
+						lo = hi - row;
+					}
+					if (ALIGN(lo, align) + size > hi) {
+						lo = cur->start;
+						hi = cur->start + cur->size;
+					}
 				}
-				cur->type = (lsr?PSCNV_VRAM_USED_LSR:PSCNV_VRAM_USED_SANE);
-				list_del(&cur->local_list);
-				if (lsr)
-					list_add(&cur->local_list, &res->regions);
-				else
-					list_add_tail(&cur->local_list, &res->regions);
-				if (pscnv_vram_debug >= 2)
-					NV_INFO (dev, "Using block at %llx-%llx\n",
-							cur->start, cur->start + cur->size);
-				if (flags & PSCNV_VO_CONTIG)
-					res->start = cur->start;
-				cur->vo = res;
-				size -= cur->size;
 			}
-			if (!size) {
-				mutex_unlock(&dev_priv->vram_mutex);
-				return res;
+		}
+		if (!cur && (cur = pscnv_vram_find_fit(dev, size, align, lsr))) {
+			lo = cur->start;
+			hi = cur->start + cur->size;
+		} else if (!cur) {
+			/* no single region will do, but a run of typed and
+			 * untyped free regions might. */
+			cur = pscnv_vram_extent_fit(dev, size, align, lsr, &lo, &hi);
+		}
+		if (!cur && !(flags & PSCNV_VO_CONTIG)) {
+			cur = pscnv_vram_find_piece(dev, piece, align, lsr);
+			/* out of whole rows, make do with what's left */
+			if (!cur && piece > align) {
+				piece = align;
+				cur = pscnv_vram_find_piece(dev, piece, align, lsr);
 			}
+			if (cur)
+				cur = pscnv_vram_extent(dev, cur, lsr, &lo, &hi);
 		}
-		cur = next;
+		if (!cur)
+			break;
+		/* keep pieces of spread VOs to whole rows */
+		want = size;
+		if (hi - ALIGN(lo, align) < want)
+			want = (hi - ALIGN(lo, align)) / piece * piece;
+		cur = pscnv_vram_take(dev, cur, lo, hi, want, align, lsr);
+		if (!cur)
+			break;
+		if (newhot)
+			dev_priv->vram_hot_row[lsr] = cur->start / row * row;
+		if (lsr)
+			list_add(&cur->local_list, &res->regions);
+		else
+			list_add_tail(&cur->local_list, &res->regions);
+		if (pscnv_vram_debug >= 2)
+			NV_INFO (dev, "Using block at %llx-%llx\n",
+					(unsigned long long)cur->start, (unsigned long long)(cur->start + cur->size));
+		if (flags & PSCNV_VO_CONTIG)
+			res->start = cur->start;
+		cur->vo = res;
+		size -= cur->size;
 	}
-	/* no free blocks. remove what we managed to alloc and fail. */
 	mutex_unlock(&dev_priv->vram_mutex);
-	pscnv_vram_free(res);
+	if (!size)
+		return res;
+	/* no free blocks. remove what we managed to alloc and fail. the
+	 * alloc was never traced, so neither is this. */
+	pscnv_vram_release(res);
+	kfree(res);
 	return 0;
 }
 
-static int
-pscnv_vram_free_region (struct drm_device *dev, struct pscnv_vram_region *reg) {
-	int lsr;
-	struct drm_nouveau_private *dev_priv = dev->dev_private;
-	struct pscnv_vram_region *next, *prev;
-	if (reg->type == PSCNV_VRAM_USED_LSR) {
-		reg->type = PSCNV_VRAM_FREE_LSR;
-		lsr = 1;
-	} else if (reg->type == PSCNV_VRAM_USED_SANE) {
-		reg->type = PSCNV_VRAM_FREE_SANE;
-		lsr = 0;
-	} else {
-		NV_ERROR (dev, "Trying to free block %llx-%llx of type %d.\n",
-				reg->start, reg->start+reg->size, reg->type);
-		return -EINVAL;
+/* 0 means page alignment. Anything else has to be a power of two, of at
+ * least a page. */
+int
+pscnv_vram_align_valid(uint64_t align)
+{
+	return !align || (align >= PSCNV_VRAM_PAGE_SIZE && is_power_of_2(align) && align < (1ULL << 40));
+}
+
+struct pscnv_vo *
+pscnv_vram_alloc(struct drm_device *dev,
+		uint64_t size, uint64_t align, int flags, int tile_flags, uint32_t cookie)
+{
+	uint64_t t0;
+	struct pscnv_vo *res = 0;
+	if (!pscnv_vram_align_valid(align)) {
+		NV_ERROR(dev, "VRAM: Bad alignment %#llx\n", (unsigned long long)align);
+		return 0;
 	}
-	mutex_lock(&dev_priv->vram_mutex);
-	if (pscnv_vram_debug >= 3)
-		NV_INFO (dev, "Freeing block %llx-%llx of type %d.\n",
-				reg->start, reg->start+reg->size, reg->type);
-	list_del(&reg->local_list);
-	next = pscnv_vram_global_next(dev, reg);
-	prev = pscnv_vram_global_prev(dev, reg);
-	/* search in both directions for the nearest free block. */
-	while (1) {
-		if (next && next->type <= PSCNV_VRAM_FREE_LSR) {
-			list_add_tail(&reg->local_list, &next->local_list);
-			break;
-		} else if (prev && prev->type <= PSCNV_VRAM_LAST_FREE) {
-			list_add(&reg->local_list, &prev->local_list);
-			break;
-		} else if (!next) {
-			list_add_tail(&reg->local_list, &dev_priv->vram_free_list);
-			break;
-		} else if (!prev) {
-			list_add(&reg->local_list, &dev_priv->vram_free_list);
-			break;
-		} else {
-			next = pscnv_vram_global_next(dev, next);
-			prev = pscnv_vram_global_prev(dev, prev);
+	t0 = pscnv_vram_trace_clock(dev);
+	if (flags & PSCNV_VO_ZERO)
+		res = pscnv_vram_scrub_take(dev, size, align, flags, tile_flags, cookie);
+	if (!res) {
+		res = pscnv_vram_do_alloc(dev, size, align, flags, tile_flags, cookie);
+		/* contig VOs can fail with plenty of free VRAM around, if it's
+		 * fragmented. Try to make some room and retry. */
+		if (!res && (flags & PSCNV_VO_CONTIG) && pscnv_vram_compact_mode != PSCNV_VRAM_COMPACT_OFF)
+			if (pscnv_vram_compact(dev))
+				res = pscnv_vram_do_alloc(dev, size, align, flags, tile_flags, cookie);
+		/* nothing zeroed in advance, do it now */
+		if (res && (flags & PSCNV_VO_ZERO) && pscnv_vram_scrub_clear(res)) {
+			pscnv_vram_release(res);
+			kfree(res);
+			res = 0;
 		}
 	}
-	reg = pscnv_vram_try_merge_adjacent (dev, reg);
-	pscnv_vram_try_untype (dev, reg);
-	mutex_unlock(&dev_priv->vram_mutex);
-	return 0;
+	pscnv_vram_trace_alloc(dev, t0, size, align, flags, tile_flags, cookie, res);
+	return res;
 }
 
 int
 pscnv_vram_free(struct pscnv_vo *vo)
 {
-	struct list_head *pos, *next;
 	struct drm_nouveau_private *dev_priv = vo->dev->dev_private;
+	uint64_t t0;
+	if (vo->slab) {
+		pscnv_vram_slab_free(vo);
+		return 0;
+	}
+	t0 = pscnv_vram_trace_clock(vo->dev);
 	if (pscnv_vram_debug >= 1)
-		NV_INFO(vo->dev, "Freeing %d, %#llx-byte %sVO of type %08x, tile_flags %x\n", vo->serial, vo->size,
+		NV_INFO(vo->dev, "Freeing %d, %#llx-byte %sVO of type %08x, tile_flags %x\n", vo->serial, (unsigned long long)vo->size,
 				(vo->flags & PSCNV_VO_CONTIG ? "contig " : ""), vo->cookie, vo->tile_flags);
-	if (dev_priv->vm && vo->map1)
-		pscnv_vspace_unmap_node(vo->map1);
-	if (dev_priv->vm && vo->map3)
-		pscnv_vspace_unmap_node(vo->map3);
-	list_for_each_safe(pos, next, &vo->regions) {
-		struct pscnv_vram_region *reg = list_entry(pos, struct pscnv_vram_region, local_list);
-		pscnv_vram_free_region (vo->dev, reg);
-	}
+	pscnv_vram_release(vo);
+	pscnv_vram_trace_free(vo, t0);
 	kfree (vo);
+	pscnv_vram_compact_kick(dev_priv->dev);
 	return 0;
 }
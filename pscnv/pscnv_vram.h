@@ -27,16 +27,46 @@
 #ifndef __PSCNV_VRAM_H__
 #define __PSCNV_VRAM_H__
 
+#include "pscnv_tree.h"
+
 #define PSCNV_VRAM_PAGE_SIZE 0x1000
+#define PSCNV_VRAM_PAGE_SHIFT 12
+
+/* VRAM at the bottom and top of the card kept out of the allocator */
+#define PSCNV_VRAM_RSVD_HEAD 0x40000
+#define PSCNV_VRAM_RSVD_TAIL 0x2000
+
+/* number of size classes for free regions: class n holds regions of
+ * [2^n, 2^(n+1)) pages. VOs are limited to 1 << 40 bytes. */
+#define PSCNV_VRAM_BUCKETS 28
+
+/* region descriptor pool: refilled to POOL_LOW outside vram_mutex, trimmed
+ * to POOL_HIGH. Taking a piece of a VO needs at most POOL_TAKE descriptors,
+ * freeing a region at most POOL_FREE. */
+#define PSCNV_VRAM_POOL_LOW	32
+#define PSCNV_VRAM_POOL_HIGH	256
+#define PSCNV_VRAM_POOL_TAKE	4
+#define PSCNV_VRAM_POOL_FREE	2
+
+/* compaction modes, selected by the vram_compact module parameter */
+#define PSCNV_VRAM_COMPACT_OFF		0
+#define PSCNV_VRAM_COMPACT_ON_FAIL	1	/* when a contig alloc fails */
+#define PSCNV_VRAM_COMPACT_BACKGROUND	2	/* also from a worker after frees */
+
+/* placement policies, selected by the vram_policy module parameter */
+#define PSCNV_VRAM_POLICY_FIRST_FIT	0	/* sane from the bottom, LSR from the top */
+#define PSCNV_VRAM_POLICY_SIZE_CLASS	1	/* smallest size class that fits */
 
 /* A VRAM object of any kind. */
 struct pscnv_vo {
 	struct drm_device *dev;
-	/* size. Always a multiple of page size. */
+	/* size. Always a multiple of page size, except for slab VOs. */
 	uint64_t size;
 	/* misc flags, see below. */
 	int flags;
 	int tile_flags;
+	/* alignment of the start of every region, power of two */
+	uint64_t align;
 	/* cookie: free-form 32-bit number displayed in debug info. */
 	uint32_t cookie;
 	/* only used for debug */
@@ -51,17 +81,44 @@ struct pscnv_vo {
 	struct drm_gem_object *gem;
 	struct pscnv_vm_mapnode *map1;
 	struct pscnv_vm_mapnode *map3;
+	/* link in the BAR1 LRU while map1 is an mmap window, protected by
+	 * bar1_mutex */
+	struct list_head bar1_lru;
+	/* mmap offset is mmap_id << 32, 0 for VOs userspace can't map */
+	uint32_t mmap_id;
+	/* host copy of a PSCNV_VO_MAP_CACHED VO, what mmap gives */
+	void *staging;
+	/* all vspace mappings of this VO, linked by vo_list. maps_lock also
+	 * keeps the VO in place while it's held. */
+	struct list_head maps;
+	struct mutex maps_lock;
+	/* nonzero if the VO must not be moved by compaction */
+	int pinned;
+	/* slab chunk this VO was carved from, or NULL for ordinary VOs */
+	struct pscnv_vram_slab_chunk *slab;
 };
 
 /* the VO flags */
 #define PSCNV_VO_CONTIG		0x00000001	/* VO needs to be contiguous in VRAM */
+#define PSCNV_VO_SPREAD		0x00000008	/* made of whole rows, for bandwidth */
+#define PSCNV_VO_HOT		0x00000010	/* shares a row with other hot VOs */
+#define PSCNV_VO_ZERO		0x00000020	/* starts out zeroed */
+#define PSCNV_VO_MAP_MASK	0x00000300	/* host mmap caching mode */
+#define PSCNV_VO_MAP_WC		0x00000000
+#define PSCNV_VO_MAP_UC		0x00000100
+#define PSCNV_VO_MAP_CACHED	0x00000200	/* mmapped through staging */
 
 /* a contiguous VRAM region. They're linked into two lists: global list of
- * all regions and local list of regions within a single VO or free list.
+ * all regions and local list of regions within a single VO or, for free
+ * regions, the size class list. Free regions are additionally kept in
+ * an address-ordered tree, one per free type.
  */
 struct pscnv_vram_region {
 	struct list_head global_list;
 	struct list_head local_list;
+	PSCNV_RB_ENTRY(pscnv_vram_region) entry;
+	/* largest free region in this subtree */
+	uint64_t maxsize;
 	/* VRAM is split into so-called rblocks. Pages can be sane or LSR.
 	 * you cannot have both sane and LSR pages in a single rblock.
 	 * So an rblock can be in one of three states - UNTYPED when no
@@ -82,10 +139,91 @@ struct pscnv_vram_region {
 	struct pscnv_vo *vo;
 };
 
+PSCNV_RB_HEAD(pscnv_vram_freetree, pscnv_vram_region);
+
 extern int pscnv_vram_init(struct drm_device *);
 extern int pscnv_vram_takedown(struct drm_device *);
 extern struct pscnv_vo *pscnv_vram_alloc(struct drm_device *,
-		uint64_t size, int flags, int tile_flags, uint32_t cookie);
+		uint64_t size, uint64_t align, int flags, int tile_flags, uint32_t cookie);
 extern int pscnv_vram_free(struct pscnv_vo *);
+extern int pscnv_vram_align_valid(uint64_t align);
+
+/* backend used to copy VRAM contents when compacting, see pscnv_compact.c */
+struct pscnv_vram_mover {
+	const char *name;
+	/* copies size bytes from src to dst. All page aligned. */
+	int (*copy) (struct drm_device *dev, uint64_t dst, uint64_t src, uint64_t size);
+	/* zeroes size bytes at dst. Page aligned too. */
+	int (*clear) (struct drm_device *dev, uint64_t dst, uint64_t size);
+};
+
+extern struct pscnv_vram_mover pscnv_vram_cpu_mover;
+
+extern void pscnv_vram_compact_init(struct drm_device *);
+extern void pscnv_vram_compact_takedown(struct drm_device *);
+extern int pscnv_vram_compact(struct drm_device *);
+extern void pscnv_vram_compact_kick(struct drm_device *);
+
+/* allocation tracing, see pscnv_vram_trace.c */
+extern void pscnv_vram_trace_init(struct drm_device *);
+extern void pscnv_vram_trace_takedown(struct drm_device *);
+extern uint64_t pscnv_vram_trace_clock(struct drm_device *);
+extern void pscnv_vram_trace_alloc(struct drm_device *, uint64_t t0, uint64_t size,
+		uint64_t align, int flags, int tile_flags, uint32_t cookie, struct pscnv_vo *res);
+extern void pscnv_vram_trace_free(struct pscnv_vo *, uint64_t t0);
+extern void pscnv_vram_trace_move(struct pscnv_vo *vo, struct pscnv_vo *tmp);
+
+/* pools of pre-zeroed VOs, see pscnv_scrub.c. Kept for up to SCRUB_CLASSES
+ * distinct allocation shapes, each at most SCRUB_DEPTH VOs deep. */
+#define PSCNV_VRAM_SCRUB_CLASSES	4
+#define PSCNV_VRAM_SCRUB_DEPTH		8
+
+struct pscnv_vram_scrub_class {
+	uint64_t size;
+	uint64_t align;
+	int flags;
+	int tile_flags;
+	uint32_t cookie;
+	int count;
+	struct pscnv_vo *vos[PSCNV_VRAM_SCRUB_DEPTH];
+	/* how long each of them took to clear */
+	uint64_t ns[PSCNV_VRAM_SCRUB_DEPTH];
+};
+
+extern void pscnv_vram_scrub_init(struct drm_device *);
+extern void pscnv_vram_scrub_takedown(struct drm_device *);
+extern struct pscnv_vo *pscnv_vram_scrub_take(struct drm_device *,
+		uint64_t size, uint64_t align, int flags, int tile_flags, uint32_t cookie);
+extern int pscnv_vram_scrub_clear(struct pscnv_vo *);
+
+/* slab suballocator for small kernel VOs, see pscnv_slab.c */
+#define PSCNV_VRAM_SLAB_CHUNK 0x1000
+
+struct pscnv_vram_slab {
+	struct drm_device *dev;
+	struct mutex lock;
+	uint32_t objsize;
+	/* cookie of the backing chunk VOs */
+	uint32_t cookie;
+	int chunk_objs;
+	/* chunks with free slots first, full chunks at the tail */
+	struct list_head chunks;
+	int nempty;
+};
+
+struct pscnv_vram_slab_chunk {
+	struct list_head list;
+	struct pscnv_vram_slab *slab;
+	struct pscnv_vo *vo;
+	int nused;
+	unsigned long used[0];
+};
+
+extern struct pscnv_vram_slab *pscnv_vram_slab_new(struct drm_device *,
+		uint32_t objsize, uint32_t cookie);
+extern void pscnv_vram_slab_destroy(struct pscnv_vram_slab *);
+extern struct pscnv_vo *pscnv_vram_slab_alloc(struct pscnv_vram_slab *,
+		uint32_t cookie);
+extern void pscnv_vram_slab_free(struct pscnv_vo *);
 
 #endif
@@ -0,0 +1,239 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * Copyright 2010 PathScale Inc.  All rights reserved.
+ * Use is subject to license terms.
+ */
+
+#include "drmP.h"
+#include "drm.h"
+#include "nouveau_drv.h"
+#include "pscnv_vram.h"
+#include "pscnv_vram_trace.h"
+#include <linux/kernel.h>
+#include <linux/ktime.h>
+#include <linux/vmalloc.h>
+#include <linux/debugfs.h>
+#include <linux/fs.h>
+
+/* Every pscnv_vram_alloc and pscnv_vram_free call is appended to a ring of
+ * vram_trace records, under a spinlock. With the module parameter left at
+ * 0, the ring isn't allocated and tracing costs a pointer test per call.
+ * The ring is exported through debugfs in the format described in
+ * pscnv_vram_trace.h, test/vram_replay.c can replay it.
+ */
+
+static uint64_t
+pscnv_vram_trace_now (struct drm_device *dev)
+{
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	return ktime_to_ns(ktime_get()) - dev_priv->vram_trace_epoch;
+}
+
+/* start time of a traced call, 0 if tracing is off */
+uint64_t
+pscnv_vram_trace_clock (struct drm_device *dev)
+{
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	if (!dev_priv->vram_trace)
+		return 0;
+	return pscnv_vram_trace_now(dev);
+}
+
+static void
+pscnv_vram_trace_put (struct drm_device *dev, struct pscnv_vram_trace_rec *rec, uint64_t t0)
+{
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	uint64_t lat = pscnv_vram_trace_now(dev) - t0;
+	rec->time = t0;
+	rec->latency = min(lat, (uint64_t)0xffffffff);
+	spin_lock(&dev_priv->vram_trace_lock);
+	dev_priv->vram_trace[dev_priv->vram_trace_count++ % dev_priv->vram_trace_size] = *rec;
+	spin_unlock(&dev_priv->vram_trace_lock);
+}
+
+void
+pscnv_vram_trace_alloc (struct drm_device *dev, uint64_t t0, uint64_t size, uint64_t align,
+		int flags, int tile_flags, uint32_t cookie, struct pscnv_vo *res)
+{
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	struct pscnv_vram_trace_rec rec = { 0 };
+	struct pscnv_vram_region *reg;
+	if (!dev_priv->vram_trace)
+		return;
+	rec.op = PSCNV_VRAM_TRACE_ALLOC;
+	rec.size = size;
+	rec.align = align;
+	rec.flags = flags;
+	rec.tile_flags = tile_flags;
+	rec.cookie = cookie;
+	rec.serial = ~0;
+	rec.start = ~0ull;
+	if (res) {
+		reg = list_first_entry(&res->regions, struct pscnv_vram_region, local_list);
+		rec.serial = res->serial;
+		rec.start = reg->start;
+	}
+	pscnv_vram_trace_put(dev, &rec, t0);
+}
+
+static void
+pscnv_vram_trace_vo (struct pscnv_vram_trace_rec *rec, struct pscnv_vo *vo)
+{
+	rec->size = vo->size;
+	rec->align = vo->align;
+	rec->flags = vo->flags;
+	rec->tile_flags = vo->tile_flags;
+	rec->cookie = vo->cookie;
+	rec->serial = vo->serial;
+}
+
+/* called once vo's regions are freed, but before vo itself is */
+void
+pscnv_vram_trace_free (struct pscnv_vo *vo, uint64_t t0)
+{
+	struct drm_nouveau_private *dev_priv = vo->dev->dev_private;
+	struct pscnv_vram_trace_rec rec = { 0 };
+	if (!dev_priv->vram_trace)
+		return;
+	rec.op = PSCNV_VRAM_TRACE_FREE;
+	pscnv_vram_trace_vo(&rec, vo);
+	pscnv_vram_trace_put(vo->dev, &rec, t0);
+}
+
+/* called after compaction swapped regions of vo and tmp */
+void
+pscnv_vram_trace_move (struct pscnv_vo *vo, struct pscnv_vo *tmp)
+{
+	struct drm_nouveau_private *dev_priv = vo->dev->dev_private;
+	struct pscnv_vram_trace_rec rec = { 0 };
+	struct pscnv_vram_region *reg;
+	if (!dev_priv->vram_trace)
+		return;
+	rec.op = PSCNV_VRAM_TRACE_MOVE;
+	pscnv_vram_trace_vo(&rec, vo);
+	reg = list_first_entry(&vo->regions, struct pscnv_vram_region, local_list);
+	rec.start = reg->start;
+	rec.aux = tmp->serial;
+	pscnv_vram_trace_put(vo->dev, &rec, pscnv_vram_trace_now(vo->dev));
+}
+
+/* the debugfs file: open takes a snapshot of the ring, reads return it. */
+struct pscnv_vram_trace_snap {
+	size_t len;
+	char data[0];
+};
+
+static int
+pscnv_vram_trace_open (struct inode *inode, struct file *filp)
+{
+	struct drm_device *dev = inode->i_private;
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	struct pscnv_vram_trace_header *hdr;
+	struct pscnv_vram_trace_rec *recs;
+	struct pscnv_vram_trace_snap *snap;
+	uint64_t first, i;
+	snap = vmalloc(sizeof *snap + sizeof *hdr + dev_priv->vram_trace_size * sizeof *recs);
+	if (!snap)
+		return -ENOMEM;
+	hdr = (void *)snap->data;
+	recs = (void *)(hdr + 1);
+	memset(hdr, 0, sizeof *hdr);
+	hdr->magic = PSCNV_VRAM_TRACE_MAGIC;
+	hdr->version = PSCNV_VRAM_TRACE_VERSION;
+	hdr->rec_size = sizeof *recs;
+	hdr->vram_size = dev_priv->vram_size;
+	hdr->rblock_size = dev_priv->vram_rblock_size;
+	hdr->policy = pscnv_vram_policy;
+	spin_lock(&dev_priv->vram_trace_lock);
+	first = 0;
+	if (dev_priv->vram_trace_count > dev_priv->vram_trace_size)
+		first = dev_priv->vram_trace_count - dev_priv->vram_trace_size;
+	for (i = first; i < dev_priv->vram_trace_count; i++)
+		recs[i - first] = dev_priv->vram_trace[i % dev_priv->vram_trace_size];
+	hdr->nrecs = dev_priv->vram_trace_count - first;
+	hdr->dropped = first;
+	spin_unlock(&dev_priv->vram_trace_lock);
+	snap->len = sizeof *hdr + hdr->nrecs * sizeof *recs;
+	filp->private_data = snap;
+	return 0;
+}
+
+static ssize_t
+pscnv_vram_trace_read (struct file *filp, char __user *buf, size_t count, loff_t *ppos)
+{
+	struct pscnv_vram_trace_snap *snap = filp->private_data;
+	return simple_read_from_buffer(buf, count, ppos, snap->data, snap->len);
+}
+
+static int
+pscnv_vram_trace_release (struct inode *inode, struct file *filp)
+{
+	vfree(filp->private_data);
+	return 0;
+}
+
+static const struct file_operations pscnv_vram_trace_fops = {
+	.owner = THIS_MODULE,
+	.open = pscnv_vram_trace_open,
+	.read = pscnv_vram_trace_read,
+	.release = pscnv_vram_trace_release,
+};
+
+void
+pscnv_vram_trace_init (struct drm_device *dev)
+{
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	spin_lock_init(&dev_priv->vram_trace_lock);
+	dev_priv->vram_trace_count = 0;
+	dev_priv->vram_trace_size = 0;
+	dev_priv->vram_trace = 0;
+	if (pscnv_vram_trace_records <= 0)
+		return;
+	dev_priv->vram_trace = vmalloc(pscnv_vram_trace_records * sizeof *dev_priv->vram_trace);
+	if (!dev_priv->vram_trace) {
+		NV_ERROR(dev, "VRAM: Couldn't allocate trace ring of %d records\n", pscnv_vram_trace_records);
+		return;
+	}
+	dev_priv->vram_trace_size = pscnv_vram_trace_records;
+	dev_priv->vram_trace_epoch = ktime_to_ns(ktime_get());
+#if defined(CONFIG_DEBUG_FS)
+	dev_priv->vram_trace_dentry = debugfs_create_file("vram_trace", S_IRUSR,
+			dev->primary->debugfs_root, dev, &pscnv_vram_trace_fops);
+	if (IS_ERR(dev_priv->vram_trace_dentry))
+		dev_priv->vram_trace_dentry = 0;
+#endif
+	NV_INFO(dev, "VRAM: Tracing last %d allocator calls\n", pscnv_vram_trace_records);
+}
+
+void
+pscnv_vram_trace_takedown (struct drm_device *dev)
+{
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+#if defined(CONFIG_DEBUG_FS)
+	if (dev_priv->vram_trace_dentry)
+		debugfs_remove(dev_priv->vram_trace_dentry);
+	dev_priv->vram_trace_dentry = 0;
+#endif
+	vfree(dev_priv->vram_trace);
+	dev_priv->vram_trace = 0;
+}
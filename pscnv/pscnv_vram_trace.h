@@ -0,0 +1,86 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * Copyright 2010 PathScale Inc.  All rights reserved.
+ * Use is subject to license terms.
+ */
+
+#ifndef __PSCNV_VRAM_TRACE_H__
+#define __PSCNV_VRAM_TRACE_H__
+
+/* VRAM allocation trace format. Shared with userspace tools, so only
+ * fixed-size types here.
+ *
+ * A trace is a struct pscnv_vram_trace_header followed by nrecs records
+ * of rec_size bytes each, oldest first. Everything is in host byte order.
+ * Readers should check magic and version, and skip any bytes past
+ * sizeof(struct pscnv_vram_trace_rec) in a record if rec_size is larger.
+ *
+ * The kernel keeps the last vram_trace records in a ring and exports a
+ * snapshot of it as the vram_trace debugfs file. If the ring wrapped,
+ * dropped says how many records were lost from the start.
+ */
+
+#define PSCNV_VRAM_TRACE_MAGIC		0x54565350	/* "PSVT" */
+#define PSCNV_VRAM_TRACE_VERSION	1
+
+struct pscnv_vram_trace_header {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t rec_size;
+	uint64_t vram_size;
+	uint32_t rblock_size;
+	/* vram_policy at the time of the snapshot */
+	uint32_t policy;
+	uint64_t nrecs;
+	uint64_t dropped;
+};
+
+/* record ops */
+#define PSCNV_VRAM_TRACE_ALLOC	1
+#define PSCNV_VRAM_TRACE_FREE	2
+/* compaction moved VO serial into the regions of VO aux, and aux took
+ * over the old ones. aux is freed right after. */
+#define PSCNV_VRAM_TRACE_MOVE	3
+
+struct pscnv_vram_trace_rec {
+	/* ns since the trace was set up */
+	uint64_t time;
+	/* for ALLOC, as requested. For FREE and MOVE, of the VO. */
+	uint64_t size;
+	uint64_t align;
+	/* ALLOC and MOVE: address of the first region of the VO, ~0 if the
+	 * alloc failed. 0 for FREE. */
+	uint64_t start;
+	uint32_t op;
+	/* VO serial, ~0 if the alloc failed */
+	uint32_t serial;
+	uint32_t aux;
+	uint32_t flags;
+	uint32_t tile_flags;
+	uint32_t cookie;
+	/* ns spent in the call, saturated */
+	uint32_t latency;
+	uint32_t pad;
+};
+
+#endif
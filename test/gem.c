@@ -52,7 +52,7 @@ main()
 	user[0] = 0xdeadbeef;
 	user[1] = 0xcafebabe;
 
-	ret = pscnv_gem_new(fd, 0xc071e, 0, 0x70, 0x1234, user, &handle, &map_handle);
+	ret = pscnv_gem_new_aligned(fd, 0xc071e, 0, 0x70, 0x1234, 0x10000, user, &handle, &map_handle);
 	if (ret) {
 		printf("new: failed ret = %d\n", ret);
 		return 1;
@@ -0,0 +1,126 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * Copyright 2010 PathScale Inc.  All rights reserved.
+ * Use is subject to license terms.
+ */
+
+/* Measures host write and read bandwidth to a BO mmapped in each caching
+ * mode. For the cached mode, the gem_sync copies are timed too. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <xf86drm.h>
+#include "libpscnv.h"
+
+static double
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int
+bench(int fd, uint64_t size, uint32_t mode, const char *name)
+{
+	volatile uint64_t *map;
+	uint64_t map_handle, i, sum = 0;
+	uint32_t handle;
+	double t0, tw, tr, ts = 0;
+	int ret;
+
+	ret = pscnv_gem_new(fd, 0xba4d, PSCNV_GEM_MAPPABLE | mode, 0, size, 0, &handle, &map_handle);
+	if (ret) {
+		printf("%s: new failed ret = %d\n", name, ret);
+		return 1;
+	}
+	map = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, map_handle);
+	if (map == MAP_FAILED) {
+		printf("%s: mmap failed\n", name);
+		return 1;
+	}
+
+	/* fault it all in first */
+	for (i = 0; i < size / 8; i += 0x1000 / 8)
+		map[i] = 0;
+
+	t0 = now();
+	for (i = 0; i < size / 8; i++)
+		map[i] = i;
+	if (mode == PSCNV_GEM_MAP_CACHED) {
+		tw = now();
+		ret = pscnv_gem_sync(fd, handle, PSCNV_GEM_SYNC_TO_VRAM);
+		ts += now() - tw;
+	}
+	tw = now() - t0;
+
+	t0 = now();
+	if (!ret && mode == PSCNV_GEM_MAP_CACHED) {
+		ret = pscnv_gem_sync(fd, handle, PSCNV_GEM_SYNC_FROM_VRAM);
+		ts += now() - t0;
+	}
+	for (i = 0; i < size / 8; i++)
+		sum += map[i];
+	tr = now() - t0;
+	if (ret) {
+		printf("%s: sync failed ret = %d\n", name, ret);
+		return 1;
+	}
+	if (sum != size / 8 * (size / 8 - 1) / 2)
+		printf("%s: read back wrong data\n", name);
+
+	printf("%s: write %.1f MB/s, read %.1f MB/s", name, size / tw / 1e6, size / tr / 1e6);
+	if (mode == PSCNV_GEM_MAP_CACHED)
+		printf(", %.3f ms of that in sync", ts * 1e3);
+	printf("\n");
+
+	munmap((void *)map, size);
+	pscnv_gem_close(fd, handle);
+	return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+	int fd;
+	uint64_t size = (argc > 1 ? strtoull(argv[1], 0, 0) : 64) << 20;
+
+	fd = drmOpen("pscnv", 0);
+	if (fd == -1)
+		return 1;
+
+	if (bench(fd, size, PSCNV_GEM_MAP_WC, "wc"))
+		return 1;
+	if (bench(fd, size, PSCNV_GEM_MAP_UC, "uc"))
+		return 1;
+	if (bench(fd, size, PSCNV_GEM_MAP_CACHED, "cached"))
+		return 1;
+
+	close(fd);
+	return 0;
+}
@@ -0,0 +1,127 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * Copyright 2010 PathScale Inc.  All rights reserved.
+ * Use is subject to license terms.
+ */
+
+/* Maps a bunch of BOs into a vspace one ioctl at a time, then all at once
+ * with the batch ioctl, and compares the time taken. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <xf86drm.h>
+#include "libpscnv.h"
+
+static double
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int
+main(int argc, char **argv)
+{
+	int fd, ret, i, n = argc > 1 ? atoi(argv[1]) : 1000;
+	uint32_t vid, *handles;
+	uint64_t *offsets;
+	int32_t *results;
+	struct pscnv_vspace_map_req *reqs;
+	double t0;
+
+	fd = drmOpen("pscnv", 0);
+	if (fd == -1)
+		return 1;
+	handles = calloc(n, sizeof *handles);
+	offsets = calloc(n, sizeof *offsets);
+	results = calloc(n, sizeof *results);
+	reqs = calloc(n, sizeof *reqs);
+	if (!handles || !offsets || !results || !reqs)
+		return 1;
+
+	ret = pscnv_vspace_new(fd, &vid);
+	if (ret) {
+		printf("vspace_new: failed ret = %d\n", ret);
+		return 1;
+	}
+	for (i = 0; i < n; i++) {
+		ret = pscnv_gem_new(fd, 0xba7c4, 0, 0, 0x1000, 0, &handles[i], 0);
+		if (ret) {
+			printf("new: failed ret = %d\n", ret);
+			return 1;
+		}
+	}
+
+	t0 = now();
+	for (i = 0; i < n; i++) {
+		ret = pscnv_vspace_map(fd, vid, handles[i], 0x20000000, 1ull << 32, 0, 0, &offsets[i]);
+		if (ret) {
+			printf("map %d: failed ret = %d\n", i, ret);
+			return 1;
+		}
+	}
+	printf("%d single maps: %.3f ms\n", n, (now() - t0) * 1e3);
+	for (i = 0; i < n; i++)
+		pscnv_vspace_unmap(fd, vid, offsets[i]);
+
+	for (i = 0; i < n; i++) {
+		reqs[i].handle = handles[i];
+		reqs[i].start = 0x20000000;
+		reqs[i].end = 1ull << 32;
+	}
+	t0 = now();
+	ret = pscnv_vspace_map_batch(fd, vid, reqs, n);
+	printf("%d batched maps: %.3f ms\n", n, (now() - t0) * 1e3);
+	if (ret) {
+		printf("map_batch: failed ret = %d\n", ret);
+		return 1;
+	}
+	for (i = 0; i < n; i++) {
+		if (reqs[i].result) {
+			printf("map_batch %d: failed ret = %d\n", i, reqs[i].result);
+			return 1;
+		}
+		offsets[i] = reqs[i].offset;
+	}
+
+	t0 = now();
+	ret = pscnv_vspace_unmap_batch(fd, vid, offsets, results, n);
+	printf("%d batched unmaps: %.3f ms\n", n, (now() - t0) * 1e3);
+	if (ret) {
+		printf("unmap_batch: failed ret = %d\n", ret);
+		return 1;
+	}
+	for (i = 0; i < n; i++)
+		if (results[i]) {
+			printf("unmap_batch %d: failed ret = %d\n", i, results[i]);
+			return 1;
+		}
+
+	pscnv_vspace_free(fd, vid);
+	close(fd);
+	return 0;
+}
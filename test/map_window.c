@@ -0,0 +1,115 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * Copyright 2010 PathScale Inc.  All rights reserved.
+ * Use is subject to license terms.
+ */
+
+/* Maps a window of a big BO and slides it along, once by remapping and
+ * once by unmapping and mapping again at the new offset, and compares the
+ * time taken. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <xf86drm.h>
+#include "libpscnv.h"
+
+static double
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int
+main(int argc, char **argv)
+{
+	uint64_t size = (argc > 1 ? atoll(argv[1]) : 256) << 20;
+	uint64_t window = (argc > 2 ? atoll(argv[2]) : 16) << 20;
+	uint64_t step = window / 4, off, offset;
+	uint32_t vid, handle;
+	int fd, ret, n = 0;
+	double t0;
+
+	fd = drmOpen("pscnv", 0);
+	if (fd == -1)
+		return 1;
+
+	ret = pscnv_vspace_new(fd, &vid);
+	if (ret) {
+		printf("vspace_new: failed ret = %d\n", ret);
+		return 1;
+	}
+	ret = pscnv_gem_new(fd, 0xa1d0, 0, 0, size, 0, &handle, 0);
+	if (ret) {
+		printf("new: failed ret = %d\n", ret);
+		return 1;
+	}
+
+	/* a window past the end of the BO has to be refused */
+	ret = pscnv_vspace_map_range(fd, vid, handle, size - step, window, 0x20000000, 1ull << 32, 0, 0, &offset);
+	if (!ret) {
+		printf("map_range: window past the end mapped\n");
+		return 1;
+	}
+
+	ret = pscnv_vspace_map_range(fd, vid, handle, 0, window, 0x20000000, 1ull << 32, 0, 0, &offset);
+	if (ret) {
+		printf("map_range: failed ret = %d\n", ret);
+		return 1;
+	}
+	t0 = now();
+	for (off = step; off + window <= size; off += step, n++) {
+		ret = pscnv_vspace_remap(fd, vid, offset, off);
+		if (ret) {
+			printf("remap to %#llx: failed ret = %d\n", (unsigned long long)off, ret);
+			return 1;
+		}
+	}
+	printf("%d remaps of %lld MiB: %.3f ms\n", n, (long long)(window >> 20), (now() - t0) * 1e3);
+	if (!pscnv_vspace_remap(fd, vid, offset, size - step)) {
+		printf("remap: window past the end mapped\n");
+		return 1;
+	}
+	pscnv_vspace_unmap(fd, vid, offset);
+
+	n = 0;
+	t0 = now();
+	for (off = step; off + window <= size; off += step, n++) {
+		ret = pscnv_vspace_map_range(fd, vid, handle, off, window, 0x20000000, 1ull << 32, 0, 0, &offset);
+		if (ret) {
+			printf("map_range at %#llx: failed ret = %d\n", (unsigned long long)off, ret);
+			return 1;
+		}
+		pscnv_vspace_unmap(fd, vid, offset);
+	}
+	printf("%d unmaps and maps of %lld MiB: %.3f ms\n", n, (long long)(window >> 20), (now() - t0) * 1e3);
+
+	pscnv_gem_close(fd, handle);
+	pscnv_vspace_free(fd, vid);
+	close(fd);
+	return 0;
+}
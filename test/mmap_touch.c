@@ -0,0 +1,100 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * Copyright 2010 PathScale Inc.  All rights reserved.
+ * Use is subject to license terms.
+ */
+
+/* Times mmap of a big BO plus touching it, once touching a page every
+ * stride bytes (sparse) and once touching every page (dense). Run it with
+ * a few values of the mmap_prefault module parameter to compare. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <xf86drm.h>
+#include "libpscnv.h"
+
+static double
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int
+touch(int fd, uint64_t map_handle, uint64_t size, uint64_t stride, const char *name)
+{
+	volatile uint32_t *map;
+	uint64_t i, n = 0;
+	double t0, t1, t2;
+
+	t0 = now();
+	map = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, map_handle);
+	if (map == MAP_FAILED) {
+		printf("mmap: failed\n");
+		return 1;
+	}
+	t1 = now();
+	for (i = 0; i < size; i += stride, n++)
+		map[i / 4] = i;
+	t2 = now();
+	printf("%s: mmap %.3f ms, %lld touches %.3f ms, %.3f us each\n", name,
+			(t1 - t0) * 1e3, (long long)n, (t2 - t1) * 1e3, (t2 - t1) * 1e6 / n);
+	munmap((void *)map, size);
+	return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+	int fd, ret;
+	uint64_t size = (argc > 1 ? strtoull(argv[1], 0, 0) : 256) << 20;
+	uint64_t stride = argc > 2 ? strtoull(argv[2], 0, 0) : 1 << 20;
+	uint64_t map_handle;
+	uint32_t handle;
+
+	fd = drmOpen("pscnv", 0);
+	if (fd == -1)
+		return 1;
+
+	ret = pscnv_gem_new(fd, 0x3370c, PSCNV_GEM_MAPPABLE, 0, size, 0, &handle, &map_handle);
+	if (ret) {
+		printf("new: failed ret = %d\n", ret);
+		return 1;
+	}
+
+	/* the BAR1 window made in the first run stays for the second, only
+	 * the host PTEs go away with munmap */
+	if (touch(fd, map_handle, size, stride, "sparse"))
+		return 1;
+	if (touch(fd, map_handle, size, 0x1000, "dense"))
+		return 1;
+
+	pscnv_gem_close(fd, handle);
+	close(fd);
+	return 0;
+}
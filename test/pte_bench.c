@@ -0,0 +1,190 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * Copyright 2010 PathScale Inc.  All rights reserved.
+ * Use is subject to license terms.
+ */
+
+/* Compares the two ways of filling NV50 page tables through BAR3 on a fake
+ * BAR: one nv_wv32 pair per PTE, as done before, and PTEs staged in a
+ * host buffer and pushed out with one memcpy_toio per batch, as
+ * nv50_vspace_do_map does now.
+ *
+ * usage: pte_bench [-s map size in MiB] [-d ns per bus write] [-w]
+ *
+ * The fake BAR is plain memory. Every bus write to it is charged -d ns of
+ * busy waiting, to stand in for an uncached write over PCIe. memcpy_toio
+ * on an uncached mapping moves 8 bytes per bus write; -w instead charges
+ * one bus write per 64 bytes, as a write-combined mapping would.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#define SPAGE_SIZE	0x1000
+#define PTE_BATCH	512	/* NV50_VM_PTE_BATCH */
+
+static uint32_t *bar;
+static int bus_ns = 100;
+static int wc;
+static uint64_t bus_writes, calls;
+
+static uint64_t
+now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void
+bus_write(uint64_t n)
+{
+	uint64_t end;
+	bus_writes += n;
+	if (!bus_ns)
+		return;
+	end = now_ns() + n * bus_ns;
+	while (now_ns() < end);
+}
+
+/* the fake BAR accessors. noinline, like the real ones behind a call. */
+static __attribute__((noinline)) void
+fake_iowrite32(uint32_t val, volatile uint32_t *p)
+{
+	calls++;
+	*p = val;
+	bus_write(1);
+}
+
+static __attribute__((noinline)) void
+fake_memcpy_toio(volatile void *dst, const void *src, size_t len)
+{
+	calls++;
+	memcpy((void *)dst, src, len);
+	bus_write(wc ? (len + 63) / 64 : (len + 7) / 8);
+}
+
+/* a stand-in for the parts of a VO nv_wv32 looks at */
+struct fake_vo {
+	uint64_t start;
+	int mapped;
+	uint64_t bar_offset;
+};
+
+static void
+fake_wv32(struct fake_vo *vo, unsigned offset, uint32_t val)
+{
+	if (vo->mapped)
+		fake_iowrite32(val, bar + (vo->bar_offset + offset) / 4);
+}
+
+static void
+map_old(struct fake_vo *pt, uint64_t phys, uint64_t npages)
+{
+	uint64_t i, pte;
+	for (i = 0; i < npages; i++) {
+		pte = (phys + i * SPAGE_SIZE) | 1;
+		fake_wv32(pt, i * 8 + 4, pte >> 32);
+		fake_wv32(pt, i * 8, pte);
+	}
+}
+
+static void
+map_batched(struct fake_vo *pt, uint64_t phys, uint64_t npages)
+{
+	static uint32_t batch[PTE_BATCH * 2];
+	uint64_t i, pte, start = 0;
+	int count = 0;
+	for (i = 0; i < npages; i++) {
+		if (count == PTE_BATCH) {
+			fake_memcpy_toio(bar + (pt->bar_offset + start * 8) / 4, batch, count * 8);
+			count = 0;
+		}
+		if (!count)
+			start = i;
+		pte = (phys + i * SPAGE_SIZE) | 1;
+		batch[count * 2] = pte;
+		batch[count * 2 + 1] = pte >> 32;
+		count++;
+	}
+	if (count)
+		fake_memcpy_toio(bar + (pt->bar_offset + start * 8) / 4, batch, count * 8);
+}
+
+static void
+run(const char *name, void (*fn)(struct fake_vo *, uint64_t, uint64_t), struct fake_vo *pt, uint64_t npages)
+{
+	uint64_t t0;
+	bus_writes = calls = 0;
+	memset(bar, 0, npages * 8);
+	t0 = now_ns();
+	fn(pt, 0x12340000, npages);
+	printf("%-8s %8.3f ms %10llu accessor calls %10llu bus writes\n", name,
+			(now_ns() - t0) / 1e6, (unsigned long long)calls,
+			(unsigned long long)bus_writes);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct fake_vo pt = { 0x100000, 1, 0 };
+	uint64_t size = 1024, npages, i;
+	uint32_t *ref;
+	int c;
+	while ((c = getopt(argc, argv, "s:d:w")) != -1)
+		switch (c) {
+		case 's':
+			size = strtoull(optarg, 0, 0);
+			break;
+		case 'd':
+			bus_ns = atoi(optarg);
+			break;
+		case 'w':
+			wc = 1;
+			break;
+		default:
+			fprintf(stderr, "usage: pte_bench [-s MiB] [-d ns] [-w]\n");
+			return 1;
+		}
+	npages = size * 0x100000 / SPAGE_SIZE;
+	bar = malloc(npages * 8);
+	ref = malloc(npages * 8);
+	if (!bar || !ref)
+		return 1;
+	printf("mapping %llu MiB with small pages, %d ns per bus write%s\n",
+			(unsigned long long)size, bus_ns, wc ? ", write-combined" : "");
+
+	run("per-PTE", map_old, &pt, npages);
+	memcpy(ref, bar, npages * 8);
+	run("batched", map_batched, &pt, npages);
+	for (i = 0; i < npages * 2; i++)
+		if (bar[i] != ref[i]) {
+			printf("page tables differ at word %llu\n", (unsigned long long)i);
+			return 1;
+		}
+	return 0;
+}
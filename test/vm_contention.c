@@ -0,0 +1,141 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * Copyright 2010 PathScale Inc.  All rights reserved.
+ * Use is subject to license terms.
+ */
+
+/* Contention benchmark for the vspace and channel ioctls. A few threads,
+ * each with its own fd and vspace like separate processes would have, map
+ * and unmap a big BO over and over, while the main thread times channel
+ * creation on a vspace of its own. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <xf86drm.h>
+#include "libpscnv.h"
+
+static volatile int stop;
+static uint64_t bo_size = 256 << 20;
+
+static double
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *
+mapper(void *arg)
+{
+	long *count = arg;
+	uint32_t vid, handle;
+	uint64_t offset;
+	int fd, ret;
+
+	fd = drmOpen("pscnv", 0);
+	if (fd == -1)
+		return 0;
+	if (pscnv_vspace_new(fd, &vid))
+		return 0;
+	ret = pscnv_gem_new(fd, 0xc0c0, 0, 0, bo_size, 0, &handle, 0);
+	if (ret) {
+		printf("new: failed ret = %d\n", ret);
+		return 0;
+	}
+	while (!stop) {
+		ret = pscnv_vspace_map(fd, vid, handle, 0x20000000, 1ull << 40, 0, 0, &offset);
+		if (ret) {
+			printf("map: failed ret = %d\n", ret);
+			break;
+		}
+		pscnv_vspace_unmap(fd, vid, offset);
+		(*count)++;
+	}
+	pscnv_gem_close(fd, handle);
+	pscnv_vspace_free(fd, vid);
+	close(fd);
+	return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+	int nthreads = argc > 1 ? atoi(argv[1]) : 4;
+	int n = argc > 2 ? atoi(argv[2]) : 1000;
+	pthread_t *threads;
+	long *counts, total = 0;
+	double t0, t, worst = 0, sum = 0;
+	uint32_t vid, cid;
+	int fd, i, ret;
+
+	if (argc > 3)
+		bo_size = strtoull(argv[3], 0, 0) << 20;
+
+	fd = drmOpen("pscnv", 0);
+	if (fd == -1)
+		return 1;
+	threads = calloc(nthreads, sizeof *threads);
+	counts = calloc(nthreads, sizeof *counts);
+	if (!threads || !counts)
+		return 1;
+	ret = pscnv_vspace_new(fd, &vid);
+	if (ret) {
+		printf("vspace_new: failed ret = %d\n", ret);
+		return 1;
+	}
+
+	for (i = 0; i < nthreads; i++)
+		pthread_create(&threads[i], 0, mapper, &counts[i]);
+
+	for (i = 0; i < n; i++) {
+		t0 = now();
+		ret = pscnv_chan_new(fd, vid, &cid, 0);
+		t = now() - t0;
+		if (ret) {
+			printf("chan_new: failed ret = %d\n", ret);
+			break;
+		}
+		pscnv_chan_free(fd, cid);
+		sum += t;
+		if (t > worst)
+			worst = t;
+	}
+
+	stop = 1;
+	for (i = 0; i < nthreads; i++) {
+		pthread_join(threads[i], 0);
+		total += counts[i];
+	}
+	printf("%d chan_new with %d mapping threads: %.3f ms average, %.3f ms worst\n",
+			i, nthreads, sum * 1e3 / (i ? i : 1), worst * 1e3);
+	printf("%ld map/unmap pairs of %lld MiB done meanwhile\n", total, (long long)(bo_size >> 20));
+
+	pscnv_vspace_free(fd, vid);
+	close(fd);
+	return 0;
+}
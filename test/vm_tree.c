@@ -0,0 +1,437 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * Copyright 2010 PathScale Inc.  All rights reserved.
+ * Use is subject to license terms.
+ */
+
+/* Fuzzes and times the vspace address space tree of pscnv_vm_tree.c.
+ * Runs a long random sequence of maps and unmaps of various sizes,
+ * alignments and address windows, with reservations coming and going and
+ * fixed address maps into them, checks the tree after every -c ops, and
+ * reports how many nodes it has and how deep they are.
+ *
+ * usage: vm_tree [-n ops] [-m max mappings] [-c check interval] [-s seed] [-b]
+ *
+ * A check walks the whole tree and verifies that the nodes cover the
+ * address space without gaps, that no two free nodes or holes of the same
+ * reservation are adjacent, that every maxgap is right, and that the
+ * mapped nodes are the ones we think. Maps done right before a check, and
+ * the first 1000 that fail, are also checked to have gone where a brute
+ * force first fit search would put them. Fixed maps and unreserves are
+ * always checked against a brute force search.
+ *
+ * -b instead measures map and unmap times with 10k, 100k and 1M small
+ * buffers mapped.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "drmP.h"
+#include "pscnv_vram.h"
+#include "pscnv_vm.h"
+
+static struct pscnv_vspace vs;
+
+struct mapping {
+	struct pscnv_vo vo;
+	struct pscnv_vm_mapnode *node;
+	uint64_t start, end;
+};
+
+struct reservation {
+	uint64_t start, size;
+};
+
+#define NRESV 16
+static struct reservation resv[NRESV];
+
+static int nnodes, maxdepth;
+static uint64_t sumdepth;
+
+static uint64_t
+check_node(struct pscnv_vm_mapnode *node, int depth, uint64_t *pos, struct pscnv_vm_mapnode **prev)
+{
+	struct pscnv_vm_mapnode *left, *right;
+	uint64_t gap, l, r;
+	if (!node)
+		return 0;
+	left = PSCNV_RB_LEFT(node, entry);
+	right = PSCNV_RB_RIGHT(node, entry);
+	nnodes++;
+	sumdepth += depth;
+	if (depth > maxdepth)
+		maxdepth = depth;
+	l = check_node(left, depth + 1, pos, prev);
+	if (node->start != *pos) {
+		printf("node at %#llx, expected %#llx\n", (unsigned long long)node->start, (unsigned long long)*pos);
+		abort();
+	}
+	if (!node->size) {
+		printf("empty node at %#llx\n", (unsigned long long)node->start);
+		abort();
+	}
+	if (!node->vo && *prev && !(*prev)->vo && node->reserved == (*prev)->reserved &&
+			(!node->reserved || node->resv == (*prev)->resv)) {
+		printf("unmerged free node at %#llx\n", (unsigned long long)node->start);
+		abort();
+	}
+	if (node->reserved) {
+		struct reservation *r = 0;
+		int i;
+		for (i = 0; i < NRESV; i++)
+			if (resv[i].size && resv[i].start == node->resv)
+				r = &resv[i];
+		if (!r || node->start < r->start || node->start + node->size > r->start + r->size) {
+			printf("node at %#llx outside its reservation\n", (unsigned long long)node->start);
+			abort();
+		}
+	}
+	if (node->vo) {
+		struct mapping *m = container_of(node->vo, struct mapping, vo);
+		if (m->node != node || node->size != m->vo.size) {
+			printf("wrong mapped node at %#llx\n", (unsigned long long)node->start);
+			abort();
+		}
+		if (node->start < m->start || node->start + node->size > m->end ||
+				node->start % m->vo.align) {
+			printf("mapping at %#llx outside its window\n", (unsigned long long)node->start);
+			abort();
+		}
+	}
+	*prev = node;
+	*pos = node->start + node->size;
+	r = check_node(right, depth + 1, pos, prev);
+	gap = node->vo || node->reserved ? 0 : node->size;
+	gap = max(gap, max(l, r));
+	if (node->maxgap != gap) {
+		printf("maxgap of %#llx is %#llx, should be %#llx\n", (unsigned long long)node->start,
+				(unsigned long long)node->maxgap, (unsigned long long)gap);
+		abort();
+	}
+	return gap;
+}
+
+static void
+check(int live)
+{
+	uint64_t pos = 0;
+	int nmapped = 0;
+	struct pscnv_vm_mapnode *node, *prev = 0;
+	nnodes = maxdepth = 0;
+	sumdepth = 0;
+	check_node(PSCNV_RB_ROOT(&vs.maps), 0, &pos, &prev);
+	if (pos != 1ULL << 40) {
+		printf("tree ends at %#llx\n", (unsigned long long)pos);
+		abort();
+	}
+	if (nnodes != vs.map_nodes) {
+		printf("%d nodes, vspace thinks %d\n", nnodes, vs.map_nodes);
+		abort();
+	}
+	PSCNV_RB_FOREACH(node, pscnv_vm_maptree, &vs.maps)
+		if (node->vo)
+			nmapped++;
+	if (nmapped != live) {
+		printf("%d mapped nodes, expected %d\n", nmapped, live);
+		abort();
+	}
+}
+
+/* where a brute force search over all free nodes would put m: the lowest
+ * fitting address, or the highest with back set. ~0 if nowhere. */
+static uint64_t
+expected_fit(struct mapping *m, int back)
+{
+	struct pscnv_vm_mapnode *node;
+	uint64_t lo, hi, res = ~0ULL;
+	PSCNV_RB_FOREACH(node, pscnv_vm_maptree, &vs.maps) {
+		if (node->vo || node->reserved)
+			continue;
+		lo = ALIGN(max(node->start, m->start), m->vo.align);
+		hi = min(node->start + node->size, m->end);
+		if (lo + m->vo.size > hi)
+			continue;
+		if (!back)
+			return lo;
+		res = (hi - m->vo.size) & ~(m->vo.align - 1);
+	}
+	return res;
+}
+
+/* can m be mapped at exactly addr? with reserve set, can a reservation
+ * go there? */
+static int
+expected_fixed(uint64_t addr, uint64_t size, int reserve)
+{
+	struct pscnv_vm_mapnode *node;
+	PSCNV_RB_FOREACH(node, pscnv_vm_maptree, &vs.maps)
+		if (node->start <= addr && addr < node->start + node->size)
+			return !node->vo && !(reserve && node->reserved) &&
+				addr + size <= node->start + node->size;
+	return 0;
+}
+
+/* reserves a random range in free space, or drops a random reservation */
+static void
+reserve_op(struct mapping *maps, int maxlive, struct pscnv_vm_mapnode **spare)
+{
+	struct reservation *r = &resv[rand() % NRESV];
+	struct pscnv_vm_mapnode *node;
+	uint64_t start;
+	int busy = 0, ret, i, fixed;
+	if (r->size) {
+		for (i = 0; i < maxlive; i++)
+			if (maps[i].node && maps[i].node->start >= r->start &&
+					maps[i].node->start < r->start + r->size)
+				busy = 1;
+		ret = pscnv_vspace_tree_unreserve(&vs, r->start);
+		if (ret != (busy ? -EBUSY : 0)) {
+			printf("unreserve of %#llx gave %d\n", (unsigned long long)r->start, ret);
+			abort();
+		}
+		if (!ret)
+			r->size = 0;
+		return;
+	}
+	r->size = (uint64_t)(rand() % 4096 + 1) << 12;
+	start = (uint64_t)(rand() % 256) << 32;
+	fixed = rand() % 2;
+	if (fixed)
+		start += (uint64_t)(rand() % 0x100000) << 12;
+	pscnv_vspace_spares_fill(spare, PSCNV_VM_SPARES);
+	if (fixed) {
+		int expect = expected_fixed(start, r->size, 1);
+		node = pscnv_vspace_tree_reserve(&vs, r->size, start, 0, 0x1000, 0, 1, spare);
+		if (!node != !expect) {
+			printf("fixed reserve of %#llx at %#llx wrongly %s\n", (unsigned long long)r->size,
+					(unsigned long long)start, node ? "done" : "failed");
+			abort();
+		}
+	} else {
+		node = pscnv_vspace_tree_reserve(&vs, r->size, start, start + (1ULL << 34), 0x1000, rand() % 2, 0, spare);
+	}
+	if (node) {
+		r->start = node->start;
+		if (node->start != node->resv || node->size != r->size) {
+			printf("bad reservation node at %#llx\n", (unsigned long long)node->start);
+			abort();
+		}
+	} else {
+		r->size = 0;
+	}
+}
+
+static uint64_t
+now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* map/unmap throughput with n small buffers mapped: fills the vspace up
+ * to n mappings, then replaces random ones */
+static void
+bench(int n)
+{
+	struct mapping *maps = calloc(n, sizeof *maps);
+	struct pscnv_vm_mapnode *spare[PSCNV_VM_SPARES] = { 0 };
+	uint64_t t0, tmap = 0, tunmap = 0;
+	int i, j, rounds = 200000;
+	if (!maps)
+		abort();
+	for (i = 0; i < n; i++) {
+		maps[i].vo.size = (uint64_t)(rand() % 16 + 1) << 12;
+		maps[i].vo.align = 0x1000;
+		maps[i].end = 1ULL << 40;
+		pscnv_vspace_spares_fill(spare, PSCNV_VM_SPARES);
+		maps[i].node = pscnv_vspace_tree_alloc(&vs, &maps[i].vo, maps[i].vo.size, 0, maps[i].end, 0x1000, 0, spare);
+	}
+	for (i = 0; i < rounds; i++) {
+		struct mapping *m = &maps[rand() % n];
+		t0 = now_ns();
+		pscnv_vspace_tree_release(m->node);
+		tunmap += now_ns() - t0;
+		pscnv_vspace_spares_fill(spare, PSCNV_VM_SPARES);
+		t0 = now_ns();
+		m->node = pscnv_vspace_tree_alloc(&vs, &m->vo, m->vo.size, 0, m->end, 0x1000, rand() % 2, spare);
+		tmap += now_ns() - t0;
+	}
+	check(n);
+	printf("%8d mappings: %d nodes, max depth %d, map %.0f ns, unmap %.0f ns\n", n, nnodes, maxdepth,
+			(double)tmap / rounds, (double)tunmap / rounds);
+	for (j = 0; j < n; j++)
+		pscnv_vspace_tree_release(maps[j].node);
+	pscnv_vspace_spares_free(spare, PSCNV_VM_SPARES);
+	free(maps);
+}
+
+int
+main(int argc, char **argv)
+{
+	long ops = 1000000, interval = 1000, i;
+	int maxlive = 10000, live = 0, fails = 0, back, verify, c, j;
+	unsigned seed = 1;
+	struct mapping *maps;
+	uint64_t t0, tmap = 0, tunmap = 0, nmap = 0, nunmap = 0, expect = 0;
+	struct pscnv_vm_mapnode *spare[PSCNV_VM_SPARES] = { 0 };
+	struct reservation *r;
+	while ((c = getopt(argc, argv, "n:m:c:s:b")) != -1)
+		switch (c) {
+		case 'b':
+			srand(seed);
+			if (pscnv_vspace_tree_init(&vs))
+				return 1;
+			bench(10000);
+			bench(100000);
+			bench(1000000);
+			return 0;
+		case 'n':
+			ops = atol(optarg);
+			break;
+		case 'm':
+			maxlive = atoi(optarg);
+			break;
+		case 'c':
+			interval = atol(optarg);
+			break;
+		case 's':
+			seed = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: vm_tree [-n ops] [-m max mappings] [-c check interval] [-s seed] [-b]\n");
+			return 1;
+		}
+	maps = calloc(maxlive, sizeof *maps);
+	if (!maps)
+		return 1;
+	srand(seed);
+	if (pscnv_vspace_tree_init(&vs))
+		return 1;
+
+	for (i = 0; i < ops; i++) {
+		struct mapping *m = &maps[rand() % maxlive];
+		if (rand() % 64 == 0) {
+			reserve_op(maps, maxlive, spare);
+		} else if (m->node) {
+			t0 = now_ns();
+			pscnv_vspace_tree_release(m->node);
+			tunmap += now_ns() - t0;
+			nunmap++;
+			m->node = 0;
+			live--;
+		} else {
+			/* mostly small buffers, some big ones, at times large
+			 * page aligned, in a few address windows */
+			j = rand() % 16;
+			m->vo.size = (uint64_t)(j < 12 ? rand() % 16 + 1 : j < 15 ? rand() % 1024 + 1 : rand() % 65536 + 1) << 12;
+			m->vo.align = rand() % 4 ? 0x1000 : 0x10000;
+			r = &resv[rand() % NRESV];
+			if (rand() % 4 == 0 && r->size) {
+				/* fixed, mostly into a reservation */
+				int expect;
+				m->start = r->start + ((rand() % (r->size >> 12)) << 12);
+				if (rand() % 4 == 0)
+					m->start = (uint64_t)rand() << 12;
+				m->start &= ~(m->vo.align - 1);
+				m->end = m->start + m->vo.size;
+				expect = expected_fixed(m->start, m->vo.size, 0);
+				pscnv_vspace_spares_fill(spare, PSCNV_VM_SPARES);
+				m->node = pscnv_vspace_tree_alloc_fixed(&vs, &m->vo, m->vo.size, m->start, spare);
+				if (!m->node != !expect) {
+					printf("fixed map of %#llx at %#llx wrongly %s\n",
+							(unsigned long long)m->vo.size, (unsigned long long)m->start,
+							m->node ? "done" : "failed");
+					abort();
+				}
+				if (m->node)
+					live++;
+				goto next;
+			}
+			switch (rand() % 4) {
+			case 0:
+				m->start = 0;
+				m->end = 1ULL << 40;
+				break;
+			case 1:
+				m->start = 0x20000000;
+				m->end = 1ULL << 32;
+				break;
+			default:
+				m->start = (uint64_t)(rand() % 256) << 32;
+				m->end = m->start + (1ULL << 34);
+				break;
+			}
+			back = rand() % 2;
+			verify = interval && (i % interval == 0 || fails < 1000);
+			if (verify)
+				expect = expected_fit(m, back);
+			pscnv_vspace_spares_fill(spare, PSCNV_VM_SPARES);
+			t0 = now_ns();
+			m->node = pscnv_vspace_tree_alloc(&vs, &m->vo, m->vo.size, m->start, m->end, m->vo.align, back, spare);
+			tmap += now_ns() - t0;
+			nmap++;
+			if (m->node)
+				live++;
+			else
+				fails++;
+			if (verify && expect != (m->node ? m->node->start : ~0ULL)) {
+				printf("map of %#llx in %#llx-%#llx went to %#llx, not %#llx\n",
+						(unsigned long long)m->vo.size, (unsigned long long)m->start,
+						(unsigned long long)m->end,
+						(unsigned long long)(m->node ? m->node->start : ~0ULL),
+						(unsigned long long)expect);
+				abort();
+			}
+		}
+next:
+		if (interval && i % interval == 0)
+			check(live);
+	}
+	check(live);
+	printf("%ld ops, %d mappings live, %d maps failed\n", ops, live, fails);
+	printf("%d nodes, max depth %d, mean depth %.2f\n", nnodes, maxdepth, (double)sumdepth / nnodes);
+	printf("map %.0f ns, unmap %.0f ns on average\n", (double)tmap / nmap, (double)tunmap / nunmap);
+	for (j = 0; j < maxlive; j++)
+		if (maps[j].node) {
+			pscnv_vspace_tree_release(maps[j].node);
+			maps[j].node = 0;
+		}
+	for (j = 0; j < NRESV; j++)
+		if (resv[j].size) {
+			if (pscnv_vspace_tree_unreserve(&vs, resv[j].start))
+				abort();
+			resv[j].size = 0;
+		}
+	pscnv_vspace_spares_free(spare, PSCNV_VM_SPARES);
+	check(0);
+	if (vs.map_nodes != 1) {
+		printf("%d nodes left with nothing mapped\n", vs.map_nodes);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,223 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * Copyright 2010 PathScale Inc.  All rights reserved.
+ * Use is subject to license terms.
+ */
+
+/* Runs VRAM compaction on a mapped GEM VO, on top of vram_stub/ and the
+ * real pscnv_compact.c, and checks that the VO's contents and the PTEs of
+ * its mappings follow it. The VO is mapped whole into one vspace and in
+ * part into another. While the second vspace has a channel, the VO must
+ * stay where it is.
+ *
+ * usage: vram_compact
+ *
+ * The PRAMIN window of the stub is backed by host memory, so the move
+ * goes through the real CPU mover. Page tables are a flat array per
+ * vspace, written by a fake do_map.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "drmP.h"
+#include "pscnv_vram.h"
+#include "pscnv_vm.h"
+
+#define NPTES 0x1000
+
+static uint64_t ptes[2][NPTES];
+static struct pscnv_vspace vs[2];
+static int batches, flushes;
+
+static int
+fake_do_map(struct pscnv_vspace *vs, struct pscnv_vo *vo, uint64_t offset, uint64_t vo_off, uint64_t size)
+{
+	uint64_t *pt = vs->engdata;
+	struct pscnv_vram_region *reg;
+	uint64_t rbase = 0, roff;
+	list_for_each_entry(reg, &vo->regions, local_list) {
+		for (roff = 0; roff < reg->size; roff += PSCNV_VRAM_PAGE_SIZE)
+			if (rbase + roff >= vo_off && rbase + roff < vo_off + size)
+				pt[(offset + rbase + roff - vo_off) / PSCNV_VRAM_PAGE_SIZE] = (reg->start + roff) | 1;
+		rbase += reg->size;
+	}
+	return 0;
+}
+
+static struct pscnv_vm_engine fake_vm = {
+	.do_map = fake_do_map,
+};
+
+/* the vspace side of a move: PTE writes in a batch, one flush at its end */
+void
+pscnv_vspace_batch_begin(struct pscnv_vspace *vs)
+{
+	vs->tlb_batch++;
+	batches++;
+}
+
+int
+pscnv_vspace_batch_end(struct pscnv_vspace *vs)
+{
+	if (!--vs->tlb_batch && vs->tlb_dirty) {
+		vs->tlb_dirty = 0;
+		flushes++;
+	}
+	return 0;
+}
+
+int
+pscnv_vspace_tlb_flush_later(struct pscnv_vspace *vs)
+{
+	vs->tlb_dirty = 1;
+	return 0;
+}
+
+/* VRAM address of byte off of vo */
+static uint64_t
+vo_addr(struct pscnv_vo *vo, uint64_t off)
+{
+	struct pscnv_vram_region *reg;
+	list_for_each_entry(reg, &vo->regions, local_list) {
+		if (off < reg->size)
+			return reg->start + off;
+		off -= reg->size;
+	}
+	abort();
+}
+
+static void
+fill(struct pscnv_vo *vo, uint32_t seed)
+{
+	uint64_t off;
+	for (off = 0; off < vo->size; off += 4)
+		vram_stub_vram[vo_addr(vo, off) / 4] = seed ^ (uint32_t)off;
+}
+
+/* checks the PTEs of node, and the contents of its VO */
+static int
+check(struct pscnv_vm_mapnode *node, uint32_t seed)
+{
+	uint64_t *pt = node->vspace->engdata;
+	uint64_t off;
+	for (off = 0; off < node->size; off += PSCNV_VRAM_PAGE_SIZE) {
+		uint64_t want = vo_addr(node->vo, node->vo_off + off) | 1;
+		uint64_t pte = pt[(node->start + off) / PSCNV_VRAM_PAGE_SIZE];
+		if (pte != want) {
+			printf("PTE at %llx is %llx, should be %llx\n", (unsigned long long)(node->start + off),
+					(unsigned long long)pte, (unsigned long long)want);
+			return 1;
+		}
+	}
+	for (off = 0; off < node->vo->size; off += 4) {
+		uint32_t val = vram_stub_vram[vo_addr(node->vo, off) / 4];
+		if (val != (seed ^ (uint32_t)off)) {
+			printf("VO word at %llx is %08x, should be %08x\n", (unsigned long long)off,
+					val, seed ^ (uint32_t)off);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static void
+map(struct pscnv_vm_mapnode *node, struct pscnv_vspace *vs, struct pscnv_vo *vo,
+		uint64_t start, uint64_t vo_off, uint64_t size)
+{
+	node->vspace = vs;
+	node->vo = vo;
+	node->start = start;
+	node->vo_off = vo_off;
+	node->size = size;
+	list_add_tail(&node->vo_list, &vo->maps);
+	fake_do_map(vs, vo, start, vo_off, size);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct drm_device *dev = &vram_stub_dev;
+	struct pscnv_vo *filler, *pin, *vo;
+	struct pscnv_vm_mapnode node[2];
+	struct list_head chan;
+	uint64_t old;
+	int i, moved, fail = 0;
+
+	/* 32MiB */
+	vram_stub_vram = calloc(4 * 8 * 4096 << 8, 1);
+	if (!vram_stub_vram || vram_stub_init(4 * 8 * 4096 << 8, 4, 8, 9, 8, 0))
+		return 1;
+	vram_stub_priv.vm = &fake_vm;
+	for (i = 0; i < 2; i++) {
+		vs[i].dev = dev;
+		mutex_init(&vs[i].lock);
+		INIT_LIST_HEAD(&vs[i].chan_list);
+		vs[i].engdata = ptes[i];
+	}
+
+	/* leave a hole below the VO once filler is gone. pin isn't a GEM
+	 * object, so it stays where it is. */
+	filler = pscnv_vram_alloc(dev, 0x200000, 0, PSCNV_VO_CONTIG, 0, 0xf111e7);
+	pin = pscnv_vram_alloc(dev, 0x100000, 0, PSCNV_VO_CONTIG, 0, 0x9172);
+	vo = pscnv_vram_alloc(dev, 0x100000, 0, PSCNV_VO_CONTIG, 0, 0x7e57);
+	if (!filler || !pin || !vo) {
+		printf("allocation failed\n");
+		return 1;
+	}
+	vo->gem = (struct drm_gem_object *)&vo->user;
+	fill(vo, 0xc0ffee);
+	map(&node[0], &vs[0], vo, 0x100000, 0, vo->size);
+	map(&node[1], &vs[1], vo, 0x400000, 0x40000, 0x80000);
+	pscnv_vram_free(filler);
+	old = vo->start;
+
+	/* a channel may be using the VO */
+	list_add(&chan, &vs[1].chan_list);
+	moved = pscnv_vram_compact(dev);
+	if (moved || vo->start != old) {
+		printf("VO mapped into a vspace with a channel got moved\n");
+		fail = 1;
+	}
+	fail |= check(&node[0], 0xc0ffee) | check(&node[1], 0xc0ffee);
+
+	list_del(&chan);
+	moved = pscnv_vram_compact(dev);
+	if (moved != 1 || vo->start >= old) {
+		printf("VO at %llx wasn't moved down, %d VOs moved\n", (unsigned long long)old, moved);
+		fail = 1;
+	}
+	fail |= check(&node[0], 0xc0ffee) | check(&node[1], 0xc0ffee);
+	if (batches != 2 || flushes != 2) {
+		printf("%d batches and %d TLB flushes for 2 mappings\n", batches, flushes);
+		fail = 1;
+	}
+	if (vs[0].lock.locked || vs[1].lock.locked || vo->maps_lock.locked) {
+		printf("compaction left a lock held\n");
+		fail = 1;
+	}
+
+	printf("VO moved from %llx to %llx: %s\n", (unsigned long long)old,
+			(unsigned long long)vo->start, fail ? "FAIL" : "ok");
+	return fail;
+}
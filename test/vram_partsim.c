@@ -0,0 +1,203 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * Copyright 2010 PathScale Inc.  All rights reserved.
+ * Use is subject to license terms.
+ */
+
+/* Simulates placement of bandwidth-heavy and hot VOs on a given NV50
+ * memory config, with and without PSCNV_VO_SPREAD / PSCNV_VO_HOT, and
+ * reports how they end up distributed over memory partitions and rows.
+ *
+ * usage: vram_partsim [-p parts] [-b banks] [-c colbits] [-r rowbits] [-t]
+ *
+ * -t selects 3-row rblocks. Everything is done twice, first on clean VRAM,
+ * then after fragmenting it with small VOs, so that large VOs have to be
+ * made of many pieces.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include "drmP.h"
+#include "pscnv_vram.h"
+
+#define NBIG	8
+#define NHOT	256
+
+/* adds up bytes of a VO in every partition */
+static void
+count_parts(struct pscnv_vo *vo, uint64_t *bytes)
+{
+	uint32_t row = vram_stub_priv.vram_row_size;
+	uint32_t stride = vram_stub_priv.vram_part_stride;
+	struct pscnv_vram_region *reg;
+	uint64_t pos, end, next;
+	list_for_each_entry(reg, &vo->regions, local_list) {
+		for (pos = reg->start; pos < reg->start + reg->size; pos = next) {
+			next = (pos / stride + 1) * stride;
+			end = min(next, reg->start + reg->size);
+			bytes[pos % row / stride] += end - pos;
+		}
+	}
+}
+
+static int
+count_regions(struct pscnv_vo *vo)
+{
+	struct pscnv_vram_region *reg;
+	int res = 0;
+	list_for_each_entry(reg, &vo->regions, local_list)
+		res++;
+	return res;
+}
+
+/* NBIG VOs taking a quarter of VRAM */
+static void
+big(int flags)
+{
+	uint64_t bigsize = vram_stub_priv.vram_size / NBIG / 4 & ~0xfffull;
+	struct pscnv_vo *vos[NBIG];
+	uint64_t bytes[8] = { 0 }, total = 0, most = 0;
+	int i, nregs = 0, parts = vram_stub_priv.vram_parts;
+	for (i = 0; i < NBIG; i++) {
+		vos[i] = pscnv_vram_alloc(&vram_stub_dev, bigsize, 0, flags, 0, 0xb16);
+		if (!vos[i]) {
+			printf("alloc of big VO %d failed\n", i);
+			exit(1);
+		}
+		count_parts(vos[i], bytes);
+		nregs += count_regions(vos[i]);
+		total += vos[i]->size;
+	}
+	printf("%-8s %5.1f regions/VO, %6.2f%% rounding, MiB per partition:", flags & PSCNV_VO_SPREAD ? "spread" : "plain",
+			(double)nregs / NBIG, 100.0 * (total - NBIG * bigsize) / total);
+	for (i = 0; i < parts; i++) {
+		printf(" %.2f", bytes[i] / 1048576.0);
+		most = max(most, bytes[i]);
+	}
+	printf(", max/mean %.3f\n", (double)most * parts / total);
+	for (i = 0; i < NBIG; i++)
+		pscnv_vram_free(vos[i]);
+}
+
+static int
+u64cmp(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return x < y ? -1 : x > y;
+}
+
+static void
+hot(int flags)
+{
+	struct pscnv_vo *hot[NHOT], *cold[NHOT];
+	uint64_t rows[NHOT];
+	uint32_t row = vram_stub_priv.vram_row_size;
+	int i, nrows = 0;
+	/* hot objects come interleaved with ordinary ones */
+	for (i = 0; i < NHOT; i++) {
+		hot[i] = pscnv_vram_alloc(&vram_stub_dev, 0x1000, 0, flags, 0, 0x407);
+		cold[i] = pscnv_vram_alloc(&vram_stub_dev, 0x10000, 0, 0, 0, 0xc01d);
+		if (!hot[i] || !cold[i]) {
+			printf("alloc of hot VO %d failed\n", i);
+			exit(1);
+		}
+		rows[i] = list_first_entry(&hot[i]->regions, struct pscnv_vram_region, local_list)->start / row;
+	}
+	qsort(rows, NHOT, sizeof *rows, u64cmp);
+	for (i = 0; i < NHOT; i++)
+		if (!i || rows[i] != rows[i - 1])
+			nrows++;
+	printf("%-8s %d 4kiB VOs in %d rows, %d at best\n", flags & PSCNV_VO_HOT ? "hot" : "plain",
+			NHOT, nrows, (int)((NHOT * 0x1000ull + row - 1) / row));
+	for (i = 0; i < NHOT; i++) {
+		pscnv_vram_free(hot[i]);
+		pscnv_vram_free(cold[i]);
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	int parts = 4, banks = 8, colbits = 9, rowbits = 11, tri = 0, c, i, nfill = 0;
+	struct pscnv_vo **fill = 0, *vo;
+	while ((c = getopt(argc, argv, "p:b:c:r:t")) != -1) {
+		switch (c) {
+			case 'p':
+				parts = atoi(optarg);
+				break;
+			case 'b':
+				banks = atoi(optarg);
+				break;
+			case 'c':
+				colbits = atoi(optarg);
+				break;
+			case 'r':
+				rowbits = atoi(optarg);
+				break;
+			case 't':
+				tri = 1;
+				break;
+			default:
+				fprintf(stderr, "usage: %s [-p parts] [-b banks] [-c colbits] [-r rowbits] [-t]\n", argv[0]);
+				return 1;
+		}
+	}
+	if (parts < 1 || parts > 8 || (banks != 4 && banks != 8) || colbits < 0 || colbits > 15 ||
+			rowbits < 8 || rowbits > 23) {
+		fprintf(stderr, "bad memory config\n");
+		return 1;
+	}
+	if (vram_stub_init((uint64_t)parts * banks * (8 << colbits) << rowbits, parts, banks, colbits, rowbits, tri))
+		return 1;
+
+	printf("clean VRAM:\n");
+	big(0);
+	big(PSCNV_VO_SPREAD);
+	hot(0);
+	hot(PSCNV_VO_HOT);
+
+	/* fragment VRAM: fill it up with small VOs, free every other */
+	srand(1);
+	while ((vo = pscnv_vram_alloc(&vram_stub_dev, (rand() % 64 + 1) * 0x1000, 0, 0, 0, 0xf111))) {
+		if (!(nfill & (nfill - 1)))
+			fill = realloc(fill, (nfill ? nfill * 2 : 1) * sizeof *fill);
+		fill[nfill++] = vo;
+	}
+	for (i = 0; i < nfill; i += 2)
+		pscnv_vram_free(fill[i]);
+
+	printf("fragmented VRAM:\n");
+	big(0);
+	big(PSCNV_VO_SPREAD);
+	hot(0);
+	hot(PSCNV_VO_HOT);
+
+	for (i = 1; i < nfill; i += 2)
+		pscnv_vram_free(fill[i]);
+	free(fill);
+	pscnv_vram_takedown(&vram_stub_dev);
+	return 0;
+}
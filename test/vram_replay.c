@@ -0,0 +1,300 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * Copyright 2010 PathScale Inc.  All rights reserved.
+ * Use is subject to license terms.
+ */
+
+/* Replays a VRAM allocation trace (see pscnv/pscnv_vram_trace.h) against
+ * pscnv_vram.c built in userspace, and reports how the allocator did.
+ *
+ * usage: vram_replay [-p policy] [-i interval] [-r reserve] trace
+ *
+ * Every interval events, and at the end, prints a line with VRAM usage,
+ * free space, the largest free extent and fragmentation, ie. the part of
+ * free space outside the largest extent. Then prints latency percentiles
+ * of the replayed calls, and of the traced ones for comparison, and the
+ * number of rblock type conversions. reserve is the typed free space kept
+ * for each of sane and LSR pages, in KiB, like the vram_reserve_* module
+ * parameters. '#' lines are comments, so the output can go straight into gnuplot.
+ *
+ * Compaction isn't replayed as such: MOVE records swap the regions of the
+ * two VOs, like compaction did.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "drmP.h"
+#include "pscnv_vram.h"
+#include "pscnv_vram_trace.h"
+
+/* finds a memory config that makes pscnv_vram_init come up with the
+ * traced VRAM and rblock size. Prefers one that also adds up to the VRAM
+ * size, so that init doesn't complain. */
+static int
+fake_memctl(uint64_t vram_size, uint32_t rblock_size)
+{
+	int parts, banks, colbits, rowbits, tri, exact;
+	uint64_t rowsize;
+	for (exact = 1; exact >= 0; exact--)
+	for (tri = 0; tri < 2; tri++)
+	for (parts = 1; parts <= 8; parts++)
+	for (banks = 4; banks <= 8; banks += 4)
+	for (colbits = 0; colbits < 16; colbits++) {
+		rowsize = parts * banks * (1 << colbits) * 8;
+		if (rowsize * (tri ? 3 : 1) != rblock_size)
+			continue;
+		for (rowbits = 8; rowbits < 23; rowbits++)
+			if (rowsize << rowbits >= vram_size)
+				break;
+		if (exact && rowsize << rowbits != vram_size)
+			continue;
+		return vram_stub_init(vram_size, parts, banks, colbits, rowbits, tri);
+	}
+	fprintf(stderr, "can't make up a memory config with rblock size %#x\n", rblock_size);
+	return -1;
+}
+
+static uint64_t
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+struct lat {
+	uint64_t *v;
+	size_t n, max;
+};
+
+static void
+lat_add(struct lat *l, uint64_t v)
+{
+	if (l->n == l->max) {
+		l->max = l->max ? l->max * 2 : 1024;
+		l->v = realloc(l->v, l->max * sizeof *l->v);
+		if (!l->v) {
+			perror("realloc");
+			exit(1);
+		}
+	}
+	l->v[l->n++] = v;
+}
+
+static int
+u64cmp(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return x < y ? -1 : x > y;
+}
+
+static void
+lat_print(const char *name, struct lat *l)
+{
+	static const double pct[] = { 50, 90, 99, 99.9 };
+	int i;
+	if (!l->n) {
+		printf("# %s: no calls\n", name);
+		return;
+	}
+	qsort(l->v, l->n, sizeof *l->v, u64cmp);
+	printf("# %s: %zu calls, ns:", name, l->n);
+	for (i = 0; i < sizeof pct / sizeof *pct; i++)
+		printf(" p%g %llu", pct[i], (unsigned long long)l->v[(size_t)(l->n * pct[i] / 100)]);
+	printf(" max %llu\n", (unsigned long long)l->v[l->n - 1]);
+}
+
+static void
+sample(uint64_t event, uint64_t time, int fails)
+{
+	struct pscnv_vram_region *reg;
+	uint64_t used = 0, free = 0, run = 0, largest = 0;
+	int nfree = 0;
+	/* adjacent free regions of any type make up a single extent */
+	list_for_each_entry(reg, &vram_stub_priv.vram_global_list, global_list) {
+		if (reg->type > PSCNV_VRAM_LAST_FREE) {
+			used += reg->size;
+			run = 0;
+			continue;
+		}
+		if (!run)
+			nfree++;
+		free += reg->size;
+		run += reg->size;
+		if (run > largest)
+			largest = run;
+	}
+	printf("%llu %llu %llu %llu %llu %d %.4f %d\n", (unsigned long long)event,
+			(unsigned long long)time / 1000000, (unsigned long long)used,
+			(unsigned long long)free, (unsigned long long)largest, nfree,
+			free ? 1.0 - (double)largest / free : 0.0, fails);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct pscnv_vram_trace_header hdr;
+	struct pscnv_vram_trace_rec rec;
+	struct pscnv_vo **vos = 0, *a, *b;
+	struct pscnv_vram_region *reg;
+	struct lat lalloc = { 0 }, lfree = { 0 }, talloc = { 0 }, tfree = { 0 };
+	uint64_t interval = 1000, i, t, tmp;
+	size_t nvos = 0;
+	int c, fails = 0, tfails = 0, skipped = 0, policy = -1;
+	LIST_HEAD(regions);
+	char *pad;
+	FILE *f;
+
+	while ((c = getopt(argc, argv, "p:i:r:")) != -1) {
+		switch (c) {
+			case 'p':
+				policy = atoi(optarg);
+				break;
+			case 'i':
+				interval = strtoull(optarg, 0, 0);
+				break;
+			case 'r':
+				pscnv_vram_reserve_sane = pscnv_vram_reserve_lsr = atoi(optarg);
+				break;
+			default:
+				fprintf(stderr, "usage: %s [-p policy] [-i interval] [-r reserve] trace\n", argv[0]);
+				return 1;
+		}
+	}
+	if (optind != argc - 1 || !interval) {
+		fprintf(stderr, "usage: %s [-p policy] [-i interval] [-r reserve] trace\n", argv[0]);
+		return 1;
+	}
+	f = fopen(argv[optind], "rb");
+	if (!f) {
+		perror(argv[optind]);
+		return 1;
+	}
+	if (fread(&hdr, sizeof hdr, 1, f) != 1 || hdr.magic != PSCNV_VRAM_TRACE_MAGIC ||
+			hdr.version != PSCNV_VRAM_TRACE_VERSION || hdr.rec_size < sizeof rec) {
+		fprintf(stderr, "%s: not a VRAM trace, or an unsupported version\n", argv[optind]);
+		return 1;
+	}
+	pad = malloc(hdr.rec_size - sizeof rec + 1);
+	pscnv_vram_policy = policy >= 0 ? policy : hdr.policy;
+
+	if (fake_memctl(hdr.vram_size, hdr.rblock_size))
+		return 1;
+
+	printf("# %s: %llu records, %llu dropped, VRAM size %#llx, rblock %#x, policy %d\n",
+			argv[optind], (unsigned long long)hdr.nrecs, (unsigned long long)hdr.dropped,
+			(unsigned long long)hdr.vram_size, hdr.rblock_size, pscnv_vram_policy);
+	printf("# event time_ms used free largest_extent free_extents fragmentation fails\n");
+	for (i = 0; i < hdr.nrecs; i++) {
+		if (fread(&rec, sizeof rec, 1, f) != 1 ||
+				fread(pad, hdr.rec_size - sizeof rec, 1, f) != (hdr.rec_size > sizeof rec)) {
+			fprintf(stderr, "trace truncated at record %llu\n", (unsigned long long)i);
+			break;
+		}
+		if (rec.serial != ~0u && rec.serial >= nvos) {
+			size_t n = rec.serial + 1 > nvos * 2 ? rec.serial + 1 : nvos * 2;
+			vos = realloc(vos, n * sizeof *vos);
+			memset(vos + nvos, 0, (n - nvos) * sizeof *vos);
+			nvos = n;
+		}
+		if (rec.op == PSCNV_VRAM_TRACE_MOVE && rec.aux >= nvos)
+			rec.op = 0;
+		switch (rec.op) {
+			case PSCNV_VRAM_TRACE_ALLOC:
+				lat_add(&talloc, rec.latency);
+				if (rec.serial == ~0u)
+					tfails++;
+				t = now();
+				a = pscnv_vram_alloc(&vram_stub_dev, rec.size, rec.align, rec.flags, rec.tile_flags, rec.cookie);
+				lat_add(&lalloc, now() - t);
+				if (!a)
+					fails++;
+				else if (rec.serial == ~0u)
+					/* the original failed, so it's never freed */
+					pscnv_vram_free(a);
+				else
+					vos[rec.serial] = a;
+				break;
+			case PSCNV_VRAM_TRACE_FREE:
+				lat_add(&tfree, rec.latency);
+				a = vos[rec.serial];
+				if (!a) {
+					/* allocated before the trace starts, or failed here */
+					skipped++;
+					break;
+				}
+				vos[rec.serial] = 0;
+				t = now();
+				pscnv_vram_free(a);
+				lat_add(&lfree, now() - t);
+				break;
+			case PSCNV_VRAM_TRACE_MOVE:
+				a = vos[rec.serial];
+				b = vos[rec.aux];
+				if (!a || !b || a->size != b->size) {
+					skipped++;
+					break;
+				}
+				list_splice_init(&a->regions, &regions);
+				list_splice_init(&b->regions, &a->regions);
+				list_splice_init(&regions, &b->regions);
+				list_for_each_entry(reg, &a->regions, local_list)
+					reg->vo = a;
+				list_for_each_entry(reg, &b->regions, local_list)
+					reg->vo = b;
+				tmp = a->start;
+				a->start = b->start;
+				b->start = tmp;
+				break;
+			default:
+				skipped++;
+				break;
+		}
+		if (!((i + 1) % interval))
+			sample(i + 1, rec.time, fails);
+	}
+	if (i % interval)
+		sample(i, rec.time, fails);
+
+	lat_print("replayed alloc", &lalloc);
+	lat_print("replayed free", &lfree);
+	lat_print("traced alloc", &talloc);
+	lat_print("traced free", &tfree);
+	printf("# %d allocs failed, %d failed in the trace, %d records skipped\n", fails, tfails, skipped);
+	printf("# rblocks typed: %llu sane, %llu LSR, untyped: %llu sane, %llu LSR\n",
+			(unsigned long long)vram_stub_priv.vram_typed[0],
+			(unsigned long long)vram_stub_priv.vram_typed[1],
+			(unsigned long long)vram_stub_priv.vram_untyped[0],
+			(unsigned long long)vram_stub_priv.vram_untyped[1]);
+
+	for (i = 0; i < nvos; i++)
+		if (vos[i])
+			pscnv_vram_free(vos[i]);
+	pscnv_vram_takedown(&vram_stub_dev);
+	fclose(f);
+	return 0;
+}
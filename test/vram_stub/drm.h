@@ -0,0 +1 @@
+/* everything is in drmP.h */
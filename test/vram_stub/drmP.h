@@ -0,0 +1,199 @@
+/* Just enough of the kernel and of drm_nouveau_private to build
+ * pscnv_vram.c, pscnv_vm_tree.c and pscnv_compact.c in userspace, for the
+ * host tools here.
+ * Keep the private struct in sync with the VRAM fields of the real one in
+ * nouveau_drv.h. */
+
+#ifndef VRAM_STUB_DRMP_H
+#define VRAM_STUB_DRMP_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+/* keep the real nouveau_drv.h out, this file stands in for it */
+#define __NOUVEAU_DRV_H__
+
+#define GFP_KERNEL 0
+#define ENOMEM 12
+#define EINVAL 22
+#define ENODEV 19
+#define ENOENT 2
+#define EBUSY 16
+#define ENOSPC 28
+#define DRM_MTRR_WC 1
+
+#define ALIGN(x, a) (((x) + (a) - 1) & ~((__typeof__(x))(a) - 1))
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#define max(a, b) ((a) > (b) ? (a) : (b))
+#define container_of(p, t, m) ((t *)((char *)(p) - offsetof(t, m)))
+
+static inline void *kmalloc(size_t size, int flags) { return malloc(size); }
+static inline void *kzalloc(size_t size, int flags) { return calloc(1, size); }
+static inline void kfree(const void *p) { free((void *)p); }
+
+static inline int ilog2(uint64_t x) { return 63 - __builtin_clzll(x); }
+static inline int order_base_2(uint64_t x) { return x <= 1 ? 0 : ilog2(x - 1) + 1; }
+static inline int is_power_of_2(uint64_t x) { return x && !(x & (x - 1)); }
+
+/* single threaded */
+struct mutex { int locked; };
+typedef struct { int locked; } spinlock_t;
+static inline void mutex_init(struct mutex *m) { m->locked = 0; }
+static inline void mutex_lock(struct mutex *m) { m->locked = 1; }
+static inline int mutex_trylock(struct mutex *m) { return m->locked ? 0 : (m->locked = 1); }
+static inline void mutex_unlock(struct mutex *m) { m->locked = 0; }
+static inline void spin_lock_init(spinlock_t *l) { }
+static inline void spin_lock(spinlock_t *l) { }
+static inline void spin_unlock(spinlock_t *l) { }
+
+struct list_head { struct list_head *next, *prev; };
+#define LIST_HEAD_INIT(name) { &(name), &(name) }
+#define LIST_HEAD(name) struct list_head name = LIST_HEAD_INIT(name)
+static inline void INIT_LIST_HEAD(struct list_head *l) { l->next = l->prev = l; }
+static inline void __list_add(struct list_head *n, struct list_head *prev, struct list_head *next)
+{
+	next->prev = n;
+	n->next = next;
+	n->prev = prev;
+	prev->next = n;
+}
+static inline void list_add(struct list_head *n, struct list_head *head) { __list_add(n, head, head->next); }
+static inline void list_add_tail(struct list_head *n, struct list_head *head) { __list_add(n, head->prev, head); }
+static inline void list_del(struct list_head *e)
+{
+	e->next->prev = e->prev;
+	e->prev->next = e->next;
+	e->next = e->prev = 0;
+}
+static inline int list_empty(const struct list_head *head) { return head->next == head; }
+static inline void list_splice_init(struct list_head *list, struct list_head *head)
+{
+	if (!list_empty(list)) {
+		list->next->prev = head;
+		list->prev->next = head->next;
+		head->next->prev = list->prev;
+		head->next = list->next;
+		INIT_LIST_HEAD(list);
+	}
+}
+#define list_entry(p, t, m) container_of(p, t, m)
+#define list_first_entry(p, t, m) list_entry((p)->next, t, m)
+#define list_for_each(p, h) for (p = (h)->next; p != (h); p = p->next)
+#define list_for_each_safe(p, n, h) for (p = (h)->next, n = p->next; p != (h); p = n, n = p->next)
+#define list_for_each_entry(p, h, m) \
+	for (p = list_entry((h)->next, __typeof__(*p), m); &p->m != (h); p = list_entry(p->m.next, __typeof__(*p), m))
+#define list_for_each_entry_reverse(p, h, m) \
+	for (p = list_entry((h)->prev, __typeof__(*p), m); &p->m != (h); p = list_entry(p->m.prev, __typeof__(*p), m))
+
+/* no background work either */
+#define HZ 100
+struct work_struct { int pending; };
+struct delayed_work { struct work_struct work; };
+#define INIT_DELAYED_WORK(w, f) ((void)(w), (void)(f))
+static inline int schedule_delayed_work(struct delayed_work *w, unsigned long delay) { return 0; }
+static inline int cancel_delayed_work_sync(struct delayed_work *w) { return 0; }
+
+struct drm_device {
+	void *dev_private;
+};
+
+struct kref { int refcount; };
+struct drm_file;
+struct drm_gem_object;
+struct file;
+struct vm_area_struct;
+
+#include "pscnv_vram.h"
+
+enum nouveau_card_type {
+	NV_50 = 0x50,
+};
+
+struct drm_nouveau_private {
+	struct drm_device *dev;
+	enum nouveau_card_type card_type;
+	int chipset;
+	struct pscnv_vm_engine *vm;
+	uint32_t *mmio;
+	spinlock_t pramin_lock;
+	uint64_t pramin_start;
+	int fb_mtrr;
+
+	uint64_t vram_size;
+	uint64_t vram_sys_base;
+	struct list_head vram_global_list;
+	struct pscnv_vram_freetree vram_free_tree[PSCNV_VRAM_LAST_FREE + 1];
+	struct list_head vram_free_bucket[PSCNV_VRAM_LAST_FREE + 1][PSCNV_VRAM_BUCKETS];
+	uint32_t vram_rblock_size;
+	uint64_t vram_free_bytes[PSCNV_VRAM_LAST_FREE + 1];
+	uint64_t vram_reserve[2];
+	uint64_t vram_typed[2];
+	uint64_t vram_untyped[2];
+	int vram_parts;
+	uint32_t vram_row_size;
+	uint32_t vram_part_stride;
+	uint64_t vram_hot_row[2];
+	struct mutex vram_mutex;
+	struct list_head vram_pool;
+	int vram_pool_count;
+	spinlock_t vram_pool_lock;
+	struct pscnv_vram_slab *vram_slab;
+	struct pscnv_vram_mover *vram_mover;
+	struct mutex vram_compact_mutex;
+	struct delayed_work vram_compact_work;
+	uint64_t vram_compact_moved;
+	uint64_t vram_compact_bytes;
+};
+
+#define NV_PRINTK(d, fmt, arg...) fprintf(stderr, "vram: " fmt, ##arg)
+#define NV_ERROR(d, fmt, arg...) NV_PRINTK(d, fmt, ##arg)
+#define NV_WARN(d, fmt, arg...) NV_PRINTK(d, fmt, ##arg)
+#define NV_INFO(d, fmt, arg...) NV_PRINTK(d, fmt, ##arg)
+
+/* VRAM contents behind the PRAMIN window, for tools that look at them */
+extern uint32_t *vram_stub_vram;
+
+static inline uint32_t *vram_stub_reg(struct drm_device *dev, uint32_t reg)
+{
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	if (vram_stub_vram && reg >= 0x700000 && reg < 0x710000)
+		return &vram_stub_vram[((uint64_t)dev_priv->mmio[0x1700 / 4] << 16 | (reg & 0xffff)) / 4];
+	return &dev_priv->mmio[reg / 4];
+}
+
+static inline uint32_t nv_rd32(struct drm_device *dev, uint32_t reg)
+{
+	return *vram_stub_reg(dev, reg);
+}
+
+static inline void nv_wr32(struct drm_device *dev, uint32_t reg, uint32_t val)
+{
+	*vram_stub_reg(dev, reg) = val;
+}
+
+static inline unsigned long drm_get_resource_start(struct drm_device *dev, int res) { return 0; }
+static inline unsigned long drm_get_resource_len(struct drm_device *dev, int res) { return 0; }
+static inline int drm_mtrr_add(unsigned long start, unsigned long len, int flags) { return -1; }
+static inline int drm_mtrr_del(int mtrr, unsigned long start, unsigned long len, int flags) { return 0; }
+
+extern int pscnv_vram_debug;
+extern int pscnv_vram_policy;
+extern int pscnv_vram_compact_mode;
+extern int pscnv_vram_reserve_sane;
+extern int pscnv_vram_reserve_lsr;
+extern int pscnv_vm_debug;
+
+/* the VM isn't there, and neither are its callers */
+struct pscnv_vm_mapnode;
+struct pscnv_vm_engine;
+extern int pscnv_vspace_unmap_node(struct pscnv_vm_mapnode *);
+extern void pscnv_vo_bar1_release(struct pscnv_vo *);
+
+/* vram_stub.c */
+extern struct drm_device vram_stub_dev;
+extern struct drm_nouveau_private vram_stub_priv;
+extern int vram_stub_init(uint64_t vram_size, int parts, int banks, int colbits, int rowbits, int tri);
+
+#endif
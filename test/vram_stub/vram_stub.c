@@ -0,0 +1,102 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * Copyright 2010 PathScale Inc.  All rights reserved.
+ * Use is subject to license terms.
+ */
+
+/* The rest of the driver, as far as pscnv_vram.c cares, and a fake NV50
+ * memory controller to init it with. */
+
+#include <stdlib.h>
+#include "drmP.h"
+#include "pscnv_vram.h"
+
+int pscnv_vram_debug = 0;
+int pscnv_vram_policy = PSCNV_VRAM_POLICY_FIRST_FIT;
+int pscnv_vram_compact_mode = PSCNV_VRAM_COMPACT_OFF;
+int pscnv_vram_reserve_sane = 4096;
+int pscnv_vram_reserve_lsr = 4096;
+int pscnv_vm_debug = 0;
+
+struct drm_device vram_stub_dev;
+struct drm_nouveau_private vram_stub_priv;
+uint32_t *vram_stub_vram;
+static uint32_t mmio[0x101000 / 4];
+
+int pscnv_vspace_unmap_node(struct pscnv_vm_mapnode *node) { return 0; }
+void pscnv_vo_bar1_release(struct pscnv_vo *vo) { }
+/* vram_compact links the real pscnv_compact.c */
+#ifndef VRAM_STUB_COMPACT
+void pscnv_vram_compact_init(struct drm_device *dev) { }
+void pscnv_vram_compact_takedown(struct drm_device *dev) { }
+void pscnv_vram_compact_kick(struct drm_device *dev) { }
+int pscnv_vram_compact(struct drm_device *dev) { return 0; }
+#endif
+void pscnv_vram_scrub_init(struct drm_device *dev) { }
+void pscnv_vram_scrub_takedown(struct drm_device *dev) { }
+struct pscnv_vo *pscnv_vram_scrub_take(struct drm_device *dev, uint64_t size, uint64_t align,
+		int flags, int tile_flags, uint32_t cookie) { return 0; }
+int pscnv_vram_scrub_clear(struct pscnv_vo *vo) { return 0; }
+void pscnv_vram_trace_init(struct drm_device *dev) { }
+void pscnv_vram_trace_takedown(struct drm_device *dev) { }
+uint64_t pscnv_vram_trace_clock(struct drm_device *dev) { return 0; }
+void pscnv_vram_trace_alloc(struct drm_device *dev, uint64_t t0, uint64_t size,
+		uint64_t align, int flags, int tile_flags, uint32_t cookie, struct pscnv_vo *res) { }
+void pscnv_vram_trace_free(struct pscnv_vo *vo, uint64_t t0) { }
+void pscnv_vram_trace_move(struct pscnv_vo *vo, struct pscnv_vo *tmp) { }
+
+struct pscnv_vram_slab *
+pscnv_vram_slab_new(struct drm_device *dev, uint32_t objsize, uint32_t cookie)
+{
+	return calloc(1, sizeof(struct pscnv_vram_slab));
+}
+
+void
+pscnv_vram_slab_destroy(struct pscnv_vram_slab *slab)
+{
+	free(slab);
+}
+
+void
+pscnv_vram_slab_free(struct pscnv_vo *vo)
+{
+	abort();
+}
+
+/* sets up memory controller regs for the given config, and inits the
+ * allocator with them. tri selects 3-row rblocks. */
+int
+vram_stub_init(uint64_t vram_size, int parts, int banks, int colbits, int rowbits, int tri)
+{
+	vram_stub_dev.dev_private = &vram_stub_priv;
+	vram_stub_priv.dev = &vram_stub_dev;
+	vram_stub_priv.card_type = NV_50;
+	vram_stub_priv.chipset = 0x50;
+	vram_stub_priv.mmio = mmio;
+	mmio[0x100200 / 4] = 0;
+	mmio[0x100204 / 4] = colbits << 12 | (rowbits - 8) << 16 | (banks == 8) << 24;
+	mmio[0x10020c / 4] = (vram_size & 0xfffff000) | (vram_size >> 32 & 0xff);
+	mmio[0x100250 / 4] = tri;
+	mmio[0x1540 / 4] = ((1 << parts) - 1) << 16;
+	return pscnv_vram_init(&vram_stub_dev);
+}